@@ -0,0 +1,357 @@
+////////////////////////////////////////////////////////////////////////
+// Bounding volume hierarchies.  See bvh.h for an overview.
+//
+// The builder works top down.  Each node bins its primitives'
+// centroids into BINS slabs along the longest axis of their bounds,
+// and splits at the slab boundary with the lowest surface area cost.
+// A node of n primitives may need up to 2n-1 nodes for its subtree,
+// so each subtree is given that many slots of a scratch array up
+// front; subtrees are then independent, and large ones are built as
+// OpenMP tasks.  A final depth first pass copies the used slots into
+// the compact node array.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <vector>
+#include <algorithm>
+#include <float.h>
+
+#include "framework.h"
+#include "bvh.h"
+#include "trace.h"
+
+const int BINS = 16;            // Split candidates per node
+const int TASK_SIZE = 8192;     // Subtrees at least this large are built as separate tasks
+const int SAH_DEPTH = 40;       // Deeper nodes split at the median, which bounds the depth
+
+static float HalfArea(const glm::vec3& lo, const glm::vec3& hi)
+{
+    const glm::vec3 e = glm::max(hi - lo, glm::vec3(0.0f));
+    return e.x*e.y + e.y*e.z + e.z*e.x;
+}
+
+// Moller-Trumbore
+static bool IntersectTriangle(const glm::vec3* v, const glm::vec3& o, const glm::vec3& d,
+                              float& t, float& b1, float& b2)
+{
+    const glm::vec3 e1 = v[1] - v[0], e2 = v[2] - v[0];
+    const glm::vec3 pv = glm::cross(d, e2);
+    const float det = glm::dot(e1, pv);
+    if (fabsf(det) < 1e-12f)
+        return false;
+    const float inv = 1.0f/det;
+    const glm::vec3 tv = o - v[0];
+    b1 = glm::dot(tv, pv)*inv;
+    if (b1 < 0.0f || b1 > 1.0f)
+        return false;
+    const glm::vec3 qv = glm::cross(tv, e1);
+    b2 = glm::dot(d, qv)*inv;
+    if (b2 < 0.0f || b1 + b2 > 1.0f)
+        return false;
+    t = glm::dot(e2, qv)*inv;
+    return t > 0.0f;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Bvh
+struct Bvh::Builder
+{
+    const std::vector<glm::vec3>& lo;
+    const std::vector<glm::vec3>& hi;
+    std::vector<glm::vec3> centroid;
+    std::vector<int>& indices;
+    std::vector<Node> scratch;
+    int maxLeaf;
+
+    Builder(const std::vector<glm::vec3>& _lo, const std::vector<glm::vec3>& _hi, std::vector<int>& _indices)
+        : lo(_lo), hi(_hi), indices(_indices) {}
+
+    void Split(const int slot, const int first, const int last, const int depth);
+    int Flatten(const int slot, std::vector<Node>& nodes) const;
+};
+
+// Build the subtree over indices[first, last) into scratch slots [slot, slot + 2n-1).
+void Bvh::Builder::Split(const int slot, const int first, const int last, const int depth)
+{
+    glm::vec3 bLo(FLT_MAX), bHi(-FLT_MAX), cLo(FLT_MAX), cHi(-FLT_MAX);
+    for (int i=first;  i<last;  i++) {
+        const int p = indices[i];
+        bLo = glm::min(bLo, lo[p]);
+        bHi = glm::max(bHi, hi[p]);
+        cLo = glm::min(cLo, centroid[p]);
+        cHi = glm::max(cHi, centroid[p]); }
+    Node& node = scratch[slot];
+    node.lo = bLo;
+    node.hi = bHi;
+    node.count = last - first;
+    node.index = first;
+
+    const int n = last - first;
+    if (n == 1)
+        return;
+    int axis = 0;
+    for (int k=1;  k<3;  k++)
+        if (cHi[k] - cLo[k] > cHi[axis] - cLo[axis])
+            axis = k;
+    const float extent = cHi[axis] - cLo[axis];
+
+    int mid = first;
+    if (extent > 0.0f && depth < SAH_DEPTH) {
+        struct Bin { glm::vec3 lo, hi; int count; } bins[BINS];
+        for (int b=0;  b<BINS;  b++) {
+            bins[b].lo = glm::vec3(FLT_MAX);
+            bins[b].hi = glm::vec3(-FLT_MAX);
+            bins[b].count = 0; }
+        const float scale = BINS/extent;
+        for (int i=first;  i<last;  i++) {
+            const int p = indices[i];
+            Bin& bin = bins[std::min(BINS-1, (int)((centroid[p][axis] - cLo[axis])*scale))];
+            bin.count++;
+            bin.lo = glm::min(bin.lo, lo[p]);
+            bin.hi = glm::max(bin.hi, hi[p]); }
+
+        // Sweep from the right for the cost of each right side, then from the left.
+        float rightCost[BINS];
+        glm::vec3 rLo(FLT_MAX), rHi(-FLT_MAX);
+        int rCount = 0;
+        for (int b=BINS-1;  b>0;  b--) {
+            rLo = glm::min(rLo, bins[b].lo);
+            rHi = glm::max(rHi, bins[b].hi);
+            rCount += bins[b].count;
+            rightCost[b] = rCount ? rCount*HalfArea(rLo, rHi) : 0.0f; }
+        glm::vec3 lLo(FLT_MAX), lHi(-FLT_MAX);
+        int lCount = 0, best = 0;
+        float bestCost = FLT_MAX;
+        for (int b=0;  b<BINS-1;  b++) {
+            lLo = glm::min(lLo, bins[b].lo);
+            lHi = glm::max(lHi, bins[b].hi);
+            lCount += bins[b].count;
+            const float cost = (lCount ? lCount*HalfArea(lLo, lHi) : 0.0f) + rightCost[b+1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = b; } }
+
+        // Stay a leaf if testing every primitive is cheaper than a
+        // traversal step plus the expected tests of the children.
+        const float area = HalfArea(bLo, bHi);
+        if (n <= maxLeaf && (area <= 0.0f || n <= 1.0f + bestCost/area))
+            return;
+
+        const std::vector<glm::vec3>& c = centroid;
+        const float cMin = cLo[axis];
+        mid = (int)(std::partition(indices.begin() + first, indices.begin() + last, [&](const int p) {
+                    return std::min(BINS-1, (int)((c[p][axis] - cMin)*scale)) <= best; }) - indices.begin()); }
+    else if (n <= maxLeaf)
+        return;
+
+    // Coincident centroids, too deep, or a degenerate split: halve at the median
+    if (mid == first || mid == last) {
+        mid = (first + last)/2;
+        const std::vector<glm::vec3>& c = centroid;
+        std::nth_element(indices.begin() + first, indices.begin() + mid, indices.begin() + last,
+                         [&](const int a, const int b) { return c[a][axis] < c[b][axis]; }); }
+
+    const int right = slot + 2*(mid - first);
+    node.count = 0;
+    node.index = right;
+    if (n >= TASK_SIZE) {
+#pragma omp task
+        Split(slot + 1, first, mid, depth + 1);
+#pragma omp task
+        Split(right, mid, last, depth + 1); }
+    else {
+        Split(slot + 1, first, mid, depth + 1);
+        Split(right, mid, last, depth + 1); }
+}
+
+int Bvh::Builder::Flatten(const int slot, std::vector<Node>& nodes) const
+{
+    const int index = (int)nodes.size();
+    nodes.push_back(scratch[slot]);
+    if (scratch[slot].count == 0) {
+        Flatten(slot + 1, nodes);
+        const int right = Flatten(scratch[slot].index, nodes);
+        nodes[index].index = right; }
+    return index;
+}
+
+void Bvh::Build(const std::vector<glm::vec3>& lo, const std::vector<glm::vec3>& hi, const int maxLeaf)
+{
+    const int n = (int)lo.size();
+    nodes.clear();
+    indices.resize(n);
+    if (n == 0)
+        return;
+
+    Builder builder(lo, hi, indices);
+    builder.maxLeaf = std::max(1, maxLeaf);
+    builder.centroid.resize(n);
+    builder.scratch.resize(2*n - 1);
+    for (int i=0;  i<n;  i++) {
+        indices[i] = i;
+        builder.centroid[i] = 0.5f*(lo[i] + hi[i]); }
+
+#pragma omp parallel
+#pragma omp single
+    builder.Split(0, 0, n, 0);
+
+    nodes.reserve(2*n - 1);
+    builder.Flatten(0, nodes);
+}
+
+// Children follow their parents, so a backwards pass meets each node
+// after both its children.
+void Bvh::Refit(const std::vector<glm::vec3>& lo, const std::vector<glm::vec3>& hi)
+{
+    for (int i=(int)nodes.size() - 1;  i>=0;  i--) {
+        Node& n = nodes[i];
+        if (n.count) {
+            n.lo = glm::vec3(FLT_MAX);
+            n.hi = glm::vec3(-FLT_MAX);
+            for (int k=n.index;  k<n.index + n.count;  k++) {
+                n.lo = glm::min(n.lo, lo[indices[k]]);
+                n.hi = glm::max(n.hi, hi[indices[k]]); } }
+        else {
+            n.lo = glm::min(nodes[i + 1].lo, nodes[n.index].lo);
+            n.hi = glm::max(nodes[i + 1].hi, nodes[n.index].hi); } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// MeshBvh
+void MeshBvh::Build(const Shape* _shape)
+{
+    shape = _shape;
+    const int n = (int)shape->Tri.size();
+    std::vector<glm::vec3> lo(n), hi(n);
+    for (int i=0;  i<n;  i++) {
+        lo[i] = glm::vec3(FLT_MAX);
+        hi[i] = glm::vec3(-FLT_MAX);
+        for (int k=0;  k<3;  k++) {
+            const glm::vec3 p = shape->Pnt[shape->Tri[i][k]].xyz();
+            lo[i] = glm::min(lo[i], p);
+            hi[i] = glm::max(hi[i], p); } }
+    bvh.Build(lo, hi);
+
+    verts.resize(3*n);
+    for (int i=0;  i<n;  i++)
+        for (int k=0;  k<3;  k++)
+            verts[3*i+k] = shape->Pnt[shape->Tri[bvh.indices[i]][k]].xyz();
+}
+
+bool MeshBvh::Intersect(const glm::vec3& o, const glm::vec3& d, const float tMax, RayHit& hit) const
+{
+    bool found = false;
+    bvh.Traverse(o, d, tMax, [&](const int first, const int count, float& tNear) {
+            for (int i=first;  i<first + count;  i++) {
+                float t, b1, b2;
+                if (IntersectTriangle(&verts[3*i], o, d, t, b1, b2) && t < tNear) {
+                    tNear = hit.t = t;
+                    hit.b1 = b1;
+                    hit.b2 = b2;
+                    hit.tri = bvh.indices[i];
+                    found = true; } }
+            return true; });
+    return found;
+}
+
+bool MeshBvh::Occluded(const glm::vec3& o, const glm::vec3& d, const float tMax) const
+{
+    bool found = false;
+    bvh.Traverse(o, d, tMax, [&](const int first, const int count, float& tNear) {
+            for (int i=first;  i<first + count;  i++) {
+                float t, b1, b2;
+                if (IntersectTriangle(&verts[3*i], o, d, t, b1, b2) && t < tNear) {
+                    found = true;
+                    return false; } }
+            return true; });
+    return found;
+}
+
+void MeshBvh::Query(const glm::vec3& lo, const glm::vec3& hi, std::vector<int>& tris) const
+{
+    bvh.Query(lo, hi, [&](const int first, const int count) {
+            for (int i=first;  i<first + count;  i++) {
+                const glm::vec3* v = &verts[3*i];
+                const glm::vec3 tLo = glm::min(v[0], glm::min(v[1], v[2]));
+                const glm::vec3 tHi = glm::max(v[0], glm::max(v[1], v[2]));
+                if (Bvh::Overlap(lo, hi, tLo, tHi))
+                    tris.push_back(bvh.indices[i]); } });
+}
+
+////////////////////////////////////////////////////////////////////////
+// SceneBvh
+void SceneBvh::Build(const RenderList& list, const int excludeId)
+{
+    TRACE_SCOPE("SceneBvh::Build");
+    instances.clear();
+    std::vector<int> drawn;
+    list.Drawn(drawn);
+    for (size_t d=0;  d<drawn.size();  d++) {
+        const int i = drawn[d];
+        const Object* object = list.objects[i];
+        if (object->shape->Tri.empty() || object->objectId == excludeId)
+            continue;
+        MeshBvh& mesh = meshes[object->shape];
+        if (mesh.bvh.Empty())
+            mesh.Build(object->shape);
+
+        Instance instance;
+        instance.object = object;
+        instance.mesh = &mesh;
+        instance.modelTr = list.modelTrs[i];
+        instance.inverseTr = list.inverseTrs[i];
+        instance.normalTr = glm::transpose(glm::mat3(instance.inverseTr));
+        instance.lo = list.lo[i];
+        instance.hi = list.hi[i];
+        for (int e=i;  list.parents[e] >= 0;  e=list.parents[e])
+            instance.path.push_back(list.slots[e]);
+        std::reverse(instance.path.begin(), instance.path.end());
+        instances.push_back(instance); }
+
+    std::vector<glm::vec3> lo(instances.size()), hi(instances.size());
+    for (size_t i=0;  i<instances.size();  i++) {
+        lo[i] = instances[i].lo;
+        hi[i] = instances[i].hi; }
+    bvh.Build(lo, hi, 1);
+}
+
+// The ray goes into each instance's object space untransformed in
+// length, so distances there are distances along the world ray.
+bool SceneBvh::Intersect(const glm::vec3& o, const glm::vec3& d, const float tMax, RayHit& hit) const
+{
+    bool found = false;
+    bvh.Traverse(o, d, tMax, [&](const int first, const int count, float& tNear) {
+            for (int i=first;  i<first + count;  i++) {
+                const Instance& instance = instances[bvh.indices[i]];
+                const glm::vec3 lo = (instance.inverseTr*glm::vec4(o, 1.0f)).xyz();
+                const glm::vec3 ld = glm::mat3(instance.inverseTr)*d;
+                if (instance.mesh->Intersect(lo, ld, tNear, hit)) {
+                    tNear = hit.t;
+                    hit.instance = bvh.indices[i];
+                    found = true; } }
+            return true; });
+    return found;
+}
+
+bool SceneBvh::Occluded(const glm::vec3& o, const glm::vec3& d, const float tMax) const
+{
+    bool found = false;
+    bvh.Traverse(o, d, tMax, [&](const int first, const int count, float& tNear) {
+            for (int i=first;  i<first + count;  i++) {
+                const Instance& instance = instances[bvh.indices[i]];
+                const glm::vec3 lo = (instance.inverseTr*glm::vec4(o, 1.0f)).xyz();
+                if (instance.mesh->Occluded(lo, glm::mat3(instance.inverseTr)*d, tNear)) {
+                    found = true;
+                    return false; } }
+            return true; });
+    return found;
+}
+
+void SceneBvh::Query(const glm::vec3& lo, const glm::vec3& hi, std::vector<int>& found) const
+{
+    bvh.Query(lo, hi, [&](const int first, const int count) {
+            for (int i=first;  i<first + count;  i++) {
+                const Instance& instance = instances[bvh.indices[i]];
+                if (Bvh::Overlap(lo, hi, instance.lo, instance.hi))
+                    found.push_back(bvh.indices[i]); } });
+}
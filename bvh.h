@@ -0,0 +1,214 @@
+////////////////////////////////////////////////////////////////////////
+// Bounding volume hierarchies for ray and box queries against the
+// scene's geometry.
+//
+// Bvh is the generic structure: built over any set of boxes with the
+// binned surface area heuristic, with subtrees built in parallel as
+// OpenMP tasks, and then flattened depth first into 32 byte nodes
+// (two to a cache line), where a node's left child immediately
+// follows it.
+//
+// The scene uses two levels:
+//   MeshBvh (the bottom level) holds one Shape's triangles in object
+//   space, and is built once per Shape no matter how often it is
+//   instanced.
+//   SceneBvh (the top level) takes the drawn instances of the
+//   RenderList, with their transformations and world space bounds
+//   (from the Shape's minP and maxP).  A query is transformed into each instance's object space
+//   to search its MeshBvh.
+// Shapes never change, so the mesh level is cached across calls to
+// SceneBvh::Build; the instance level is cheap and is simply rebuilt
+// when the transformations change.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _BVH_
+#define _BVH_
+
+#include <vector>
+#include <map>
+#include <algorithm>
+
+class Shape;
+class Object;
+class RenderList;
+
+class Bvh
+{
+public:
+    // An interior node's children are at its index+1 and at index; a
+    // leaf holds the primitives indices[index, index+count).
+    struct Node
+    {
+        glm::vec3 lo;
+        int count;
+        glm::vec3 hi;
+        int index;
+    };
+    std::vector<Node> nodes;
+    std::vector<int> indices;   // Primitive numbers, in leaf order
+
+    // Build over primitives with the given bounds.  Leaves hold at
+    // most maxLeaf primitives, fewer where splitting is cheaper.
+    void Build(const std::vector<glm::vec3>& lo, const std::vector<glm::vec3>& hi, const int maxLeaf=4);
+
+    // Recompute the bounds after primitives move, keeping the tree:
+    // cheaper than Build, though the tree degrades as they move far.
+    void Refit(const std::vector<glm::vec3>& lo, const std::vector<glm::vec3>& hi);
+
+    bool Empty() const { return nodes.empty(); }
+
+    // Visit the leaves a ray may hit before tMax, nearer ones first.
+    // leaf(first, count, tMax) tests indices[first, first+count), and
+    // may lower tMax on a hit; it returns false to end the search.
+    template <class Leaf>
+    void Traverse(const glm::vec3& o, const glm::vec3& d, float tMax, Leaf leaf) const;
+
+    // Visit the leaves overlapping a box: leaf(first, count).
+    template <class Leaf>
+    void Query(const glm::vec3& lo, const glm::vec3& hi, Leaf leaf) const;
+
+    // 1/d, with zero components replaced by a tiny value so Slab never
+    // computes 0*infinity.
+    static glm::vec3 Inverse(const glm::vec3& d)
+    {
+        return glm::vec3(1.0f/(d.x != 0.0f ? d.x : 1e-30f), 1.0f/(d.y != 0.0f ? d.y : 1e-30f),
+                         1.0f/(d.z != 0.0f ? d.z : 1e-30f));
+    }
+
+    // The ray's entry distance into a box, if it enters before tMax;
+    // inv is Inverse(d).
+    static bool Slab(const glm::vec3& lo, const glm::vec3& hi, const glm::vec3& o, const glm::vec3& inv,
+                     const float tMax, float& tNear)
+    {
+        const glm::vec3 t0 = (lo - o)*inv, t1 = (hi - o)*inv;
+        const glm::vec3 tMin = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        tNear = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+        return tNear <= std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    }
+
+    static bool Overlap(const glm::vec3& aLo, const glm::vec3& aHi, const glm::vec3& bLo, const glm::vec3& bHi)
+    {
+        return aLo.x <= bHi.x && aLo.y <= bHi.y && aLo.z <= bHi.z
+            && bLo.x <= aHi.x && bLo.y <= aHi.y && bLo.z <= aHi.z;
+    }
+
+private:
+    struct Builder;
+};
+
+// A ray's nearest hit
+struct RayHit
+{
+    float t;                    // Distance along the ray, in units of its direction
+    float b1, b2;               // Barycentrics of the triangle's second and third vertices
+    int tri;                    // Index into the Shape's Tri
+    int instance;               // Index into SceneBvh::instances
+};
+
+class MeshBvh
+{
+public:
+    const Shape* shape;
+    Bvh bvh;
+
+    MeshBvh() : shape(NULL) {}
+    void Build(const Shape* shape);
+
+    // Nearest hit before tMax, in object space; hit.instance is not set.
+    bool Intersect(const glm::vec3& o, const glm::vec3& d, const float tMax, RayHit& hit) const;
+    bool Occluded(const glm::vec3& o, const glm::vec3& d, const float tMax) const;
+
+    // Append the triangles (indices into Tri) whose bounds overlap a box.
+    void Query(const glm::vec3& lo, const glm::vec3& hi, std::vector<int>& tris) const;
+
+private:
+    std::vector<glm::vec3> verts;       // Three per triangle, in leaf order
+};
+
+class SceneBvh
+{
+public:
+    struct Instance
+    {
+        const Object* object;
+        const MeshBvh* mesh;
+        glm::mat4 modelTr, inverseTr;
+        glm::mat3 normalTr;     // Transpose of the inverse, as the shaders transform normals
+        glm::vec3 lo, hi;       // World space bounds
+        std::vector<int> path;  // Indices into Object::instances from the root down to this object
+    };
+    std::vector<Instance> instances;
+    Bvh bvh;
+
+    // Gather the instances the list draws (except those with objectId
+    // excludeId), as of its last Update, and build the top level.
+    void Build(const RenderList& list, const int excludeId=-1);
+
+    // Nearest hit before tMax, in world space.
+    bool Intersect(const glm::vec3& o, const glm::vec3& d, const float tMax, RayHit& hit) const;
+    bool Occluded(const glm::vec3& o, const glm::vec3& d, const float tMax) const;
+
+    // Append the instances whose world bounds overlap a box.
+    void Query(const glm::vec3& lo, const glm::vec3& hi, std::vector<int>& found) const;
+
+private:
+    std::map<const Shape*, MeshBvh> meshes;
+};
+
+////////////////////////////////////////////////////////////////////////
+// Traversal
+template <class Leaf>
+void Bvh::Traverse(const glm::vec3& o, const glm::vec3& d, float tMax, Leaf leaf) const
+{
+    if (nodes.empty())
+        return;
+    const glm::vec3 inv = Inverse(d);
+    float tNear;
+    if (!Slab(nodes[0].lo, nodes[0].hi, o, inv, tMax, tNear))
+        return;
+    int stack[64], top = 0;
+    int node = 0;
+    for (;;) {
+        const Node& n = nodes[node];
+        if (n.count) {
+            if (!leaf(n.index, n.count, tMax))
+                return; }
+        else {
+            int a = node + 1, b = n.index;
+            float ta, tb;
+            const bool hitA = Slab(nodes[a].lo, nodes[a].hi, o, inv, tMax, ta);
+            const bool hitB = Slab(nodes[b].lo, nodes[b].hi, o, inv, tMax, tb);
+            if (hitA && hitB) {
+                if (tb < ta)
+                    std::swap(a, b);
+                stack[top++] = b;
+                node = a;
+                continue; }
+            if (hitA || hitB) {
+                node = hitA ? a : b;
+                continue; } }
+        if (top == 0)
+            return;
+        node = stack[--top]; }
+}
+
+template <class Leaf>
+void Bvh::Query(const glm::vec3& lo, const glm::vec3& hi, Leaf leaf) const
+{
+    if (nodes.empty())
+        return;
+    int stack[64], top = 0;
+    stack[top++] = 0;
+    while (top) {
+        const int node = stack[--top];
+        const Node& n = nodes[node];
+        if (!Overlap(lo, hi, n.lo, n.hi))
+            continue;
+        if (n.count)
+            leaf(n.index, n.count);
+        else {
+            stack[top++] = n.index;
+            stack[top++] = node + 1; } }
+}
+
+#endif
@@ -1,5 +1,367 @@
+////////////////////////////////////////////////////////////////////////
+// A software emulation of the graphics pipeline.  See emulator.h for
+// the overall structure, and raster.cpp for the rasterization
+// conventions, which follow OpenGL's.
+////////////////////////////////////////////////////////////////////////
 
+#include "math.h"
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
 
+#include "framework.h"
+#include "emulator.h"
+#include "trace.h"
 
+bool hasGL = true;
 
-// This file is intentionally blank
+#ifdef EM
+
+const int VERTEX_BATCH = 4096;  // Vertices per task of the vertex stage
+
+// Offsets of the varyings in Vertex::v
+enum { WORLD=0, NORMAL=3, TANGENT=6, TEX=9, SHADOW=11 };
+
+Emulator::Emulator()
+    : width(0), height(0), trianglesIn(0), trianglesDrawn(0), shadowTime(0.0), lightingTime(0.0),
+      scene(NULL), shadowSize(1024),
+      blitProgram(NULL), blitTexture(0), blitVao(0)
+{}
+
+void Emulator::DrawScene(const Scene& _scene)
+{
+    scene = &_scene;
+    if (width != scene->width || height != scene->height) {
+        width = scene->width;
+        height = scene->height;
+        color.resize(4*width*height); }
+    shadowMap.resize(shadowSize*shadowSize);
+
+    CollectDraws(scene->renderList);
+
+    // Shadow pass, into a map cleared like the shadow FBO
+    double start = Trace::Now();
+    Pass pass;
+    pass.viewProj = scene->WorldProj*scene->LightView;
+    pass.width = pass.height = shadowSize;
+    pass.cull = Rasterizer::CULL_FRONT;
+    pass.shade = false;
+    DrawPass(pass);
+    shadowTime = Trace::Now() - start;
+
+    // Lighting pass, into color cleared to the same grey as glClearColor
+    start = Trace::Now();
+    pass.viewProj = scene->WorldProj*scene->WorldView;
+    pass.shadowMatrix = scene->ShadowMatrix;
+    pass.eyePos = (scene->WorldInverse*glm::vec4(0, 0, 0, 1)).xyz();
+    pass.width = width;
+    pass.height = height;
+    pass.cull = Rasterizer::CULL_NONE;
+    pass.shade = true;
+    DrawPass(pass);
+    lightingTime = Trace::Now() - start;
+}
+
+// The entries the passes would draw, as of the list's last Update.
+void Emulator::CollectDraws(const RenderList& list)
+{
+    std::vector<int> drawn;
+    list.Drawn(drawn);
+    draws.clear();
+    for (size_t k=0;  k<drawn.size();  k++) {
+        const int i = drawn[k];
+        if (list.objects[i]->shape->Tri.empty())
+            continue;
+        DrawItem d;
+        d.object = list.objects[i];
+        d.modelTr = list.modelTrs[i];
+        d.normalTr = glm::transpose(glm::mat3(list.inverseTrs[i]));
+        draws.push_back(d); }
+}
+
+////////////////////////////////////////////////////////////////////////
+// A pass: the vertex stage, rasterization, and then each pixel's
+// output from its visible triangle
+void Emulator::DrawPass(const Pass& pass)
+{
+    // Vertex stage, in batches of vertices across all draws
+    std::vector<int> jobs;      // Pairs of draw, first vertex
+    vertices.resize(draws.size());
+    for (int d=0;  d<(int)draws.size();  d++) {
+        const int n = (int)draws[d].object->shape->Pnt.size();
+        vertices[d].resize(n);
+        for (int first=0;  first<n;  first+=VERTEX_BATCH) {
+            jobs.push_back(d);
+            jobs.push_back(first); } }
+#pragma omp parallel for schedule(dynamic)
+    for (int j=0;  j<(int)jobs.size()/2;  j++) {
+        const int d = jobs[2*j], first = jobs[2*j+1];
+        TransformVertices(pass, d, first, std::min(first+VERTEX_BATCH, (int)vertices[d].size())); }
+
+    // Draws are queued in order, so their indices are the Rasterizer's
+    raster.Begin(pass.width, pass.height);
+    for (int d=0;  d<(int)draws.size();  d++) {
+        const std::vector<glm::ivec3>& tris = draws[d].object->shape->Tri;
+        raster.Draw(&vertices[d][0].clip, sizeof(Vertex), &tris[0], (int)tris.size(), pass.cull); }
+    raster.Flush();
+    trianglesIn = (int)raster.trianglesIn;
+    trianglesDrawn = (int)raster.trianglesDrawn;
+
+#pragma omp parallel for schedule(dynamic)
+    for (int y=0;  y<pass.height;  y++)
+        for (int x=0;  x<pass.width;  x++) {
+            const Rasterizer::Triangle* t = raster.visible[y*pass.width + x];
+            if (!pass.shade) {
+                // shadow.frag writes the light's clip position; only w
+                // is read.  The map is cleared like the shadow FBO.
+                shadowMap[y*pass.width + x] = t ? t->W(x, y) : 0.5f;
+                continue; }
+
+            // Cleared to the same grey as glClearColor
+            unsigned char* out = &color[4*(y*width + x)];
+            out[3] = 255;
+            if (!t) {
+                out[0] = out[1] = out[2] = 128;
+                continue; }
+            const glm::vec3 c = ShadePixel(pass, *t, x, y);
+            for (int k=0;  k<3;  k++)
+                out[k] = c[k] > 0.0f ? (unsigned char)(std::min(c[k], 1.0f)*255.0f + 0.5f) : 0; }
+}
+
+// The vertex stage: lighting.vert (or shadow.vert) for vertices [first, last) of a draw.
+void Emulator::TransformVertices(const Pass& pass, const int draw, const int first, const int last)
+{
+    const DrawItem& d = draws[draw];
+    const Shape* shape = d.object->shape;
+    const glm::mat4 mvp = pass.viewProj*d.modelTr;
+    const glm::mat3 tanTr(d.modelTr);
+    const glm::mat4& texTr = d.object->textureTransform;
+    for (int i=first;  i<last;  i++) {
+        Vertex& v = vertices[draw][i];
+        v.clip = mvp*shape->Pnt[i];
+        if (!pass.shade)
+            continue;
+
+        const glm::vec4 world = d.modelTr*shape->Pnt[i];
+        const glm::vec3 normal = i < (int)shape->Nrm.size() ? d.normalTr*shape->Nrm[i] : glm::vec3(0.0f);
+        const glm::vec3 tangent = i < (int)shape->Tan.size() ? tanTr*shape->Tan[i] : glm::vec3(0.0f);
+        const glm::vec2 tex = i < (int)shape->Tex.size() ? (texTr*glm::vec4(shape->Tex[i], 0.0f, 0.0f)).xy() : glm::vec2(0.0f);
+        const glm::vec4 shadow = pass.shadowMatrix*world;
+        for (int c=0;  c<3;  c++) {
+            v.v[WORLD+c] = world[c];
+            v.v[NORMAL+c] = normal[c];
+            v.v[TANGENT+c] = tangent[c]; }
+        v.v[TEX+0] = tex.x;
+        v.v[TEX+1] = tex.y;
+        for (int c=0;  c<4;  c++)
+            v.v[SHADOW+c] = shadow[c]; }
+}
+
+// The shadow FBO's texture, with GL_LINEAR filtering and clamping to the edge
+float Emulator::ShadowLookup(const glm::vec2& uv) const
+{
+    const float x = uv.x*shadowSize - 0.5f, y = uv.y*shadowSize - 0.5f;
+    const int x0 = std::max(0, std::min((int)floorf(x), shadowSize-1));
+    const int y0 = std::max(0, std::min((int)floorf(y), shadowSize-1));
+    const int x1 = std::min(x0+1, shadowSize-1), y1 = std::min(y0+1, shadowSize-1);
+    const float ax = std::max(0.0f, std::min(x - x0, 1.0f)), ay = std::max(0.0f, std::min(y - y0, 1.0f));
+    const float* m = &shadowMap[0];
+    return (1-ay)*((1-ax)*m[y0*shadowSize+x0] + ax*m[y0*shadowSize+x1])
+        + ay*((1-ax)*m[y1*shadowSize+x0] + ax*m[y1*shadowSize+x1]);
+}
+
+static glm::vec3 Lookup(const Texture* texture, const glm::vec2& uv, const float lod)
+{
+    return texture ? texture->Sample(uv, lod).xyz() : glm::vec3(0.0f);
+}
+
+static glm::vec2 SphereMap(const glm::vec3& R)
+{
+    return glm::vec2(-atan2f(R.y, R.x)/(2*3.141592f), acosf(std::max(-1.0f, std::min(R.z, 1.0f)))/3.141592f);
+}
+
+// lighting.frag's LightingPixel followed by final.frag's tone mapping,
+// for the non-reflective case.
+glm::vec3 Emulator::ShadePixel(const Pass& pass, const Rasterizer::Triangle& t, const int x, const int y) const
+{
+    const Object& object = *draws[t.draw].object;
+    const glm::ivec3& tri = object.shape->Tri[t.prim];
+    const Vertex* tv[3] = { &vertices[t.draw][tri[0]], &vertices[t.draw][tri[1]], &vertices[t.draw][tri[2]] };
+
+    // Perspective correct interpolation of the varyings
+    glm::vec3 b, dbdx, dbdy;
+    t.Interpolants(x, y, b, dbdx, dbdy);
+    float v[VARYINGS];
+    for (int k=0;  k<VARYINGS;  k++)
+        v[k] = b[0]*tv[0]->v[k] + b[1]*tv[1]->v[k] + b[2]*tv[2]->v[k];
+    const glm::vec3 worldPos(v[WORLD], v[WORLD+1], v[WORLD+2]);
+    const glm::vec3 normalVec(v[NORMAL], v[NORMAL+1], v[NORMAL+2]);
+    const glm::vec3 tanVec(v[TANGENT], v[TANGENT+1], v[TANGENT+2]);
+    const glm::vec2 texCoord(v[TEX], v[TEX+1]);
+    const glm::vec4 shadowCoord(v[SHADOW], v[SHADOW+1], v[SHADOW+2], v[SHADOW+3]);
+
+    // Screen space derivatives of texCoord, for the mip level
+    glm::vec2 dx(0.0f), dy(0.0f);
+    for (int i=0;  i<3;  i++) {
+        const glm::vec2 tex(tv[i]->v[TEX], tv[i]->v[TEX+1]);
+        dx += dbdx[i]*tex;
+        dy += dbdy[i]*tex; }
+    const Texture* textureMap = object.texture;
+    const float texLod = textureMap ? textureMap->Lod(dx, dy) : 0.0f;
+
+    // Compute unit vector N, L, V for lighting calc
+    glm::vec3 N = glm::normalize(normalVec);
+    const glm::vec3 L = glm::normalize(scene->lightPos - worldPos);
+    const glm::vec3 V = glm::normalize(pass.eyePos - worldPos);
+
+    // linear color from irradiance maps gamma color
+    glm::vec2 uv(atan2f(N.y, N.x)/(2*3.141592f), acosf(std::max(-1.0f, std::min(N.z, 1.0f)))/3.141592f);
+    const glm::vec3 cG = Lookup(scene->texSkyIrr, uv, 0.0f);
+    const glm::vec3 cL(powf(cG.x, 2.2f), powf(cG.y, 2.2f), powf(cG.z, 2.2f));
+
+    // Values describing surface
+    glm::vec3 Kd = object.diffuseColor;
+    const glm::vec3 Ks = object.specularColor;
+    const float alpha = object.shininess;
+    const int objectId = object.objectId;
+    glm::vec3 out;
+
+    if (objectId == roomId || objectId == boxId || objectId == floorId
+        || objectId == seaId || objectId == groundId) {
+        const glm::vec3 T = glm::normalize(tanVec);
+        const glm::vec3 B = glm::normalize(glm::cross(T, N));
+        const float normalLod = object.normalTex ? object.normalTex->Lod(dx, dy) : 0.0f;
+        const glm::vec3 delta = Lookup(object.normalTex, texCoord, normalLod)*2.0f - glm::vec3(1.0f);
+        N = delta.x*T + delta.y*B + delta.z*N;
+        Kd = Lookup(textureMap, texCoord, texLod); }
+    if (objectId == teapotId)
+        Kd = Lookup(textureMap, texCoord, texLod);
+
+    if (objectId == seaId) {
+        const glm::vec3 R = -(2*std::max(glm::dot(V, N), 0.0001f)*N - V);
+        out = Lookup(textureMap, SphereMap(R), 0.0f); }
+    else if (objectId == skyId)
+        out = Lookup(textureMap, SphereMap(V), 0.0f);
+    else if (objectId == lPicId) {
+        const bool white = ((int)(texCoord.x/0.9f*7))%2 == ((int)(texCoord.y/0.9f*7))%2;
+        out = glm::vec3(white ? 1.0f : 0.0f); }
+    else if (objectId == rPicId) {
+        if (texCoord.x < 0.05f || texCoord.x > 0.95f || texCoord.y < 0.05f || texCoord.y > 0.95f)
+            out = glm::vec3(0.5f);
+        else
+            out = Lookup(textureMap, (texCoord - 0.05f)/0.9f, textureMap ? textureMap->Lod(dx/0.9f, dy/0.9f) : 0.0f); }
+    else {
+        // Light from the sky in the mirror direction; GGX reads the
+        // prefiltered chain at the level of its roughness.
+        glm::vec3 Ii;
+        const glm::vec3 R = -(2*std::max(glm::dot(V, N), 0.0001f)*N - V);
+        uv = SphereMap(R);
+        if (scene->mode == 1 && scene->skySpecLevels > 1) {
+            const float alphaG = sqrtf(2.0f/(alpha + 2.0f));
+            Ii = Lookup(scene->texSkySpec, uv, alphaG*(scene->skySpecLevels - 1)); }
+        else
+            Ii = Lookup(scene->texSky, uv, 0.0f);
+
+        // diffuse color from irradiance map
+        const glm::vec3 Ia = cL*(Kd/3.141592f);
+
+        // Values for lighting calculation
+        const glm::vec3 H = glm::normalize(L + V);
+        const float LH = std::max(glm::dot(L, H), 0.0001f);
+        const float LN = std::max(glm::dot(L, N), 0.0001f);
+        const float HN = std::max(glm::dot(H, N), 0.0001f);
+        const float VN = std::max(glm::dot(V, N), 0.0001f);
+        glm::vec3 BRDF;
+
+        // Schlick's approximation to Fresnel term F
+        const glm::vec3 F = Ks + (glm::vec3(1.0f) - Ks)*powf(1 - LH, 5);
+
+        if (scene->mode == 1) {
+            // GGX
+            const float alphaGsq = 2.0f/(alpha + 2.0f);
+            const float tanThetaHSq = (1.0f - HN*HN)/(HN*HN);
+            const float tanThetaVSq = (1.0f - VN*VN)/(VN*VN);
+            float GLH = 1.0f, GVH = 1.0f;
+            if (tanThetaHSq <= 1)
+                GLH = 2.0f/(1.0f + sqrtf(1 + alphaGsq*tanThetaHSq));
+            if (tanThetaVSq <= 1)
+                GVH = 2.0f/(1.0f + sqrtf(1 + alphaGsq*tanThetaVSq));
+            const float G = GLH*GVH;
+            const float Dg = (alphaGsq*alphaGsq)/(3.141592f*powf(HN*HN*(alphaGsq - 1.0f) + 1.0f, 2.0f));
+            BRDF = Kd/3.141592f + F*G*Dg/(4*LN*VN); }
+        else {
+            // Starter Set
+            const float GandDen = powf(LH, -2.0f);
+            const float D = powf(HN, alpha)*(alpha + 2)/(2*3.141592f);
+            BRDF = Kd/3.141592f + F*GandDen*D/4.0f; }
+
+        // Project interpolated pixel to shadow map
+        const glm::vec2 shadowIndex = shadowCoord.xy()/shadowCoord.w;
+        float notInShadow = 1.0f;
+        if (scene->shadows == 0 && shadowCoord.w > 0
+            && shadowIndex.x > 0 && shadowIndex.x < 1 && shadowIndex.y > 0 && shadowIndex.y < 1
+            && shadowCoord.w > ShadowLookup(shadowIndex) + 0.001f)
+            notInShadow = 0.0f;
+
+        out = Ia + Ii*LN*BRDF*notInShadow; }
+
+    // final.frag: linear to gamma
+    const float exposure = 1.5f, contrast = 1.1f;
+    const glm::vec3 c = out*exposure/(out*exposure + glm::vec3(1.0f));
+    return glm::vec3(powf(c.x, contrast/2.2f), powf(c.y, contrast/2.2f), powf(c.z, contrast/2.2f));
+}
+
+////////////////////////////////////////////////////////////////////////
+// Output
+void Emulator::Blit()
+{
+    if (!blitProgram) {
+        blitProgram = new ShaderProgram();
+        blitProgram->AddShader("emulator.vert", GL_VERTEX_SHADER);
+        blitProgram->AddShader("emulator.frag", GL_FRAGMENT_SHADER);
+        blitProgram->LinkProgram();
+        glGenVertexArrays(1, &blitVao);     // Empty: the vertex shader makes its own positions
+        glGenTextures(1, &blitTexture);
+        glBindTexture(GL_TEXTURE_2D, blitTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0); }
+
+    glViewport(0, 0, width, height);
+    glDisable(GL_DEPTH_TEST);
+    blitProgram->Use();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, blitTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, (GLint)GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &color[0]);
+    blitProgram->Set(ShaderProgram::image, 0);
+    glBindVertexArray(blitVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    blitProgram->Unuse();
+    glEnable(GL_DEPTH_TEST);
+}
+
+bool Emulator::WritePPM(const std::string& name) const
+{
+    FILE* fp = fopen(name.c_str(), "wb");
+    if (!fp) {
+        printf("Can't create file: %s\n", name.c_str());
+        return false; }
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(3*width);
+    for (int y=height-1;  y>=0;  y--) {
+        for (int x=0;  x<width;  x++)
+            for (int c=0;  c<3;  c++)
+                row[3*x+c] = color[4*(y*width+x)+c];
+        fwrite(&row[0], 1, row.size(), fp); }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    if (!ok)
+        printf("Write error on file %s\n", name.c_str());
+    return ok;
+}
+
+#endif
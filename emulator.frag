@@ -0,0 +1,13 @@
+/////////////////////////////////////////////////////////////////////////
+// Pixel shader for showing the software emulator's image
+////////////////////////////////////////////////////////////////////////
+#version 330
+
+uniform sampler2D image;
+
+in vec2 texCoord;
+
+void main()
+{
+    gl_FragColor = texture(image, texCoord);
+}
@@ -1,3 +1,111 @@
+////////////////////////////////////////////////////////////////////////
+// A software emulation of the graphics pipeline, for the v=em build.
+//
+// The Emulator draws the entries of the scene's RenderList from the
+// Shapes' Pnt/Nrm/Tex/Tan/Tri arrays with no help from OpenGL, so it runs
+// headless on machines with no GPU.  Each pass goes through the same
+// stages as the hardware:
+//   vertex transform, computing the same varyings as lighting.vert,
+//   clipping, setup, binning and rasterization with a depth test, by
+//   the Rasterizer (see raster.h), and
+//   shading each visible pixel once with a C++ port of lighting.frag
+//   and final.frag, from the varyings of its triangle's vertices.
+// The vertex stage and shading are spread across threads with
+// OpenMP, as is the Rasterizer's work, and the result does not
+// depend on the thread count.
+//
+// The shadow pass is emulated too, into the emulator's own shadow
+// map.  The reflection passes are not: no object in the scene is
+// reflective, so the lighting pass never reads them.
+////////////////////////////////////////////////////////////////////////
 
+#ifndef _EMULATOR_
+#define _EMULATOR_
 
-// This file is intentionally blank
+// False when running with no OpenGL context at all (software only).
+// Code that would call OpenGL checks this first.
+extern bool hasGL;
+
+#ifdef EM
+
+#include <string>
+#include <vector>
+
+#include "raster.h"
+
+class Scene;
+class Object;
+class RenderList;
+class ShaderProgram;
+
+class Emulator
+{
+public:
+    int width, height;                  // Size of the color buffer
+    std::vector<unsigned char> color;   // RGBA8, bottom row first as glReadPixels returns it
+    Rasterizer raster;                  // Left with the lighting pass's depth
+
+    // Statistics of the last frame
+    int trianglesIn, trianglesDrawn;    // Submitted, and left after clipping and culling
+    double shadowTime, lightingTime;    // Seconds per pass
+
+    Emulator();
+
+    // Render the scene's shadow and lighting passes into color, at
+    // the scene's width and height.  Call after the scene has built
+    // its transformations for the frame.
+    void DrawScene(const Scene& scene);
+
+    // Draw color over the current OpenGL framebuffer.
+    void Blit();
+
+    // Write color as a binary PPM.  Prints a message and returns false on error.
+    bool WritePPM(const std::string& name) const;
+
+private:
+    enum { VARYINGS = 15 };     // World position, normal, tangent, texture coord, shadow coord
+
+    struct Vertex
+    {
+        glm::vec4 clip;
+        float v[VARYINGS];
+    };
+
+    struct DrawItem
+    {
+        const Object* object;
+        glm::mat4 modelTr;
+        glm::mat3 normalTr;     // Transpose of the inverse, as lighting.vert applies NormalTr
+    };
+
+    struct Pass
+    {
+        glm::mat4 viewProj, shadowMatrix;
+        glm::vec3 eyePos;
+        int width, height;
+        Rasterizer::Cull cull;  // The shadow pass culls front faces
+        bool shade;             // Lighting; otherwise write the light's depth as shadow.frag does
+    };
+
+    const Scene* scene;
+    std::vector<DrawItem> draws;
+    std::vector<std::vector<Vertex> > vertices;     // Per draw
+
+    // The shadow map: the light's clip w of the nearest surface, as
+    // the shadow shader writes to its FBO.
+    int shadowSize;
+    std::vector<float> shadowMap;
+
+    // For Blit
+    ShaderProgram* blitProgram;
+    unsigned int blitTexture, blitVao;
+
+    void CollectDraws(const RenderList& list);
+    void DrawPass(const Pass& pass);
+    void TransformVertices(const Pass& pass, const int draw, const int first, const int last);
+    glm::vec3 ShadePixel(const Pass& pass, const Rasterizer::Triangle& t, const int x, const int y) const;
+    float ShadowLookup(const glm::vec2& uv) const;
+};
+
+#endif
+#endif
@@ -0,0 +1,15 @@
+/////////////////////////////////////////////////////////////////////////
+// Vertex shader for showing the software emulator's image
+//
+// Makes a single triangle covering the screen from gl_VertexID, so no
+// vertex buffer is needed.
+////////////////////////////////////////////////////////////////////////
+#version 330
+
+out vec2 texCoord;
+
+void main()
+{
+    texCoord = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(texCoord*2.0f - 1.0f, 0.0f, 1.0f);
+}
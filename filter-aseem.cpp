@@ -1,130 +1,354 @@
+#define _USE_MATH_DEFINES
 #include "math.h"
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h> 
+#include <ctype.h>
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
 using namespace std;
 
-#include "rgbe.h"
 
-// Read an HDR image in .hdr (RGBE) format.
-void read(const string inName, std::vector<float>& image, 
-          int& width, int& height)
+#include "hdr.h"
+#include "irradiance.h"
+
+// Write an HDR image in .hdr (RGBE) format.
+bool write(const string outName, std::vector<float>& image, 
+           const int width, const int height)
 {
-    rgbe_header_info info;
-    char errbuf[100] = {0};
-    
-    // Open file and read width and height from the header
-    FILE* fp = fopen(inName.c_str(), "rb");
-    if (!fp) {
-        printf("Can't open file: %s\n", inName.c_str());
-        exit(-1); }
-    int rc = RGBE_ReadHeader(fp, &width, &height, &info, errbuf);
-    if (rc != RGBE_RETURN_SUCCESS) {
-        printf("RGBE read error: %s\n", errbuf);
-        exit(-1); }
+    if (!HdrWrite(outName, &image[0], width, height))
+        return false;
+    printf("Wrote %s (%dX%d)\n", outName.c_str(), width, height);
+    return true;
+}
 
-    // Allocate enough memory
-    image.resize(3*width*height);
+// Filter parameters, as set on the command line.
+struct Options
+{
+    int shOrder = -1;
+    bool bruteForce = false;
+    int mipLevel = -2;          // -2: no pyramid,  -1: automatic
+    float tolerance = 0.005f;
+    int specularLevels = 0;
+    int specularSamples = 256;
+    int outWidth = 200, outHeight = 100;
 
-    // Read the pixel data and close the file
-    rc = RGBE_ReadPixels_RLE(fp, &image[0], width, height, errbuf);
-    if (rc != RGBE_RETURN_SUCCESS) {
-        printf("RGBE read error: %s\n", errbuf);
-        exit(-1); }
-    fclose(fp);
-    
-    printf("Read %s (%dX%d)\n", inName.c_str(), width, height);
+    // Everything that affects the output files, for the cache.  Bump
+    // the version whenever the filter itself changes its results.
+    string Key() const
+    {
+        char buf[200];
+        sprintf(buf, "v1:sh=%d:brute=%d:mip=%d:tol=%g:spec=%d:samples=%d:out=%dx%d",
+                shOrder, bruteForce, mipLevel, mipLevel == -1 ? tolerance : 0.0f,
+                specularLevels, specularSamples, outWidth, outHeight);
+        return buf;
+    }
+};
+
+static string Stem(const string& name) { return name.substr(0, name.length()-4); }
+
+// The files written for one input
+static std::vector<string> OutputNames(const string& inName, const Options& opt)
+{
+    std::vector<string> names(1, Stem(inName) + "-irradiance.hdr");
+    for (int i=0;  i<opt.specularLevels;  i++) {
+        char suffix[32];
+        sprintf(suffix, "-specular%d.hdr", i);
+        names.push_back(Stem(inName) + suffix); }
+    return names;
 }
 
-// Write an HDR image in .hdr (RGBE) format.
-void write(const string outName, std::vector<float>& image, 
-           const int width, const int height)
+// Filter one input file and write all its outputs.
+static bool Process(const string& inName, const Options& opt)
 {
-    rgbe_header_info info;
-    char errbuf[100] = {0};
-
-    // Open file and write width and height to the header
-    FILE* fp  =  fopen(outName.c_str(), "wb");
-    int rc = RGBE_WriteHeader(fp, width, height, NULL, errbuf);
-    if (rc != RGBE_RETURN_SUCCESS) {
-        printf("RGBE write error: %s\n", errbuf);
-        exit(-1); }
+    // The input streams straight into the filter; only the brute
+    // force reference needs the whole image as floats.
+    HdrReader hdr;
+    if (!hdr.Open(inName))
+        return false;
+    const int inWidth = hdr.width, inHeight = hdr.height;
+    printf("Read %s (%dX%d)\n", inName.c_str(), inWidth, inHeight);
 
-    // Write the pixel data and close the file
-    rc = RGBE_WritePixels_RLE(fp, &image[0], width,  height, errbuf);
-    if (rc != RGBE_RETURN_SUCCESS) {
-        printf("RGBE write error: %s\n", errbuf);
-        exit(-1); }
+    const int outWidth=opt.outWidth, outHeight=opt.outHeight;
+    std::vector<float> outImage(3*outWidth*outHeight);
+
+    IrradianceFilter filter(hdr);
+
+    int level = 0;
+    if (opt.specularLevels > 0)
+        filter.BuildPyramid(1);
+    else if (opt.mipLevel != -2)
+        filter.BuildPyramid();
+    if (opt.mipLevel != -2) {
+        float maxError, rmsError;
+        if (opt.mipLevel == -1)
+            level = filter.ChooseLevel(outWidth, outHeight, opt.tolerance, maxError, rmsError);
+        else {
+            level = std::min(opt.mipLevel, filter.LevelCount()-1);
+            filter.EstimateError(level, outWidth, outHeight, maxError, rmsError); }
+        printf("%s: using mip level %d (%dX%d)\n", inName.c_str(),
+               level, filter.LevelWidth(level), filter.LevelHeight(level));
+        printf("  Estimated error vs full resolution: max %.3f%%, rms %.3f%%\n",
+               100*maxError, 100*rmsError); }
+
+    if (opt.shOrder >= 0) {
+        printf("%s: projecting onto %d SH coefficients\n", inName.c_str(),
+               (opt.shOrder+1)*(opt.shOrder+1));
+        std::vector<double> coeffs = filter.ProjectSH(opt.shOrder, level);
+        IrradianceFilter::EvaluateSH(coeffs, opt.shOrder, outImage, outWidth, outHeight); }
+    else if (opt.bruteForce) {
+        std::vector<float> inImage;
+        hdr.Read(inImage);
+        IrradianceFilter::ConvolveBruteForce(inImage, inWidth, inHeight, outImage, outWidth, outHeight); }
+    else
+        filter.Convolve(outImage, outWidth, outHeight, level);
+
+    // Write the output image
+    std::vector<string> outNames = OutputNames(inName, opt);
+    if (!write(outNames[0], outImage, outWidth, outHeight))
+        return false;
+
+    // The specular chain halves in size each level, like a texture's
+    // mipmaps, starting from (at most) 512x256.
+    for (int i=0;  i<opt.specularLevels;  i++) {
+        int w = std::max(1, std::min(512, inWidth) >> i);
+        int h = std::max(1, std::min(256, inHeight) >> i);
+        float alpha = float(i)/(opt.specularLevels-1);
+        std::vector<float> specImage;
+        filter.PrefilterSpecular(alpha, opt.specularSamples, specImage, w, h);
+        if (!write(outNames[1+i], specImage, w, h))
+            return false; }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Batch mode: inputs may be directories, and unchanged inputs are
+// skipped using a cache of (content hash, parameters) per input file.
+////////////////////////////////////////////////////////////////////////
+
+static bool IsDirectory(const string& name)
+{
+    struct stat st;
+    return stat(name.c_str(), &st) == 0 && (st.st_mode & S_IFDIR);
+}
+
+static bool Exists(const string& name)
+{
+    struct stat st;
+    return stat(name.c_str(), &st) == 0;
+}
+
+static bool EndsWith(const string& s, const string& end)
+{
+    return s.length() >= end.length() && s.compare(s.length()-end.length(), end.length(), end) == 0;
+}
+
+// An .hdr in a directory is an input unless it is one of our outputs.
+static bool IsInputName(const string& name)
+{
+    if (!EndsWith(name, ".hdr") || EndsWith(name, "-irradiance.hdr"))
+        return false;
+    size_t s = name.rfind("-specular");
+    return s == string::npos || !isdigit((unsigned char)name[s+9]);
+}
+
+// Append the input .hdr files in a directory, in sorted order.
+static void ListDirectory(const string& dir, std::vector<string>& files)
+{
+    std::vector<string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA((dir + "\\*.hdr").c_str(), &fd);
+    if (h != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                names.push_back(fd.cFileName);
+        } while (FindNextFileA(h, &fd));
+        FindClose(h); }
+    const char* sep = "\\";
+#else
+    DIR* d = opendir(dir.c_str());
+    if (d) {
+        while (struct dirent* e = readdir(d))
+            names.push_back(e->d_name);
+        closedir(d); }
+    const char* sep = "/";
+#endif
+    std::sort(names.begin(), names.end());
+    for (size_t i=0;  i<names.size();  i++)
+        if (IsInputName(names[i]))
+            files.push_back(dir + sep + names[i]);
+}
+
+// 64 bit FNV-1a hash of a file's contents, as 16 hex digits ("" on error).
+static string HashFile(const string& name)
+{
+    FILE* fp = fopen(name.c_str(), "rb");
+    if (!fp) return "";
+    uint64_t h = 14695981039346656037ULL;
+    std::vector<unsigned char> buf(1<<16);
+    size_t n;
+    while ((n = fread(&buf[0], 1, buf.size(), fp)) > 0)
+        for (size_t i=0;  i<n;  i++) {
+            h ^= buf[i];
+            h *= 1099511628211ULL; }
     fclose(fp);
-    
-    printf("Wrote %s (%dX%d)\n", outName.c_str(), width, height);
+    char hex[20];
+    sprintf(hex, "%016llx", (unsigned long long)h);
+    return hex;
 }
 
+// The cache file has one line per input: <hash> <parameter key> <input name>
+typedef std::map<string, std::pair<string,string> > Cache;
+
+static void ReadCache(const string& cacheName, Cache& cache)
+{
+    FILE* fp = fopen(cacheName.c_str(), "r");
+    if (!fp) return;
+    char line[4096], hash[64], key[256];
+    while (fgets(line, sizeof(line), fp)) {
+        int n = 0;
+        if (sscanf(line, "%63s %255s %n", hash, key, &n) != 2 || n == 0)
+            continue;
+        string name = line + n;
+        while (!name.empty() && (name.back() == '\n' || name.back() == '\r'))
+            name.pop_back();
+        cache[name] = std::make_pair(string(hash), string(key)); }
+    fclose(fp);
+}
+
+static void WriteCache(const string& cacheName, const Cache& cache)
+{
+    FILE* fp = fopen(cacheName.c_str(), "w");
+    if (!fp) {
+        printf("Can't write cache file: %s\n", cacheName.c_str());
+        return; }
+    for (Cache::const_iterator c=cache.begin();  c!=cache.end();  ++c)
+        fprintf(fp, "%s %s %s\n", c->second.first.c_str(), c->second.second.c_str(), c->first.c_str());
+    fclose(fp);
+}
 
 int main(int argc, char** argv)
 {    
-    // Read in-file name from command line, create out-file name
-    string inName = argv[1];
-    string outName = inName.substr(0,inName.length()-4) + "-irradiance.hdr";
+    // Usage: filter-aseem <in.hdr|directory>... [-sh [order]] [-brute] [-mip [level]] [-tol tolerance]
+    //                     [-specular [levels]] [-samples n] [-cache file] [-force]
+    if (argc < 2) {
+        printf("Usage: %s <in.hdr|directory>... [-sh [order]] [-brute] [-mip [level]] [-tol tolerance]\n"
+               "       [-specular [levels]] [-samples n] [-cache file] [-force]\n", argv[0]);
+        exit(-1); }
 
-    int inWidth, inHeight;
-    std::vector<float> inImage;
-    read(inName, inImage, inWidth, inHeight);
+    // -sh selects the spherical harmonics approximation (default order 2, i.e. 9 coefficients)
+    // -brute selects the original per-pixel convolution
+    // -mip filters a level of a downsampled pyramid of the input,
+    //      chosen automatically (within -tol, default 0.5%) if no level is given
+    // -specular also writes a GGX prefiltered mip chain, <in>-specular<i>.hdr,
+    //      level i having roughness alpha = i/(levels-1)
+    // -cache names the file recording each input's content hash and
+    //      parameters (default filter-aseem.cache); an input whose hash and
+    //      parameters match, and whose outputs all exist, is skipped
+    // -force processes every input regardless of the cache
+    Options opt;
+    string cacheName = "filter-aseem.cache";
+    bool force = false;
+    std::vector<string> inputs;
+    for (int a=1;  a<argc;  a++) {
+        // Optional numeric arguments; anything else is the next input or option
+        bool num = a+1 < argc && isdigit((unsigned char)argv[a+1][0]);
+        if (argv[a][0] != '-')
+            inputs.push_back(argv[a]);
+        else if (strcmp(argv[a], "-sh") == 0) {
+            opt.shOrder = 2;
+            if (num)
+                opt.shOrder = atoi(argv[++a]); }
+        else if (strcmp(argv[a], "-brute") == 0)
+            opt.bruteForce = true;
+        else if (strcmp(argv[a], "-mip") == 0) {
+            opt.mipLevel = -1;
+            if (num)
+                opt.mipLevel = atoi(argv[++a]); }
+        else if (strcmp(argv[a], "-tol") == 0 && a+1 < argc)
+            opt.tolerance = atof(argv[++a]);
+        else if (strcmp(argv[a], "-specular") == 0) {
+            opt.specularLevels = 6;
+            if (num)
+                opt.specularLevels = std::max(2, atoi(argv[++a])); }
+        else if (strcmp(argv[a], "-samples") == 0 && a+1 < argc)
+            opt.specularSamples = atoi(argv[++a]);
+        else if (strcmp(argv[a], "-cache") == 0 && a+1 < argc)
+            cacheName = argv[++a];
+        else if (strcmp(argv[a], "-force") == 0)
+            force = true;
+        else
+            printf("Ignoring unknown option %s\n", argv[a]); }
 
-    int outWidth=200, outHeight=100;
-    std::vector<float> outImage(3*outWidth*outHeight);
+    // Expand directories into their .hdr files
+    std::vector<string> files;
+    for (size_t i=0;  i<inputs.size();  i++) {
+        if (IsDirectory(inputs[i]))
+            ListDirectory(inputs[i], files);
+        else
+            files.push_back(inputs[i]); }
 
-	float pi = 3.141592f;
-	float angTheta = 0.0f;
-	float angPhi = 0.0f;
-	float xOut, yOut, zOut;
-	float xIn, yIn, zIn;
-	float omegaDot;
-
-    // Irradiance calculation algorithm:
-    //  Loop through all output pixels (The #pragma parallelizes this loop)
-#pragma omp parallel for schedule(dynamic, 1) // Magic: Multi-thread y loop
-    for (int j=0;  j<outHeight;  j++) {
-        for (int i=0;  i<outWidth;  i++) {
-            // Calculate N from the indices  i and j
-			angTheta = (pi * (j + (1.0f / 2.0f))) / outHeight;
-			angPhi = (2 * pi * (i + (1.0f / 2.0f))) / outWidth;
-			xOut = sin(angTheta) * cos(angPhi);
-			yOut = sin(angTheta) * sin(angPhi);
-			zOut = cos(angTheta);
-			
-            // For each output pixel, accumulate across *all* input pixels
-            for (int l=0;  l<inHeight;  l++) {
-                for (int k=0;  k<inWidth;  k++) {
-                    // Calculate W from indices k and l
-					angTheta = (pi * (l + (1.0f / 2.0f))) / inHeight;
-					angPhi = (2 * pi * (k + (1.0f / 2.0f))) / inWidth;
-					xIn = sin(angTheta) * cos(angPhi);
-					yIn = sin(angTheta) * sin(angPhi);
-					zIn = cos(angTheta);
-					
-					omegaDot = xOut * xIn + yOut * yIn + zOut * zIn;
-					if (omegaDot < 0.0f) {
-						continue;
-					}
-					
-                    // Accumulate input pixel (l,k)'s contribution to the output pixel (i,j)
-					//red
-					outImage[(3 * j * outWidth) + (3 * i) + 0] += inImage[(3 * l * inWidth) + (3 * k) + 0] *
-																	omegaDot * sin(angTheta) * pi / inHeight * 2 * pi / inWidth;
-					//green
-					outImage[(3 * j * outWidth) + (3 * i) + 1] += inImage[(3 * l * inWidth) + (3 * k) + 1] *
-																	omegaDot * sin(angTheta) * pi / inHeight * 2 * pi / inWidth;
-					//blue
-					outImage[(3 * j * outWidth) + (3 * i) + 2] += inImage[(3 * l * inWidth) + (3 * k) + 2] *
-																	omegaDot * sin(angTheta) * pi / inHeight * 2 * pi / inWidth;
-                }
-            }
-        }
-    }
+    // Hash every input, and keep those not already up to date
+    Cache cache;
+    ReadCache(cacheName, cache);
+    const string key = opt.Key();
+    std::vector<string> hashes(files.size());
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int i=0;  i<(int)files.size();  i++)
+        hashes[i] = HashFile(files[i]);
 
+    std::vector<int> todo;
+    int failed = 0, upToDateCount = 0;
+    for (int i=0;  i<(int)files.size();  i++) {
+        if (hashes[i].empty()) {
+            printf("Can't open file: %s\n", files[i].c_str());
+            failed++;
+            continue; }
+        Cache::const_iterator c = cache.find(files[i]);
+        bool upToDate = !force && c != cache.end()
+            && c->second.first == hashes[i] && c->second.second == key;
+        std::vector<string> outNames = OutputNames(files[i], opt);
+        for (size_t o=0;  upToDate && o<outNames.size();  o++)
+            upToDate = Exists(outNames[o]);
+        if (upToDate) {
+            printf("Up to date: %s\n", files[i].c_str());
+            upToDateCount++; }
+        else
+            todo.push_back(i); }
 
-    // Write the output image
-    write(outName, outImage, outWidth, outHeight);
+    // Independent inputs are filtered in parallel, one per thread.  The
+    // filter's own parallel loops then run on that single thread, which
+    // gives the same results since they are deterministic.  A single
+    // input keeps all threads for itself.
+    std::vector<char> ok(todo.size(), 0);
+#pragma omp parallel for schedule(dynamic, 1) if (todo.size() > 1)
+    for (int t=0;  t<(int)todo.size();  t++)
+        ok[t] = Process(files[todo[t]], opt);
+
+    int processed = 0;
+    for (size_t t=0;  t<todo.size();  t++) {
+        const string& name = files[todo[t]];
+        if (ok[t]) {
+            cache[name] = std::make_pair(hashes[todo[t]], key);
+            processed++; }
+        else {
+            cache.erase(name);
+            failed++; } }
+    if (!todo.empty())
+        WriteCache(cacheName, cache);
+
+    printf("%d processed, %d up to date, %d failed\n",
+           processed, upToDateCount, failed);
+    return failed ? 1 : 0;
 }
@@ -0,0 +1,238 @@
+////////////////////////////////////////////////////////////////////////
+// Benchmark for the irradiance filter variants.
+//
+// For each input .hdr and output size, runs each variant of
+// IrradianceFilter at several thread counts, and reports time,
+// throughput (input texels x output texels per second, counting the
+// full resolution input even for variants that read less of it),
+// speedup over one thread, and max/RMS relative error against the
+// exact convolution of the full resolution input.
+//
+// Usage: filter-bench [<in.hdr|directory>...] [-sizes WxH,...] [-threads n,...]
+//                     [-reps n] [-tol tolerance] [-brute-limit pairs] [-csv file]
+////////////////////////////////////////////////////////////////////////
+
+#define _USE_MATH_DEFINES
+#include "math.h"
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "hdr.h"
+#include "irradiance.h"
+#include "trace.h"
+
+static int MaxThreads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static void SetThreads(const int n)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(n);
+#endif
+}
+
+// Append the .hdr files in a directory, in sorted order.
+static void ListDirectory(const std::string& dir, std::vector<std::string>& files)
+{
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA((dir + "\\*.hdr").c_str(), &fd);
+    if (h != INVALID_HANDLE_VALUE) {
+        do names.push_back(fd.cFileName);
+        while (FindNextFileA(h, &fd));
+        FindClose(h); }
+    const char* sep = "\\";
+#else
+    DIR* d = opendir(dir.c_str());
+    if (d) {
+        while (struct dirent* e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name.size() > 4 && name.compare(name.size()-4, 4, ".hdr") == 0)
+                names.push_back(name); }
+        closedir(d); }
+    const char* sep = "/";
+#endif
+    std::sort(names.begin(), names.end());
+    for (size_t i=0;  i<names.size();  i++)
+        files.push_back(dir + sep + names[i]);
+}
+
+// Same relative measure as the filter's own level selection
+static void Compare(const std::vector<float>& ref, const std::vector<float>& out,
+                    double& maxError, double& rmsError)
+{
+    double sumSq = 0.0;
+    maxError = 0.0;
+    for (size_t s=0;  s<ref.size();  s++) {
+        double rel = fabs(out[s]-ref[s]) / std::max(ref[s], 1e-6f);
+        sumSq += rel*rel;
+        maxError = std::max(maxError, rel); }
+    rmsError = sqrt(sumSq/std::max((size_t)1, ref.size()));
+}
+
+enum Variant { BRUTE, EXACT, MIP, SH2, SH4, VARIANTS };
+static const char* variantNames[VARIANTS] = { "brute", "exact", "mip", "sh2", "sh4" };
+
+// Run one variant, returning the pyramid level it used (0 if none).
+static int Run(const Variant v, const IrradianceFilter& filter, const std::vector<float>& image,
+               const float tolerance, std::vector<float>& out, const int outWidth, const int outHeight)
+{
+    float maxE, rmsE;
+    int level = 0;
+    switch (v) {
+    case BRUTE:
+        IrradianceFilter::ConvolveBruteForce(image, filter.width, filter.height, out, outWidth, outHeight);
+        break;
+    case EXACT:
+        filter.Convolve(out, outWidth, outHeight, 0);
+        break;
+    case MIP:
+        level = filter.ChooseLevel(outWidth, outHeight, tolerance, maxE, rmsE);
+        filter.Convolve(out, outWidth, outHeight, level);
+        break;
+    case SH2:
+    case SH4: {
+        int order = v == SH2 ? 2 : 4;
+        IrradianceFilter::EvaluateSH(filter.ProjectSH(order, 0), order, out, outWidth, outHeight);
+        break; }
+    default:
+        break; }
+    return level;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> inputs;
+    std::vector<int> sizes, threads;
+    int reps = 3;
+    float tolerance = 0.005f;
+    double bruteLimit = 1e10;
+    const char* csvName = NULL;
+    for (int a=1;  a<argc;  a++) {
+        if (argv[a][0] != '-')
+            inputs.push_back(argv[a]);
+        else if (strcmp(argv[a], "-sizes") == 0 && a+1 < argc) {
+            for (char* s=strtok(argv[++a], ",");  s;  s=strtok(NULL, ",")) {
+                int w, h;
+                if (sscanf(s, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+                    sizes.push_back(w);
+                    sizes.push_back(h); } } }
+        else if (strcmp(argv[a], "-threads") == 0 && a+1 < argc) {
+            for (char* s=strtok(argv[++a], ",");  s;  s=strtok(NULL, ","))
+                if (atoi(s) > 0)
+                    threads.push_back(atoi(s)); }
+        else if (strcmp(argv[a], "-reps") == 0 && a+1 < argc)
+            reps = std::max(1, atoi(argv[++a]));
+        else if (strcmp(argv[a], "-tol") == 0 && a+1 < argc)
+            tolerance = atof(argv[++a]);
+        else if (strcmp(argv[a], "-brute-limit") == 0 && a+1 < argc)
+            bruteLimit = atof(argv[++a]);
+        else if (strcmp(argv[a], "-csv") == 0 && a+1 < argc)
+            csvName = argv[++a];
+        else {
+            printf("Usage: %s [<in.hdr|directory>...] [-sizes WxH,...] [-threads n,...]\n"
+                   "       [-reps n] [-tol tolerance] [-brute-limit pairs] [-csv file]\n", argv[0]);
+            exit(-1); } }
+
+    // Defaults: the bundled skies, a few output sizes up to the tool's
+    // 200x100, and powers of two up to all threads.
+    if (inputs.empty())
+        inputs.push_back("textures");
+    if (sizes.empty()) {
+        int defaults[] = { 32,16,  64,32,  200,100 };
+        sizes.assign(defaults, defaults+6); }
+    if (threads.empty()) {
+        for (int n=1;  n<MaxThreads();  n*=2)
+            threads.push_back(n);
+        threads.push_back(MaxThreads()); }
+
+    std::vector<std::string> files;
+    for (size_t i=0;  i<inputs.size();  i++) {
+        struct stat st;
+        if (stat(inputs[i].c_str(), &st) == 0 && (st.st_mode & S_IFDIR))
+            ListDirectory(inputs[i], files);
+        else
+            files.push_back(inputs[i]); }
+
+    FILE* csv = NULL;
+    if (csvName) {
+        csv = fopen(csvName, "w");
+        if (!csv) {
+            printf("Can't create file: %s\n", csvName);
+            exit(-1); }
+        fprintf(csv, "file,inWidth,inHeight,outWidth,outHeight,variant,level,threads,seconds,pairsPerSecond,maxError,rmsError\n"); }
+
+    for (size_t f=0;  f<files.size();  f++) {
+        HdrReader hdr;
+        if (!hdr.Open(files[f]))
+            continue;
+        std::vector<float> image;
+        hdr.Read(image);
+        IrradianceFilter filter(hdr);
+        double t0 = Trace::Now();
+        filter.BuildPyramid();
+        printf("\n%s (%dX%d), pyramid of %d levels built in %.1f ms\n", files[f].c_str(),
+               hdr.width, hdr.height, filter.LevelCount(), 1000*(Trace::Now()-t0));
+
+        for (size_t s=0;  s<sizes.size();  s+=2) {
+            const int outWidth = sizes[s], outHeight = sizes[s+1];
+            const double pairs = (double)hdr.width*hdr.height*outWidth*outHeight;
+
+            // The reference, at full thread count
+            SetThreads(MaxThreads());
+            std::vector<float> ref(3*outWidth*outHeight);
+            filter.Convolve(ref, outWidth, outHeight, 0);
+
+            printf("  Output %dX%d\n", outWidth, outHeight);
+            printf("    %-6s %5s %7s %11s %13s %8s %9s %9s\n",
+                   "", "level", "threads", "time (ms)", "Gpairs/s", "speedup", "max err", "rms err");
+            for (int v=0;  v<VARIANTS;  v++) {
+                if (v == BRUTE && pairs > bruteLimit) {
+                    printf("    %-6s skipped (%.2g pairs > -brute-limit %.2g)\n", variantNames[v], pairs, bruteLimit);
+                    continue; }
+                double oneThread = 0.0;
+                for (size_t t=0;  t<threads.size();  t++) {
+                    SetThreads(threads[t]);
+                    std::vector<float> out(3*outWidth*outHeight);
+                    double best = 1e30;
+                    int level = 0;
+                    for (int r=0;  r<reps;  r++) {
+                        double start = Trace::Now();
+                        level = Run((Variant)v, filter, image, tolerance, out, outWidth, outHeight);
+                        best = std::min(best, Trace::Now()-start); }
+                    if (t == 0)
+                        oneThread = best;
+
+                    double maxError, rmsError;
+                    Compare(ref, out, maxError, rmsError);
+                    printf("    %-6s %5d %7d %11.2f %13.3f %8.2f %8.4f%% %8.4f%%\n",
+                           t == 0 ? variantNames[v] : "", level, threads[t], 1000*best,
+                           pairs/best*1e-9, oneThread/best, 100*maxError, 100*rmsError);
+                    if (csv)
+                        fprintf(csv, "%s,%d,%d,%d,%d,%s,%d,%d,%g,%g,%g,%g\n", files[f].c_str(),
+                                hdr.width, hdr.height, outWidth, outHeight, variantNames[v], level,
+                                threads[t], best, pairs/best, maxError, rmsError); } } } }
+
+    if (csv)
+        fclose(csv);
+}
@@ -2,16 +2,16 @@
 // Pixel shader for lighting
 ////////////////////////////////////////////////////////////////////////
 #version 330
-uniform bool Reflective;
 uniform sampler2D reflectionMapTop;
 uniform sampler2D reflectionMapBottom;
-uniform vec3 diffuse;
-uniform vec3 specular;
-uniform float shininess;
+
+// The uniform blocks of ubo.h are declared ahead of this source by
+// ShaderProgram::AddShader.
 
 in vec3 normalVec;
 in vec3 eyeVec;
 in vec2 texCoord;
+flat in int instanceId;
 
 vec3 reflectionColor;
 
@@ -22,6 +22,11 @@ void main()
     float exposure = 1.5f;
     float contrast = 1.1f;
 
+    // This instance's surface values
+    vec3 diffuse = instances[instanceId].diffuse;
+    vec3 specular = instances[instanceId].specular;
+    float shininess = instances[instanceId].shininess;
+
     // Reflection
     if (Reflective) {
         // Values for lighting calculation
@@ -5,7 +5,8 @@
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
-uniform mat4 WorldView, WorldInverse, WorldProj, ModelTr;
+// The uniform blocks of ubo.h are declared ahead of this source by
+// ShaderProgram::AddShader.
 
 in vec4 vertex;
 
@@ -14,6 +15,7 @@ void LightingVertex(vec3 eyePos);
 void main()
 {
     // Compute the point's projection on the screen
+    mat4 ModelTr = INSTANCE_MODEL_TR(gl_InstanceID);
     gl_Position = WorldProj*WorldView*ModelTr*vertex;
 
     // Compute eye vectors
@@ -3,7 +3,22 @@
 // initialization and main loop.
 ////////////////////////////////////////////////////////////////////////
 
+#include <string.h>
+#include <ctype.h>
+#include <chrono>
+#include <thread>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "framework.h"
+#include "headless.h"
+#include "imagediff.h"
+#include "png.h"
+#include "pathtracer.h"
+#include "raster.h"
+#include "trace.h"
+#include "transform.h"
 
 Scene scene;
 
@@ -12,10 +27,386 @@ static void error_callback(int error, const char* msg)
     fputs(msg, stderr);
 }
 
+// Given with -trace, where the trace is written at exit
+static const char* traceName = NULL;
+
+static void WriteTrace()
+{
+    Trace::Write(traceName);
+}
+
+#ifdef EM
+////////////////////////////////////////////////////////////////////////
+// Render frames entirely in software, with no window or OpenGL
+// context, and write the last one as a PPM image.  The animation is
+// frozen at time 0, so runs are reproducible.
+static int EmulateHeadless(const int frames, const char* outName, const int w, const int h)
+{
+    hasGL = false;
+    scene.emulate = true;
+    scene.width = w;
+    scene.height = h;
+    scene.InitializeScene();
+    scene.fixedTime = 0.0;
+
+    for (int f=0;  f<frames;  f++) {
+        scene.DrawScene();
+        printf("Frame %d: %d of %d triangles drawn, shadow %.1f ms, lighting %.1f ms\n", f,
+               scene.emulator.trianglesDrawn, scene.emulator.trianglesIn,
+               1000*scene.emulator.shadowTime, 1000*scene.emulator.lightingTime); }
+    return scene.emulator.WritePPM(outName) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Path trace a reference image of the first frame, with no window or
+// OpenGL context, progressively written to an .hdr file.  It is the
+// same frame EmulateHeadless renders.
+static int PathTraceHeadless(const int spp, const char* outName, const int w, const int h)
+{
+    hasGL = false;
+    scene.width = w;
+    scene.height = h;
+    scene.InitializeScene();
+    scene.fixedTime = 0.0;
+    scene.UpdateFrame();
+    scene.renderList.Update();
+
+    PathTracer tracer;
+    if (!tracer.Build(scene, w, h))
+        return -1;
+    return tracer.Render(spp, outName) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Time the Rasterizer by itself on the scene's teapot and terrain
+// meshes, each viewed so it fills the frame, with and without AVX2
+// and at 1, 2, 4, ... threads.  The vertices are transformed once,
+// outside the timing, which covers setup, binning and rasterization,
+// with no culling, as in the emulator's lighting pass.
+static int RasterBenchmark(const int w, const int h)
+{
+    const int reps = 10;
+    hasGL = false;
+    Teapot teapot(12);          // As InitializeScene makes them
+    ProceduralGround terrain(100.0f, 400, 4.0f, 0.03f, 0.03f, -3.0f, 5.0f);
+
+    int maxThreads = 1;
+#ifdef _OPENMP
+    maxThreads = omp_get_max_threads();
+#endif
+    const Shape* meshes[2] = { &teapot, &terrain };
+    const char* names[2] = { "teapot", "terrain" };
+    Rasterizer raster;
+    const bool hasSimd = raster.simd;
+    printf("%dx%d, best of %d frames\n", w, h, reps);
+    printf("%-8s %-6s %7s %9s %9s %9s %10s %10s\n",
+           "mesh", "path", "threads", "ms", "tris", "drawn", "Mtris/s", "Mpixels/s");
+    for (int m=0;  m<2;  m++) {
+        const Shape* shape = meshes[m];
+        const glm::vec3 eye = shape->center + 3.5f*shape->size*glm::normalize(glm::vec3(1, -2, 1));
+        const glm::mat4 viewProj = Perspective(0.4f*w/h, 0.4f, 0.1f*shape->size, 10.0f*shape->size)
+            *LookAt(eye, shape->center, glm::vec3(0, 0, 1));
+        std::vector<glm::vec4> clip(shape->Pnt.size());
+        for (size_t i=0;  i<clip.size();  i++)
+            clip[i] = viewProj*shape->Pnt[i];
+
+        for (int simd=0;  simd<=1;  simd++) {
+            if (simd && !hasSimd)
+                continue;
+            raster.simd = simd != 0;
+            for (int threads=1;  ;  threads=std::min(2*threads, maxThreads)) {
+#ifdef _OPENMP
+                omp_set_num_threads(threads);
+#endif
+                double best = 1e30;
+                for (int r=0;  r<reps;  r++) {
+                    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    raster.Begin(w, h);
+                    raster.Draw(&clip[0], sizeof(glm::vec4), &shape->Tri[0], (int)shape->Tri.size(),
+                                Rasterizer::CULL_NONE);
+                    raster.Flush();
+                    best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()); }
+                printf("%-8s %-6s %7d %9.2f %9lld %9lld %10.2f %10.2f\n", names[m], simd ? "avx2" : "scalar",
+                       threads, 1000*best, raster.trianglesIn, raster.trianglesDrawn,
+                       raster.trianglesIn/best/1e6, raster.fragments/best/1e6);
+                if (threads == maxThreads)
+                    break; } } }
+#ifdef _OPENMP
+    omp_set_num_threads(maxThreads);
+#endif
+    return 0;
+}
+#endif
+
+// Scene time per frame when rendering with no window
+const double headlessFps = 30.0;
+
+////////////////////////////////////////////////////////////////////////
+// Make an offscreen OpenGL context of the given size, initialize the
+// scene in it, and make a camera path: from a file, or one turn
+// around the scene over the given number of frames.
+static bool StartHeadless(HeadlessContext& context, CameraPath& path, const int frames,
+                          const int w, const int h, const char* pathName)
+{
+    glbinding::Binding::initialize(false);
+    if (!context.Create(w, h))
+        return false;
+    printf("OpenGL Version: %s\n", glGetString(GL_VERSION));
+    printf("Rendered by: %s\n", glGetString(GL_RENDERER));
+
+    scene.width = w;
+    scene.height = h;
+    scene.InitializeScene();
+    if (pathName) {
+        if (!path.Read(pathName))
+            return false; }
+    else
+        path.Orbit(scene, (float)(frames/headlessFps));
+
+    // A sky irradiance map being computed is waited for, so every
+    // frame uses it.
+    while (scene.irrTask.Pending())
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Render frames with OpenGL, but into an offscreen surface with no
+// window, as fast as they draw.  The camera follows a path, and scene
+// time advances a fixed 1/30 s per frame, so runs are reproducible.
+// Every frame is written if outName holds a printf format for the
+// frame number (e.g. frames/f%04d.png), otherwise just the last, as a
+// .png (see SaveFramebuffer).
+static int RenderHeadless(const int frames, const char* outName, const int w, const int h,
+                          const char* pathName)
+{
+    if (!IsPngName(outName)) {
+        printf("-headless writes .png frames only: %s\n", outName);
+        return -1; }
+
+    HeadlessContext context;
+    CameraPath path;
+    if (!StartHeadless(context, path, frames, w, h, pathName))
+        return -1;
+
+    const bool everyFrame = strchr(outName, '%') != NULL;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int f=0;  f<frames;  f++) {
+        scene.fixedTime = f/headlessFps;
+        path.Apply(scene, (float)scene.fixedTime);
+        scene.profiler.BeginFrame();
+        scene.DrawScene();
+        scene.profiler.EndFrame();
+        glFinish();
+        if (everyFrame || f == frames-1) {
+            char name[1024];
+            snprintf(name, sizeof(name), outName, f);
+            if (!SaveFramebuffer(name, w, h))
+                return -1; } }
+    scene.profiler.Flush();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%d frames in %.2f s, %.1f ms per frame (including writes)\n", frames, seconds,
+           1000*seconds/std::max(frames, 1));
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Time frames rendered as RenderHeadless does, after some warm-up
+// frames (all at time 0), and write each pass's CPU and GPU times as
+// JSON: the mean and 50th, 95th and 99th percentiles, in ms.
+static int BenchmarkHeadless(const int frames, const int warmup, const char* outName,
+                             const int w, const int h, const char* pathName)
+{
+    HeadlessContext context;
+    CameraPath path;
+    if (!StartHeadless(context, path, frames, w, h, pathName))
+        return -1;
+
+    Profiler& profiler = scene.profiler;
+    profiler.enabled = true;
+    profiler.wait = true;
+    for (int f=-warmup;  f<frames;  f++) {
+        if (f == 0)
+            profiler.Clear();
+        scene.fixedTime = std::max(f, 0)/headlessFps;
+        path.Apply(scene, (float)scene.fixedTime);
+        profiler.BeginFrame();
+        scene.DrawScene();
+        profiler.EndFrame(); }
+    profiler.Flush();
+
+    FILE* fp = fopen(outName, "w");
+    if (!fp) {
+        printf("Can't create file: %s\n", outName);
+        return -1; }
+    fprintf(fp, "{\n  \"frames\": %d,\n  \"warmup\": %d,\n  \"width\": %d,\n  \"height\": %d,\n",
+            frames, warmup, w, h);
+    fprintf(fp, "  \"renderer\": \"%s\",\n  \"passes\": {", (const char*)glGetString(GL_RENDERER));
+    for (size_t p=0;  p<profiler.passes.size();  p++) {
+        const Profiler::Pass& pass = profiler.passes[p];
+        const Profiler::Stats cpu = Profiler::Summarize(pass.cpu);
+        const Profiler::Stats gpu = Profiler::Summarize(pass.gpu);
+        fprintf(fp, "%s\n    \"%s\": {\n", p ? "," : "", pass.name.c_str());
+        if (p)
+            fprintf(fp, "      \"draw_calls\": %d,\n      \"triangles\": %d,\n", pass.drawCalls, pass.triangles);
+        fprintf(fp, "      \"cpu_ms\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f},\n",
+                cpu.mean, cpu.p50, cpu.p95, cpu.p99);
+        fprintf(fp, "      \"gpu_ms\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f}\n    }",
+                gpu.mean, gpu.p50, gpu.p95, gpu.p99);
+        printf("%-18s cpu %8.3f ms (p95 %8.3f)   gpu %8.3f ms (p95 %8.3f)\n", pass.name.c_str(),
+               cpu.mean, cpu.p95, gpu.mean, gpu.p95); }
+    fprintf(fp, "\n  }\n}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Render fixed views of the scene as RenderHeadless does, and compare
+// each with its golden image, dir/viewN.png.  A view with no golden
+// image fails, unless record is set, which (re)writes every view's
+// golden image instead of comparing.  A view that fails also gets its
+// render written, as dir/viewN-new.png; every view compared gets a
+// heat map of the differences, dir/viewN-diff.png.  Returns the number
+// of views that failed.
+static int RegressHeadless(const char* dir, const int w, const int h, const bool record)
+{
+    // Time (for the animation), spin, tilt, zoom
+    static const float views[][4] = {
+        { 0.0f,    0.0f, 30.0f, 25.0f },   // The initial view
+        { 1.0f,   90.0f, 20.0f, 12.0f },   // The teapot, close up
+        { 2.5f,   45.0f, 80.0f, 40.0f },   // From above
+        { 4.0f,  200.0f,  8.0f, 60.0f } }; // Low and far, across the terrain
+    const int count = sizeof(views)/sizeof(views[0]);
+
+    HeadlessContext context;
+    CameraPath path;
+    if (!StartHeadless(context, path, 1, w, h, NULL))
+        return -1;
+
+    const ImageTolerance tolerance;
+    int failed = 0;
+    for (int v=0;  v<count;  v++) {
+        const CameraPath::Key key = { 0.0f, views[v][1], views[v][2], views[v][3],
+                                      scene.lightSpin, scene.lightTilt };
+        path.keys.assign(1, key);
+        scene.fixedTime = views[v][0];
+        path.Apply(scene, 0.0f);
+        scene.DrawScene();
+        glFinish();
+        std::vector<unsigned char> rgb;
+        ReadFramebuffer(w, h, rgb);
+
+        char golden[1024], name[1024];
+        snprintf(golden, sizeof(golden), "%s/view%d.png", dir, v);
+        if (record) {
+            if (PngWrite(golden, &rgb[0], w, h))
+                printf("view%d: recorded as %s\n", v, golden);
+            else {
+                printf("view%d: FAIL, can't write %s\n", v, golden);
+                failed++; }
+            continue; }
+
+        std::vector<unsigned char> expected;
+        int gw, gh;
+        if (FILE* fp = fopen(golden, "rb"))
+            fclose(fp);
+        else {
+            printf("view%d: FAIL, no golden image %s (record one with -record)\n", v, golden);
+            failed++;
+            continue; }
+        if (!ReadImage(golden, expected, gw, gh) || gw != w || gh != h) {
+            printf("view%d: FAIL, can't compare with %s\n", v, golden);
+            failed++;
+            continue; }
+
+        ImageDiff diff;
+        DiffImages(&rgb[0], &expected[0], w, h, tolerance, diff);
+        printf("view%d: %s  %.3f%% of pixels over %d, delta E mean %.3f, max %.1f\n", v,
+               diff.pass ? "pass" : "FAIL", 100*diff.overFraction, tolerance.channel,
+               diff.meanDeltaE, diff.maxDeltaE);
+        snprintf(name, sizeof(name), "%s/view%d-diff.png", dir, v);
+        bool ok = diff.pass;
+        if (!PngWrite(name, &diff.heatmap[0], w, h)) {
+            printf("view%d: FAIL, can't write %s\n", v, name);
+            ok = false; }
+        if (!diff.pass) {
+            snprintf(name, sizeof(name), "%s/view%d-new.png", dir, v);
+            if (!PngWrite(name, &rgb[0], w, h))
+                printf("view%d: can't write %s\n", v, name); }
+        if (!ok)
+            failed++; }
+    printf("%d of %d views failed\n", failed, count);
+    return failed;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Do the OpenGL/GLFW setup and then enter the interactive loop.
 int main(int argc, char** argv)
 {
+    // framework -trace out.json ...             records a trace of everything below,
+    //                                           written at exit (in the Chrome format)
+    Trace::NameThread("main");
+    for (int a=1;  a+1<argc;  a++)
+        if (strcmp(argv[a], "-trace") == 0) {
+            traceName = argv[a+1];
+            for (int b=a;  b+2<=argc;  b++)
+                argv[b] = argv[b+2];
+            argc -= 2;
+            Trace::Start();
+            atexit(WriteTrace);
+            break; }
+
+    // framework -headless frames out.png [WxH] [camera.txt]
+    //                                           renders with OpenGL offscreen, with no window
+    // framework -benchmark frames out.json [WxH] [camera.txt]
+    //                                           times the passes likewise (after 30
+    //                                           warm-up frames), as JSON
+    // framework -regress dir [WxH] [-record]    compares fixed views with golden images,
+    //                                           or with -record, writes them
+    for (int a=1;  a<argc;  a++) {
+        const bool headless = strcmp(argv[a], "-headless") == 0;
+        if ((headless || strcmp(argv[a], "-benchmark") == 0) && a+2 < argc) {
+            int w = 750, h = 750;
+            if (a+3 < argc)
+                sscanf(argv[a+3], "%dx%d", &w, &h);
+            const char* pathName = a+4 < argc ? argv[a+4] : NULL;
+            if (headless)
+                return RenderHeadless(atoi(argv[a+1]), argv[a+2], w, h, pathName);
+            return BenchmarkHeadless(atoi(argv[a+1]), 30, argv[a+2], w, h, pathName); }
+        if (strcmp(argv[a], "-regress") == 0 && a+1 < argc) {
+            int w = 750, h = 750;
+            bool record = false;
+            for (int b=a+2;  b<argc;  b++) {
+                if (strcmp(argv[b], "-record") == 0)
+                    record = true;
+                else
+                    sscanf(argv[b], "%dx%d", &w, &h); }
+            return RegressHeadless(argv[a+1], w, h, record); } }
+
+#ifdef EM
+    // framework -emulate                        renders in software, shown in the window
+    // framework -emulate frames out.ppm [WxH]   renders in software with no window at all
+    // framework -pathtrace spp out.hdr [WxH]    path traces a reference image with no window
+    // framework -rasterbench [WxH]              times the software rasterizer alone
+    for (int a=1;  a<argc;  a++) {
+        if (strcmp(argv[a], "-emulate") == 0) {
+            scene.emulate = true;
+            if (a+2 < argc && isdigit(argv[a+1][0])) {
+                int w = 750, h = 750;
+                if (a+3 < argc)
+                    sscanf(argv[a+3], "%dx%d", &w, &h);
+                return EmulateHeadless(atoi(argv[a+1]), argv[a+2], w, h); } }
+        if (strcmp(argv[a], "-pathtrace") == 0 && a+2 < argc) {
+            int w = 750, h = 750;
+            if (a+3 < argc)
+                sscanf(argv[a+3], "%dx%d", &w, &h);
+            return PathTraceHeadless(atoi(argv[a+1]), argv[a+2], w, h); }
+        if (strcmp(argv[a], "-rasterbench") == 0) {
+            int w = 750, h = 750;
+            if (a+1 < argc)
+                sscanf(argv[a+1], "%dx%d", &w, &h);
+            return RasterBenchmark(w, h); } }
+#endif
+
     glfwSetErrorCallback(error_callback);
 
     // Initialize the OpenGL bindings
@@ -51,11 +442,14 @@ int main(int argc, char** argv)
     scene.InitializeScene();
     
     // Enter the event loop.
+    scene.profiler.history = 300;       // For the profiler's graphs
     while (!glfwWindowShouldClose(scene.window)) {
         glfwPollEvents();
 
+        scene.profiler.BeginFrame();
         scene.DrawScene();
         scene.DrawMenu();
+        scene.profiler.EndFrame();
         glfwSwapBuffers(scene.window); }
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -0,0 +1,81 @@
+////////////////////////////////////////////////////////////////////////
+// Box culling against a set of planes.  See frustum.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+
+// SSE is part of every x86-64 CPU, so needs no check at run time.
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+void Frustum::Clear()
+{
+    count = 0;
+    for (int p=0;  p<MAX_PLANES;  p++) {
+        nx[p] = ny[p] = nz[p] = 0.0f;
+        d[p] = 1.0f; }
+}
+
+// The planes are sums and differences of the matrix's rows (Gribb and
+// Hartmann): -w <= x <= w, and so on, for the transformed point.
+Frustum Frustum::FromMatrix(const glm::mat4& m)
+{
+    Frustum f;
+    const glm::vec4 x(m[0][0], m[1][0], m[2][0], m[3][0]);
+    const glm::vec4 y(m[0][1], m[1][1], m[2][1], m[3][1]);
+    const glm::vec4 z(m[0][2], m[1][2], m[2][2], m[3][2]);
+    const glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+    const glm::vec4 planes[6] = { w + x, w - x, w + y, w - y, w + z, w - z };
+    for (int p=0;  p<6;  p++)
+        f.AddPlane(glm::vec3(planes[p]), planes[p].w);
+    return f;
+}
+
+void Frustum::AddPlane(const glm::vec3& n, const float offset)
+{
+    if (count == MAX_PLANES)
+        return;
+    nx[count] = n.x;
+    ny[count] = n.y;
+    nz[count] = n.z;
+    d[count] = offset;
+    count++;
+}
+
+// With the box as center c and half extent e, a plane's signed
+// distance to c (scaled by |n|) is dot(n, c) + d, and the box reaches
+// dot(|n|, e) either side of that.
+Frustum::Side Frustum::Test(const glm::vec3& lo, const glm::vec3& hi) const
+{
+    const glm::vec3 c = 0.5f*(lo + hi), e = 0.5f*(hi - lo);
+    int outside = 0, partial = 0;
+#ifdef FRUSTUM_SSE
+    const __m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+    const __m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+    const __m128 sign = _mm_set1_ps(-0.0f), zero = _mm_setzero_ps();
+    for (int p=0;  p<count;  p+=4) {
+        const __m128 px = _mm_loadu_ps(nx + p), py = _mm_loadu_ps(ny + p), pz = _mm_loadu_ps(nz + p);
+        const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+                                       _mm_add_ps(_mm_mul_ps(pz, cz), _mm_loadu_ps(d + p)));
+        const __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, px), ex),
+                                               _mm_mul_ps(_mm_andnot_ps(sign, py), ey)),
+                                    _mm_mul_ps(_mm_andnot_ps(sign, pz), ez));
+        outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, r), zero));
+        partial |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dist, r), zero)); }
+#else
+    for (int p=0;  p<count;  p++) {
+        const float dist = nx[p]*c.x + ny[p]*c.y + nz[p]*c.z + d[p];
+        const float r = fabsf(nx[p])*e.x + fabsf(ny[p])*e.y + fabsf(nz[p])*e.z;
+        outside |= dist + r < 0.0f;
+        partial |= dist - r < 0.0f; }
+#endif
+    return outside ? OUTSIDE : partial ? PARTIAL : INSIDE;
+}
@@ -0,0 +1,39 @@
+////////////////////////////////////////////////////////////////////////
+// A convex volume bounded by up to eight planes, for culling boxes:
+// a pass's view frustum (from its projection times view matrix), or
+// any other set of half spaces, such as the hemisphere a paraboloid
+// reflection sees.
+//
+// The planes are held as four arrays (of x, y and z of the normal,
+// and the offset) so that Test, with SSE, tests a box against four
+// planes at once.  Unused planes contain everything.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _FRUSTUM_
+#define _FRUSTUM_
+
+class Frustum
+{
+public:
+    enum { MAX_PLANES = 8 };
+    enum Side { OUTSIDE, PARTIAL, INSIDE };
+
+    int count;
+    // Plane p keeps the points x with dot(n, x) + d >= 0, where n = (nx, ny, nz)[p]
+    float nx[MAX_PLANES], ny[MAX_PLANES], nz[MAX_PLANES], d[MAX_PLANES];
+
+    Frustum() { Clear(); }
+    void Clear();
+
+    // The six planes of the clip volume of an OpenGL projection (times
+    // view) matrix, in world space.
+    static Frustum FromMatrix(const glm::mat4& viewProj);
+
+    void AddPlane(const glm::vec3& n, const float offset);
+
+    // Whether a box is entirely outside (of some plane), entirely
+    // inside (all planes), or neither.
+    Side Test(const glm::vec3& lo, const glm::vec3& hi) const;
+};
+
+#endif
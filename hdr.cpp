@@ -0,0 +1,423 @@
+////////////////////////////////////////////////////////////////////////
+// Reading and writing Radiance .hdr (RGBE) images.  See hdr.h for an
+// overview.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "hdr.h"
+
+// Rows decoded per task when a whole image is read in parallel
+const int chunkRows = 32;
+
+// The float value of one unit of the mantissa for each exponent byte.
+struct ExponentTable
+{
+    float scale[256];
+    ExponentTable()
+    {
+        scale[0] = 0.0f;
+        for (int e=1;  e<256;  e++)
+            scale[e] = (float)ldexp(1.0, e-(128+8)); }
+};
+static const ExponentTable exponents;
+
+HdrReader::HdrReader()
+    : width(0), height(0), data(NULL), size(0), file(NULL), mapping(NULL)
+{
+}
+
+HdrReader::~HdrReader()
+{
+    Close();
+}
+
+void HdrReader::Close()
+{
+#ifdef _WIN32
+    if (mapping) {
+        UnmapViewOfFile(data);
+        CloseHandle((HANDLE)mapping); }
+    if (file)
+        CloseHandle((HANDLE)file);
+#else
+    if (mapping)
+        munmap(mapping, size);
+#endif
+    file = mapping = NULL;
+    data = NULL;
+    size = 0;
+    buffer.clear();
+    rowStart.clear();
+    width = height = 0;
+}
+
+bool HdrReader::Open(const std::string& _name)
+{
+    Close();
+    name = _name;
+
+    // Map the file, or failing that read it all into memory.
+#ifdef _WIN32
+    HANDLE fh = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(fh, &fileSize);
+        HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mh) {
+            data = (const unsigned char*)MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+            if (data) {
+                file = fh;
+                mapping = mh;
+                size = (size_t)fileSize.QuadPart; }
+            else
+                CloseHandle(mh); }
+        if (!data)
+            CloseHandle(fh); }
+#else
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                mapping = p;
+                data = (const unsigned char*)p;
+                size = st.st_size; } }
+        close(fd); }
+#endif
+    if (!data) {
+        FILE* fp = fopen(name.c_str(), "rb");
+        if (!fp) {
+            printf("Can't open file: %s\n", name.c_str());
+            return false; }
+        unsigned char chunk[1<<16];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+            buffer.insert(buffer.end(), chunk, chunk+n);
+        fclose(fp);
+        data = buffer.empty() ? NULL : &buffer[0];
+        size = buffer.size(); }
+
+    // The header is text lines ending with an empty line, and then a
+    // line giving the resolution.
+    size_t p = 0;
+    std::string line;
+    bool first = true;
+    while (true) {
+        size_t e = p;
+        while (e < size && data[e] != '\n') e++;
+        if (e >= size) {
+            printf("HDR read error in %s: unterminated header\n", name.c_str());
+            Close();
+            return false; }
+        line.assign((const char*)data+p, e-p);
+        p = e+1;
+        if (first && line.compare(0, 2, "#?") != 0) {
+            printf("HDR read error in %s: bad initial token\n", name.c_str());
+            Close();
+            return false; }
+        first = false;
+        if (line.empty())
+            break;
+        if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+            printf("HDR read error in %s: unsupported %s\n", name.c_str(), line.c_str());
+            Close();
+            return false; } }
+
+    size_t e = p;
+    while (e < size && data[e] != '\n') e++;
+    line.assign((const char*)data+p, e-p);
+    p = e+1;
+    int w, h;
+    if (sscanf(line.c_str(), "-Y %d +X %d", &h, &w) != 2 || w <= 0 || h <= 0) {
+        printf("HDR read error in %s: missing or unsupported image size\n", name.c_str());
+        Close();
+        return false; }
+
+    // Find the start of each scanline.  A run-length encoded scanline
+    // starts with 2,2 and its width, followed by each of the four
+    // channels in turn as runs (count>128: one byte repeated
+    // count-128 times) or literals (count bytes).  Anything else is a
+    // flat scanline of 4 bytes per pixel.
+    rowStart.resize(h);
+    for (int y=0;  y<h;  y++) {
+        rowStart[y] = p;
+        if (w >= 8 && w < 0x8000 && p+4 <= size
+            && data[p] == 2 && data[p+1] == 2 && !(data[p+2] & 0x80)) {
+            if (((data[p+2]<<8) | data[p+3]) != w) {
+                printf("HDR read error in %s: wrong scanline width\n", name.c_str());
+                Close();
+                return false; }
+            p += 4;
+            for (int c=0;  c<4;  c++)
+                for (int n=0;  n<w;  ) {
+                    if (p >= size) {
+                        printf("HDR read error in %s: file is truncated\n", name.c_str());
+                        Close();
+                        return false; }
+                    int count = data[p++];
+                    if (count > 128) {
+                        count -= 128;
+                        p++; }
+                    else
+                        p += count;
+                    if (count == 0 || n+count > w) {
+                        printf("HDR read error in %s: bad scanline data\n", name.c_str());
+                        Close();
+                        return false; }
+                    n += count; } }
+        else
+            p += 4*(size_t)w;
+        if (p > size) {
+            printf("HDR read error in %s: file is truncated\n", name.c_str());
+            Close();
+            return false; } }
+
+    width = w;
+    height = h;
+    return true;
+}
+
+// One scanline as interleaved RGBE bytes.  The indexing pass has
+// already validated the run lengths.
+void HdrReader::DecodeRow(const int y, unsigned char* rgbe) const
+{
+    size_t p = rowStart[y];
+    if (width >= 8 && width < 0x8000 && data[p] == 2 && data[p+1] == 2 && !(data[p+2] & 0x80)) {
+        p += 4;
+        for (int c=0;  c<4;  c++)
+            for (int n=0;  n<width;  ) {
+                int count = data[p++];
+                if (count > 128) {
+                    count -= 128;
+                    unsigned char v = data[p++];
+                    for (int i=0;  i<count;  i++)
+                        rgbe[4*(n+i)+c] = v; }
+                else
+                    for (int i=0;  i<count;  i++)
+                        rgbe[4*(n+i)+c] = data[p++];
+                n += count; } }
+    else
+        memcpy(rgbe, data+p, 4*(size_t)width);
+}
+
+bool HdrReader::DecodeRows(const int y0, const int y1, float* rgb) const
+{
+    if (y0 < 0 || y1 > height)
+        return false;
+    std::vector<unsigned char> rgbe(4*width);
+    for (int y=y0;  y<y1;  y++) {
+        DecodeRow(y, &rgbe[0]);
+        float* row = rgb + 3*(size_t)width*(y-y0);
+        for (int i=0;  i<width;  i++) {
+            float f = exponents.scale[rgbe[4*i+3]];
+            row[3*i+0] = rgbe[4*i+0] * f;
+            row[3*i+1] = rgbe[4*i+1] * f;
+            row[3*i+2] = rgbe[4*i+2] * f; } }
+    return true;
+}
+
+bool HdrReader::Read(std::vector<float>& rgb) const
+{
+    rgb.resize(3*(size_t)width*height);
+    int chunks = (height + chunkRows-1)/chunkRows;
+    bool ok = true;
+#pragma omp parallel for schedule(dynamic, 1) reduction(&&:ok)
+    for (int c=0;  c<chunks;  c++) {
+        int y0 = c*chunkRows, y1 = std::min(height, y0+chunkRows);
+        ok = DecodeRows(y0, y1, &rgb[3*(size_t)width*y0]) && ok; }
+    return ok;
+}
+
+// Since a value is mantissa*scale[exponent], its gamma encoding is
+// mantissa^(1/gamma) * scale[exponent]^(1/gamma), so two small tables
+// replace a pow per value.
+bool HdrReader::ReadHalf(std::vector<unsigned short>& rgb, const bool flipRows,
+                         const float gamma) const
+{
+    float mant[256], scale[256];
+    for (int i=0;  i<256;  i++) {
+        mant[i] = (float)pow((double)i, 1.0/gamma);
+        scale[i] = (float)pow((double)exponents.scale[i], 1.0/gamma); }
+    const float maxValue = gamma != 1.0f ? 1.0f : 65504.0f;
+
+    rgb.resize(3*(size_t)width*height);
+#pragma omp parallel for schedule(dynamic, chunkRows)
+    for (int y=0;  y<height;  y++) {
+        std::vector<unsigned char> rgbe(4*width);
+        DecodeRow(y, &rgbe[0]);
+        unsigned short* dst = &rgb[3*(size_t)width*(flipRows ? height-1-y : y)];
+        for (int i=0;  i<width;  i++) {
+            float f = scale[rgbe[4*i+3]];
+            for (int c=0;  c<3;  c++)
+                dst[3*i+c] = FloatToHalf(std::min(maxValue, mant[rgbe[4*i+c]] * f)); } }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Writing.  The conversion to RGBE and the run-length encoding follow
+// rgbe.c, so files are byte for byte what it wrote (with the
+// "#?RADIANCE" signature, which stb_image requires).
+
+static void FloatToRGBE(const float* rgb, unsigned char* rgbe)
+{
+    double v = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+    if (v < 1e-32) {
+        rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+        return; }
+    int e;
+    v = frexp(v, &e) * 256.0/v;
+    rgbe[0] = (unsigned char)(rgb[0] * v);
+    rgbe[1] = (unsigned char)(rgb[1] * v);
+    rgbe[2] = (unsigned char)(rgb[2] * v);
+    rgbe[3] = (unsigned char)(e + 128);
+}
+
+// Run-length encode n bytes (one channel of a scanline), using runs
+// only when at least minRun long.
+static void EncodeChannel(const unsigned char* data, const int n, std::vector<unsigned char>& out)
+{
+    const int minRun = 4;
+    int cur = 0;
+    while (cur < n) {
+        // Find the next run of at least minRun
+        int begRun = cur, runCount = 0, oldRunCount = 0;
+        while (runCount < minRun && begRun < n) {
+            begRun += runCount;
+            oldRunCount = runCount;
+            runCount = 1;
+            while (begRun+runCount < n && runCount < 127 && data[begRun] == data[begRun+runCount])
+                runCount++; }
+
+        // A short run just before the long one is still worth a run
+        if (oldRunCount > 1 && oldRunCount == begRun-cur) {
+            out.push_back((unsigned char)(128 + oldRunCount));
+            out.push_back(data[cur]);
+            cur = begRun; }
+
+        // Literals up to the run
+        while (cur < begRun) {
+            int count = std::min(128, begRun-cur);
+            out.push_back((unsigned char)count);
+            out.insert(out.end(), data+cur, data+cur+count);
+            cur += count; }
+
+        if (runCount >= minRun) {
+            out.push_back((unsigned char)(128 + runCount));
+            out.push_back(data[begRun]);
+            cur += runCount; } }
+}
+
+bool HdrWrite(const std::string& name, const float* rgb, const int width, const int height)
+{
+    // Encode the rows in parallel, then write them in order.
+    std::vector<std::vector<unsigned char> > rows(height);
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int y=0;  y<height;  y++) {
+        std::vector<unsigned char> rgbe(4*width);
+        for (int i=0;  i<width;  i++)
+            FloatToRGBE(rgb + 3*((size_t)y*width+i), &rgbe[4*i]);
+
+        std::vector<unsigned char>& out = rows[y];
+        if (width < 8 || width >= 0x8000) {
+            out.swap(rgbe);
+            continue; }
+
+        out.reserve(4*width + 4);
+        out.push_back(2);
+        out.push_back(2);
+        out.push_back((unsigned char)(width >> 8));
+        out.push_back((unsigned char)(width & 0xff));
+        std::vector<unsigned char> channel(width);
+        for (int c=0;  c<4;  c++) {
+            for (int i=0;  i<width;  i++)
+                channel[i] = rgbe[4*i+c];
+            EncodeChannel(&channel[0], width, out); } }
+
+    FILE* fp = fopen(name.c_str(), "wb");
+    if (!fp) {
+        printf("Can't create file: %s\n", name.c_str());
+        return false; }
+    bool ok = fprintf(fp, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", height, width) > 0;
+    for (int y=0;  ok && y<height;  y++)
+        ok = fwrite(&rows[y][0], 1, rows[y].size(), fp) == rows[y].size();
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok)
+        printf("HDR write error in %s\n", name.c_str());
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Half floats
+
+unsigned short FloatToHalf(const float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, 4);
+    uint32_t sign = (x >> 16) & 0x8000;
+    int exp = (int)((x >> 23) & 0xff);
+    uint32_t mant = x & 0x7fffff;
+
+    if (exp == 0xff)            // Inf or NaN
+        return (unsigned short)(sign | 0x7c00 | (mant ? 0x200 : 0));
+    exp += 15 - 127;
+    if (exp >= 31)              // Overflow to Inf
+        return (unsigned short)(sign | 0x7c00);
+    if (exp <= 0) {             // Denormal or zero
+        if (exp < -10)
+            return (unsigned short)sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t h = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1), half = 1u << (shift-1);
+        if (rest > half || (rest == half && (h & 1)))
+            h++;
+        return (unsigned short)(sign | h); }
+
+    // Rounding may carry into the exponent, which is still correct.
+    uint32_t h = ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rest = mant & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+        h++;
+    return (unsigned short)(sign | h);
+}
+
+float HalfToFloat(const unsigned short h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0x1f)
+        x = sign | 0x7f800000 | (mant << 13);
+    else if (exp == 0) {
+        if (mant == 0)
+            x = sign;
+        else {                  // Normalize a denormal
+            exp = 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                exp--; }
+            x = sign | ((uint32_t)(exp + 127 - 15) << 23) | ((mant & 0x3ff) << 13); } }
+    else
+        x = sign | ((uint32_t)(exp + 127 - 15) << 23) | (mant << 13);
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
@@ -0,0 +1,67 @@
+////////////////////////////////////////////////////////////////////////
+// Reading and writing Radiance .hdr (RGBE) images.
+//
+// An HdrReader maps the file into memory, parses the header, and
+// makes one quick pass over the run-length encoded data to find where
+// each scanline starts.  Any range of rows can then be decoded
+// independently, so a whole image decodes in parallel, and a consumer
+// can stream the image a few rows at a time without ever holding the
+// full float image.  Rows decode to RGB floats or to half floats.
+//
+// Only the usual orientation (-Y height +X width) and the RGBE format
+// are handled, as with Greg Ward's rgbe.c which this replaces.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _HDR_
+#define _HDR_
+
+#include <string>
+#include <vector>
+
+class HdrReader
+{
+public:
+    int width, height;
+
+    HdrReader();
+    ~HdrReader();
+
+    // Open and index a file.  Prints a message and returns false on error.
+    bool Open(const std::string& name);
+    void Close();
+
+    // Decode rows [y0, y1) as interleaved RGB floats (3*width per
+    // row).  Thread safe, so disjoint ranges may decode in parallel.
+    bool DecodeRows(const int y0, const int y1, float* rgb) const;
+
+    // The whole image, decoded in parallel in chunks of rows.
+    bool Read(std::vector<float>& rgb) const;
+
+    // The whole image as RGB half floats, optionally bottom row first
+    // (as OpenGL wants).  With gamma != 1 each value becomes
+    // min(1, v^(1/gamma)), like stb_image's conversion of HDR to LDR;
+    // otherwise values beyond the half float range are clamped to it.
+    bool ReadHalf(std::vector<unsigned short>& rgb, const bool flipRows=false,
+                  const float gamma=1.0f) const;
+
+private:
+    std::string name;
+    const unsigned char* data;  // The mapped file
+    size_t size;
+    void* file;                 // Platform handles of the mapping
+    void* mapping;
+    std::vector<unsigned char> buffer;  // Used instead if mapping fails
+    std::vector<size_t> rowStart;       // Offset of each scanline in data
+
+    void DecodeRow(const int y, unsigned char* rgbe) const;
+};
+
+// Write an image of interleaved RGB floats, run-length encoded.  Rows
+// are encoded in parallel.  Prints a message and returns false on error.
+bool HdrWrite(const std::string& name, const float* rgb, const int width, const int height);
+
+// IEEE half float conversions, rounding to nearest even.
+unsigned short FloatToHalf(const float f);
+float HalfToFloat(const unsigned short h);
+
+#endif
@@ -0,0 +1,223 @@
+////////////////////////////////////////////////////////////////////////
+// Rendering with no window.  See headless.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <vector>
+#include <algorithm>
+
+#include "framework.h"
+#include "headless.h"
+#include "png.h"
+
+#ifndef _WIN32
+#define EGL_NO_X11              // Keep Xlib's macros out
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+HeadlessContext::HeadlessContext()
+    : window(NULL), display(NULL), surface(NULL), context(NULL)
+{}
+
+#ifdef _WIN32
+bool HeadlessContext::Create(const int width, const int height)
+{
+    if (!glfwInit()) {
+        printf("Can't initialize GLFW\n");
+        return false; }
+    glfwWindowHint(GLFW_VISIBLE, 0);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    window = glfwCreateWindow(width, height, "Graphics Framework", NULL, NULL);
+    if (!window) {
+        printf("Can't create a hidden %dx%d window\n", width, height);
+        return false; }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+    return true;
+}
+
+void HeadlessContext::Destroy()
+{
+    if (window) {
+        glfwDestroyWindow(window);
+        glfwTerminate(); }
+    window = NULL;
+}
+
+#else
+bool HeadlessContext::Create(const int width, const int height)
+{
+    // Prefer Mesa's surfaceless platform, which needs no display
+    // server, over whatever the default display is.
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay)
+        dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    EGLint major, minor;
+    if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, &major, &minor)) {
+        dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, &major, &minor)) {
+            printf("Can't initialize EGL\n");
+            return false; } }
+    display = dpy;
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE };
+    EGLConfig config;
+    EGLint count = 0;
+    if (!eglChooseConfig(dpy, configAttribs, &config, 1, &count) || count == 0) {
+        printf("No EGL config for a pbuffer with OpenGL\n");
+        return false; }
+
+    const EGLint surfaceAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    surface = eglCreatePbufferSurface(dpy, config, surfaceAttribs);
+    if (surface == EGL_NO_SURFACE) {
+        printf("Can't create a %dx%d EGL pbuffer\n", width, height);
+        return false; }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE };
+    eglBindAPI(EGL_OPENGL_API);
+    context = eglCreateContext(dpy, config, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT) {
+        printf("Can't create an OpenGL 3.3 core context with EGL\n");
+        return false; }
+    if (!eglMakeCurrent(dpy, surface, surface, context)) {
+        printf("Can't make the EGL context current\n");
+        return false; }
+    printf("EGL %d.%d, %dx%d pbuffer\n", major, minor, width, height);
+    return true;
+}
+
+void HeadlessContext::Destroy()
+{
+    if (!display)
+        return;
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context)
+        eglDestroyContext(display, context);
+    if (surface)
+        eglDestroySurface(display, surface);
+    eglTerminate(display);
+    display = surface = context = NULL;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Camera paths
+
+bool CameraPath::Read(const std::string& name)
+{
+    FILE* fp = fopen(name.c_str(), "r");
+    if (!fp) {
+        printf("Can't open camera path: %s\n", name.c_str());
+        return false; }
+    keys.clear();
+    char line[256];
+    for (int n=1;  fgets(line, sizeof(line), fp);  n++) {
+        if (char* comment = strchr(line, '#'))
+            *comment = 0;
+        Key k;
+        const int got = sscanf(line, "%f %f %f %f %f %f", &k.time, &k.spin, &k.tilt, &k.zoom,
+                               &k.lightSpin, &k.lightTilt);
+        if (got <= 0)
+            continue;
+        if (keys.empty())
+            light = got == 6;
+        if (got != (light ? 6 : 4) || (!keys.empty() && k.time <= keys.back().time)) {
+            printf("Bad camera key at %s:%d\n", name.c_str(), n);
+            fclose(fp);
+            return false; }
+        keys.push_back(k); }
+    fclose(fp);
+    if (keys.empty()) {
+        printf("No camera keys in %s\n", name.c_str());
+        return false; }
+    return true;
+}
+
+void CameraPath::Orbit(const Scene& scene, const float duration)
+{
+    const Key start = { 0.0f, scene.spin, scene.tilt, scene.zoom, scene.lightSpin, scene.lightTilt };
+    const Key end = { std::max(duration, 1e-3f), scene.spin + 360.0f, scene.tilt, scene.zoom,
+                      scene.lightSpin + 180.0f, scene.lightTilt };
+    light = true;
+    keys.clear();
+    keys.push_back(start);
+    keys.push_back(end);
+}
+
+void CameraPath::Apply(Scene& scene, const float t) const
+{
+    if (keys.empty())
+        return;
+    Key k = t <= keys[0].time ? keys[0] : keys.back();
+    for (size_t i=1;  i<keys.size() && t > keys[0].time;  i++)
+        if (t < keys[i].time) {
+            const Key& a = keys[i-1];
+            const Key& b = keys[i];
+            const float s = (t - a.time)/(b.time - a.time);
+            k.spin = a.spin + s*(b.spin - a.spin);
+            k.tilt = a.tilt + s*(b.tilt - a.tilt);
+            k.zoom = a.zoom + s*(b.zoom - a.zoom);
+            k.lightSpin = a.lightSpin + s*(b.lightSpin - a.lightSpin);
+            k.lightTilt = a.lightTilt + s*(b.lightTilt - a.lightTilt);
+            break; }
+    scene.transformationMode = true;
+    scene.spin = k.spin;
+    scene.tilt = k.tilt;
+    scene.zoom = k.zoom;
+    if (light) {
+        scene.lightSpin = k.lightSpin;
+        scene.lightTilt = k.lightTilt; }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Frame dumps
+
+// OpenGL's rows run bottom up; the files' run top down.
+void ReadFramebuffer(const int width, const int height, std::vector<unsigned char>& rgb)
+{
+    const size_t row = 3*(size_t)width;
+    std::vector<unsigned char> pixels(row*height);
+    rgb.resize(row*height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+    for (int y=0;  y<height;  y++)
+        std::copy(&pixels[(height-1-y)*row], &pixels[(height-1-y)*row] + row, &rgb[y*row]);
+}
+
+bool IsPngName(const std::string& name)
+{
+    const size_t dot = name.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : name.substr(dot+1);
+    for (size_t i=0;  i<ext.size();  i++)
+        ext[i] = (char)tolower(ext[i]);
+    return ext == "png";
+}
+
+bool SaveFramebuffer(const std::string& name, const int width, const int height)
+{
+    if (!IsPngName(name)) {
+        printf("Can't write %s: frames are written only as .png\n", name.c_str());
+        return false; }
+    std::vector<unsigned char> rgb;
+    ReadFramebuffer(width, height, rgb);
+    return PngWrite(name, &rgb[0], width, height);
+}
@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////
+// Rendering with OpenGL but no window, so batch renders and
+// benchmarks run on machines with no display.
+//
+// HeadlessContext makes an OpenGL 3.3 core context whose default
+// framebuffer is an offscreen surface of a given size: on Linux an EGL
+// pbuffer, which works with no X server (e.g. with Mesa's llvmpipe),
+// and elsewhere a hidden GLFW window.  Nothing is ever swapped, so
+// nothing waits for vsync.
+//
+// CameraPath scripts the scene's orbiting camera, and optionally its
+// light: keys of spin, tilt and zoom (and the light's spin and tilt)
+// at given times, interpolated linearly between them.  A path is read
+// from a text file of lines
+//     time spin tilt zoom [lightSpin lightTilt]
+// (times in seconds, increasing; '#' starts a comment; the light on
+// every line or none), or is made as one turn around the scene.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _HEADLESS_
+#define _HEADLESS_
+
+#include <string>
+#include <vector>
+
+class Scene;
+struct GLFWwindow;
+
+class HeadlessContext
+{
+public:
+    HeadlessContext();
+    ~HeadlessContext() { Destroy(); }
+
+    // Create the context and make it current.  Prints a message and
+    // returns false on error.
+    bool Create(const int width, const int height);
+    void Destroy();
+
+private:
+    GLFWwindow* window;         // When not using EGL
+    void* display;              // EGLDisplay, EGLSurface, EGLContext
+    void* surface;
+    void* context;
+};
+
+class CameraPath
+{
+public:
+    struct Key
+    {
+        float time, spin, tilt, zoom;
+        float lightSpin, lightTilt;
+    };
+    std::vector<Key> keys;
+    bool light;                 // Whether the keys move the light
+
+    CameraPath() : light(false) {}
+
+    // Prints a message and returns false on error.
+    bool Read(const std::string& name);
+
+    // One full turn of spin over the given time, from the scene's
+    // current view, with the light turning half as far.
+    void Orbit(const Scene& scene, const float duration);
+
+    // Set the scene's camera to the path's position at time t.
+    void Apply(Scene& scene, const float t) const;
+};
+
+// Read the current context's framebuffer as RGB, top row first.
+void ReadFramebuffer(const int width, const int height, std::vector<unsigned char>& rgb);
+
+// Whether a file name ends in .png, the one format SaveFramebuffer
+// writes.  The framebuffer holds the lighting pass's tone mapped 8-bit
+// colors, so a float format would add nothing.  For a linear image of
+// the scene, path trace one (-pathtrace, in the v=em build) to .hdr.
+bool IsPngName(const std::string& name);
+
+// Read the current context's framebuffer and write it as a .png.
+// Prints a message and returns false on error, or for any other
+// extension.
+bool SaveFramebuffer(const std::string& name, const int width, const int height);
+
+#endif
@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////
+// Comparing rendered images.  See imagediff.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "imagediff.h"
+#include "stb_image.h"
+
+// sRGB values, linearized
+struct LinearTable
+{
+    float value[256];
+    LinearTable()
+    {
+        for (int i=0;  i<256;  i++) {
+            const double c = i/255.0;
+            value[i] = (float)(c <= 0.04045 ? c/12.92 : pow((c + 0.055)/1.055, 2.4)); } }
+};
+static const LinearTable linear;
+
+static float LabF(const float t)
+{
+    return t > 216.0f/24389.0f ? cbrtf(t) : (24389.0f/27.0f*t + 16.0f)/116.0f;
+}
+
+// CIELAB of an sRGB color, with the D65 white point
+static void Lab(const unsigned char* rgb, float lab[3])
+{
+    const float r = linear.value[rgb[0]], g = linear.value[rgb[1]], b = linear.value[rgb[2]];
+    const float x = LabF((0.4124f*r + 0.3576f*g + 0.1805f*b)/0.95047f);
+    const float y = LabF( 0.2126f*r + 0.7152f*g + 0.0722f*b);
+    const float z = LabF((0.0193f*r + 0.1192f*g + 0.9505f*b)/1.08883f);
+    lab[0] = 116.0f*y - 16.0f;
+    lab[1] = 500.0f*(x - y);
+    lab[2] = 200.0f*(y - z);
+}
+
+// Black, blue, red, yellow as t goes from 0 to 1
+static void Heat(const float t, unsigned char* rgb)
+{
+    const float s = std::min(std::max(t, 0.0f), 1.0f)*3.0f;
+    float r, g, b;
+    if (s < 1.0f) {
+        r = 0.0f;  g = 0.0f;  b = s; }
+    else if (s < 2.0f) {
+        r = s - 1.0f;  g = 0.0f;  b = 2.0f - s; }
+    else {
+        r = 1.0f;  g = s - 2.0f;  b = 0.0f; }
+    rgb[0] = (unsigned char)(255.0f*r + 0.5f);
+    rgb[1] = (unsigned char)(255.0f*g + 0.5f);
+    rgb[2] = (unsigned char)(255.0f*b + 0.5f);
+}
+
+void DiffImages(const unsigned char* a, const unsigned char* b, const int width, const int height,
+                const ImageTolerance& tolerance, ImageDiff& diff)
+{
+    const int n = width*height;
+    diff.heatmap.resize(3*(size_t)n);
+    std::vector<float> deltaE(n);
+    std::vector<unsigned char> isOver(n);
+#pragma omp parallel for
+    for (int i=0;  i<n;  i++) {
+        const unsigned char* pa = a + 3*(size_t)i;
+        const unsigned char* pb = b + 3*(size_t)i;
+        int channel = 0;
+        for (int c=0;  c<3;  c++)
+            channel = std::max(channel, abs((int)pa[c] - (int)pb[c]));
+        isOver[i] = channel > tolerance.channel;
+        float la[3], lb[3];
+        Lab(pa, la);
+        Lab(pb, lb);
+        deltaE[i] = sqrtf((la[0]-lb[0])*(la[0]-lb[0]) + (la[1]-lb[1])*(la[1]-lb[1]) + (la[2]-lb[2])*(la[2]-lb[2]));
+        Heat(deltaE[i]/10.0f, &diff.heatmap[3*(size_t)i]); }
+
+    int over = 0;
+    double sum = 0.0, maxDeltaE = 0.0;
+    for (int i=0;  i<n;  i++) {
+        over += isOver[i];
+        sum += deltaE[i];
+        maxDeltaE = std::max(maxDeltaE, (double)deltaE[i]); }
+    diff.over = over;
+    diff.overFraction = n ? (double)over/n : 0.0;
+    diff.meanDeltaE = n ? sum/n : 0.0;
+    diff.maxDeltaE = maxDeltaE;
+    diff.pass = diff.overFraction <= tolerance.overFraction && diff.meanDeltaE <= tolerance.meanDeltaE;
+}
+
+bool ReadImage(const std::string& name, std::vector<unsigned char>& rgb, int& width, int& height)
+{
+    // stb_image's flip is global, and Texture sets it.
+    stbi_set_flip_vertically_on_load(false);
+    int channels;
+    unsigned char* image = stbi_load(name.c_str(), &width, &height, &channels, 3);
+    if (!image) {
+        printf("Read error on file %s: %s\n", name.c_str(), stbi_failure_reason());
+        return false; }
+    rgb.assign(image, image + 3*(size_t)width*height);
+    stbi_image_free(image);
+    return true;
+}
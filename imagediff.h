@@ -0,0 +1,47 @@
+////////////////////////////////////////////////////////////////////////
+// Comparing rendered images against golden images, for catching
+// visual regressions.
+//
+// Two measures are taken per pixel: the largest difference of any
+// channel (in 8 bit units), and the perceptual difference, CIE76
+// delta E (the distance in CIELAB, where about 2.3 is just noticeable),
+// of the colors taken as sRGB.  An image passes if few enough pixels
+// exceed the channel tolerance, and the mean delta E is small
+// enough.  A heat map of delta E shows where the images differ: black
+// where they match, through blue and red to yellow at delta E 10 and
+// beyond.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _IMAGEDIFF_
+#define _IMAGEDIFF_
+
+#include <string>
+#include <vector>
+
+struct ImageTolerance
+{
+    int channel;                // Largest channel difference not counted
+    double overFraction;        // Of pixels allowed over the channel tolerance
+    double meanDeltaE;          // Largest mean delta E allowed
+
+    ImageTolerance() : channel(8), overFraction(0.002), meanDeltaE(1.0) {}
+};
+
+struct ImageDiff
+{
+    int over;                   // Pixels over the channel tolerance
+    double overFraction;
+    double meanDeltaE, maxDeltaE;
+    bool pass;
+    std::vector<unsigned char> heatmap;     // RGB, as the images
+};
+
+// Compare two images of interleaved 8 bit RGB of the same size.
+void DiffImages(const unsigned char* a, const unsigned char* b, const int width, const int height,
+                const ImageTolerance& tolerance, ImageDiff& diff);
+
+// Read an image as interleaved 8 bit RGB, top row first.  Prints a
+// message and returns false on error.
+bool ReadImage(const std::string& name, std::vector<unsigned char>& rgb, int& width, int& height);
+
+#endif
@@ -120,6 +120,30 @@ void Keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
 
 }
 
+////////////////////////////////////////////////////////////////////////
+// Report the object under the cursor: its objectId, and the path of
+// instance indices leading to it from the root, with the objectId of
+// each object along the way.
+void PickObject(const double x, const double y)
+{
+    const double start = glfwGetTime();
+    RayHit hit;
+    const SceneBvh::Instance* picked = scene.Pick(x, y, hit);
+    const double ms = 1000*(glfwGetTime() - start);
+    if (!picked) {
+        printf("Picked nothing (%.3f ms)\n", ms);
+        return; }
+
+    printf("Picked objectId %d, triangle %d at distance %.2f (%.3f ms)\n  path: root(%d)",
+           picked->object->objectId, hit.tri, hit.t, ms, scene.objectRoot->objectId);
+    const Object* object = scene.objectRoot;
+    for (size_t i=0;  i<picked->path.size();  i++) {
+        object = object->instances[picked->path[i]].first;
+        printf(" > [%d](%d)", picked->path[i], object->objectId); }
+    printf("\n");
+    fflush(stdout);
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Called when a mouse button changes state.
 void MouseButton(GLFWwindow* window, int button, int action, int mods)
@@ -134,7 +158,9 @@ void MouseButton(GLFWwindow* window, int button, int action, int mods)
     // Record any change of state in variables in the scene object.
     
     if (button == GLFW_MOUSE_BUTTON_LEFT) {
-        leftDown = (action == GLFW_PRESS); }
+        leftDown = (action == GLFW_PRESS);
+        if (leftDown)
+            PickObject(mouseX, mouseY); }
 
     else if (button == GLFW_MOUSE_BUTTON_MIDDLE) {
         middleDown = (action == GLFW_PRESS);  }
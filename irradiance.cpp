@@ -0,0 +1,641 @@
+////////////////////////////////////////////////////////////////////////
+// Irradiance filtering of equirectangular HDR environment maps.  See
+// irradiance.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#define _USE_MATH_DEFINES
+#include "math.h"
+#include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "hdr.h"
+#include "irradiance.h"
+
+const float pi = 3.141592f;
+
+static int ThreadCount()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static int ThreadNum()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////
+// Exact convolution with precomputed tables.  An input direction is
+// W = (sin(theta_l)*cos(phi_k), sin(theta_l)*sin(phi_k), cos(theta_l)),
+// so for a fixed output normal N,
+//   N.W = sin(theta_l)*(Nx*cos(phi_k) + Ny*sin(phi_k)) + Nz*cos(theta_l).
+// The bracketed term depends only on the column, and is computed once
+// per output pixel; sin/cos of theta only on the row.  The radiance
+// is stored as planar R, G, B rows already weighted by each row's
+// solid angle sin(theta)*dTheta*dPhi, so the inner loop is a
+// multiply-add over contiguous floats that vectorizes cleanly.
+IrradianceFilter::IrradianceFilter(const std::vector<float>& image, const int _width, const int _height)
+    : width(_width), height(_height), tileRows(32)
+{
+    AllocateInput();
+    SetRows(0, height, &image[0]);
+}
+
+// Streaming construction: each thread decodes a few rows at a time
+// straight into the planar tables, so the interleaved float image is
+// never held in memory.
+IrradianceFilter::IrradianceFilter(const HdrReader& hdr)
+    : width(hdr.width), height(hdr.height), tileRows(32)
+{
+    AllocateInput();
+    const int chunkRows = 16;
+    int chunks = (height + chunkRows-1)/chunkRows;
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int c=0;  c<chunks;  c++) {
+        int y0 = c*chunkRows, y1 = std::min(height, y0+chunkRows);
+        std::vector<float> rows(3*width*(y1-y0));
+        hdr.DecodeRows(y0, y1, &rows[0]);
+        SetRows(y0, y1, &rows[0]); }
+}
+
+void IrradianceFilter::AllocateInput()
+{
+    levels.resize(1);
+    Level& lv = levels[0];
+    lv.width = width;
+    lv.height = height;
+    lv.BuildTables();
+
+    lv.R.resize(width*height);
+    lv.G.resize(width*height);
+    lv.B.resize(width*height);
+}
+
+// Fill input rows [l0, l1) of level 0 from interleaved RGB.
+void IrradianceFilter::SetRows(const int l0, const int l1, const float* rgb)
+{
+    Level& lv = levels[0];
+    for (int l=l0;  l<l1;  l++) {
+        float angTheta = (pi * (l + 0.5f)) / height;
+        float dOmega = sin(angTheta) * pi / height * 2 * pi / width;
+        const float* row = rgb + 3*width*(l-l0);
+        for (int k=0;  k<width;  k++) {
+            lv.R[l*width+k] = row[3*k+0] * dOmega;
+            lv.G[l*width+k] = row[3*k+1] * dOmega;
+            lv.B[l*width+k] = row[3*k+2] * dOmega; } }
+}
+
+void IrradianceFilter::Level::BuildTables()
+{
+    rowSin.resize(height);
+    rowCos.resize(height);
+    colCos.resize(width);
+    colSin.resize(width);
+
+    for (int k=0;  k<width;  k++) {
+        float angPhi = (2 * pi * (k + 0.5f)) / width;
+        colCos[k] = cos(angPhi);
+        colSin[k] = sin(angPhi); }
+
+    rowInvOmega.resize(height);
+    for (int l=0;  l<height;  l++) {
+        float angTheta = (pi * (l + 0.5f)) / height;
+        rowSin[l] = sin(angTheta);
+        rowCos[l] = cos(angTheta);
+        rowInvOmega[l] = 1.0f / (sin(angTheta) * pi / height * 2 * pi / width); }
+}
+
+// Bilinearly interpolated radiance in direction (x,y,z) (unit length),
+// wrapping around in phi and clamping at the poles.
+void IrradianceFilter::Level::Radiance(const float x, const float y, const float z, float* rgb) const
+{
+    float angTheta = acos(std::min(1.0f, std::max(-1.0f, z)));
+    float angPhi = atan2(y, x);
+    if (angPhi < 0.0f) angPhi += 2*pi;
+
+    float u = angPhi / (2*pi) * width - 0.5f;
+    float v = angTheta / pi * height - 0.5f;
+    int k0 = (int)floor(u), l0 = (int)floor(v);
+    float fu = u - k0, fv = v - l0;
+
+    rgb[0] = rgb[1] = rgb[2] = 0.0f;
+    for (int dl=0;  dl<2;  dl++) {
+        int l = std::min(height-1, std::max(0, l0+dl));
+        float wl = dl ? fv : 1.0f-fv;
+        for (int dk=0;  dk<2;  dk++) {
+            int k = ((k0+dk) % width + width) % width;
+            float w = wl * (dk ? fu : 1.0f-fu) * rowInvOmega[l];
+            rgb[0] += w*R[l*width+k];
+            rgb[1] += w*G[l*width+k];
+            rgb[2] += w*B[l*width+k]; } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Mip pyramid.  Since the planar radiance is already multiplied by
+// each texel's solid angle, a 2x2 block of texels merges into its
+// parent by simply adding them: the sum is the energy arriving
+// through the parent's (area weighted) solid angle.  Odd sizes round
+// up, and the last parent of a row or column takes a single child.
+void IrradianceFilter::BuildPyramid(const int minHeight)
+{
+    levels.resize(1);
+    while (levels.back().height/2 >= minHeight && levels.back().width > 1) {
+        levels.push_back(Level());
+        const Level& src = levels[levels.size()-2];
+        Level& dst = levels.back();
+        dst.width = (src.width+1)/2;
+        dst.height = (src.height+1)/2;
+        dst.BuildTables();
+        dst.R.assign(dst.width*dst.height, 0.0f);
+        dst.G.assign(dst.width*dst.height, 0.0f);
+        dst.B.assign(dst.width*dst.height, 0.0f);
+
+#pragma omp parallel for
+        for (int l=0;  l<dst.height;  l++)
+            for (int k=0;  k<dst.width;  k++)
+                for (int dl=0;  dl<2;  dl++)
+                    for (int dk=0;  dk<2;  dk++) {
+                        int sl = 2*l+dl, sk = 2*k+dk;
+                        if (sl >= src.height || sk >= src.width) continue;
+                        dst.R[l*dst.width+k] += src.R[sl*src.width+sk];
+                        dst.G[l*dst.width+k] += src.G[sl*src.width+sk];
+                        dst.B[l*dst.width+k] += src.B[sl*src.width+sk]; } }
+}
+
+// The error estimates compare a sparse grid of output pixels (about
+// 8x8, fixed so the estimate is repeatable) against level 0.  Each
+// sample costs one full resolution pixel, a tiny fraction of the
+// work a coarse level saves.
+void IrradianceFilter::SampleLevel(const int level, const int outWidth, const int outHeight,
+                                   std::vector<float>& samples) const
+{
+    std::vector<int> si, sj;
+    for (int j=outHeight/16;  j<outHeight;  j+=std::max(1, outHeight/8))
+        for (int i=outWidth/16;  i<outWidth;  i+=std::max(1, outWidth/8)) {
+            si.push_back(i);
+            sj.push_back(j); }
+    int n = (int)si.size();
+
+    const Level& lv = levels[level];
+    samples.resize(3*n);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int s=0;  s<n;  s++) {
+        std::vector<float> a(lv.width);
+        IrradianceAt(lv, &a[0], si[s], sj[s], outWidth, outHeight, 0, lv.height, &samples[3*s]); }
+}
+
+static void CompareSamples(const std::vector<float>& ref, const std::vector<float>& lev,
+                           float& maxError, float& rmsError)
+{
+    double sumSq = 0.0, maxRel = 0.0;
+    for (size_t s=0;  s<ref.size();  s++) {
+        double rel = fabs(lev[s]-ref[s]) / std::max(ref[s], 1e-6f);
+        sumSq += rel*rel;
+        maxRel = std::max(maxRel, rel); }
+    maxError = (float)maxRel;
+    rmsError = (float)sqrt(sumSq/std::max((size_t)1, ref.size()));
+}
+
+void IrradianceFilter::EstimateError(const int level, const int outWidth, const int outHeight,
+                                     float& maxError, float& rmsError) const
+{
+    std::vector<float> ref, lev;
+    SampleLevel(0, outWidth, outHeight, ref);
+    SampleLevel(level, outWidth, outHeight, lev);
+    CompareSamples(ref, lev, maxError, rmsError);
+}
+
+int IrradianceFilter::ChooseLevel(const int outWidth, const int outHeight, const float tolerance,
+                                  float& maxError, float& rmsError) const
+{
+    std::vector<float> ref, lev;
+    SampleLevel(0, outWidth, outHeight, ref);
+
+    int best = 0;
+    maxError = rmsError = 0.0f;
+    for (int level=1;  level<LevelCount();  level++) {
+        float maxE, rmsE;
+        SampleLevel(level, outWidth, outHeight, lev);
+        CompareSamples(ref, lev, maxE, rmsE);
+        if (rmsE >= tolerance) break;
+        best = level;
+        maxError = maxE;
+        rmsError = rmsE; }
+    return best;
+}
+
+// Accumulate one input row into sum[3]:  for each column k,
+//   w = max(0, s*a[k] + c);   sum += w*(R[k], G[k], B[k])
+// with s = sin(theta_l), c = Nz*cos(theta_l), and a[k] the column term.
+static void AccumulateRow(const float* a, const float s, const float c,
+                          const float* R, const float* G, const float* B,
+                          const int n, float* sum)
+{
+    int k = 0;
+    float r = 0.0f, g = 0.0f, b = 0.0f;
+
+#if defined(__AVX2__)
+    __m256 vs = _mm256_set1_ps(s);
+    __m256 vc = _mm256_set1_ps(c);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 vr = zero, vg = zero, vb = zero;
+    for (;  k+8<=n;  k+=8) {
+        __m256 w = _mm256_max_ps(zero, _mm256_add_ps(_mm256_mul_ps(vs, _mm256_loadu_ps(a+k)), vc));
+        vr = _mm256_add_ps(vr, _mm256_mul_ps(w, _mm256_loadu_ps(R+k)));
+        vg = _mm256_add_ps(vg, _mm256_mul_ps(w, _mm256_loadu_ps(G+k)));
+        vb = _mm256_add_ps(vb, _mm256_mul_ps(w, _mm256_loadu_ps(B+k))); }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, vr);  for (int i=0;  i<8;  i++) r += lanes[i];
+    _mm256_storeu_ps(lanes, vg);  for (int i=0;  i<8;  i++) g += lanes[i];
+    _mm256_storeu_ps(lanes, vb);  for (int i=0;  i<8;  i++) b += lanes[i];
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 vs = _mm_set1_ps(s);
+    __m128 vc = _mm_set1_ps(c);
+    __m128 zero = _mm_setzero_ps();
+    __m128 vr = zero, vg = zero, vb = zero;
+    for (;  k+4<=n;  k+=4) {
+        __m128 w = _mm_max_ps(zero, _mm_add_ps(_mm_mul_ps(vs, _mm_loadu_ps(a+k)), vc));
+        vr = _mm_add_ps(vr, _mm_mul_ps(w, _mm_loadu_ps(R+k)));
+        vg = _mm_add_ps(vg, _mm_mul_ps(w, _mm_loadu_ps(G+k)));
+        vb = _mm_add_ps(vb, _mm_mul_ps(w, _mm_loadu_ps(B+k))); }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vr);  for (int i=0;  i<4;  i++) r += lanes[i];
+    _mm_storeu_ps(lanes, vg);  for (int i=0;  i<4;  i++) g += lanes[i];
+    _mm_storeu_ps(lanes, vb);  for (int i=0;  i<4;  i++) b += lanes[i];
+#endif
+
+    // Scalar fallback, and the leftover columns of the SIMD paths
+    for (;  k<n;  k++) {
+        float w = s*a[k] + c;
+        if (w < 0.0f) continue;
+        r += w*R[k];
+        g += w*G[k];
+        b += w*B[k]; }
+
+    sum[0] += r;
+    sum[1] += g;
+    sum[2] += b;
+}
+
+// Accumulate input rows [l0,l1) of a level into output pixel (i,j).
+// The column term a[] is the calling thread's scratch space, at least
+// the level's width.
+void IrradianceFilter::IrradianceAt(const Level& lv, float* a, const int i, const int j,
+                                    const int outWidth, const int outHeight, const int l0, const int l1,
+                                    float* rgb) const
+{
+    float angTheta = (pi * (j + 0.5f)) / outHeight;
+    float angPhi = (2 * pi * (i + 0.5f)) / outWidth;
+    float xOut = sin(angTheta) * cos(angPhi);
+    float yOut = sin(angTheta) * sin(angPhi);
+    float zOut = cos(angTheta);
+
+    for (int k=0;  k<lv.width;  k++)
+        a[k] = xOut*lv.colCos[k] + yOut*lv.colSin[k];
+
+    rgb[0] = rgb[1] = rgb[2] = 0.0f;
+    for (int l=l0;  l<l1;  l++)
+        AccumulateRow(a, lv.rowSin[l], zOut*lv.rowCos[l],
+                      &lv.R[l*lv.width], &lv.G[l*lv.width], &lv.B[l*lv.width], lv.width, rgb);
+}
+
+// The work is divided into (output row, input tile) tasks, so even a
+// 100 row output keeps many cores busy.  Each task writes its own
+// slice of the partials array;  the partials are then summed per
+// output pixel in tile order, which makes the result independent of
+// scheduling.
+void IrradianceFilter::Convolve(std::vector<float>& out, const int outWidth, const int outHeight,
+                                const int level) const
+{
+    const Level& lv = levels[level];
+    int tiles = (lv.height + tileRows - 1)/tileRows;
+    int tasks = outHeight*tiles;
+    std::vector<float> partials((size_t)3*outWidth*tasks);
+
+    std::vector<ThreadState> states(ThreadCount());
+    for (size_t t=0;  t<states.size();  t++)
+        states[t].a.resize(lv.width);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int task=0;  task<tasks;  task++) {
+        int j = task/tiles;
+        int tile = task%tiles;
+        int l0 = tile*tileRows;
+        int l1 = std::min(lv.height, l0+tileRows);
+        float* a = &states[ThreadNum()].a[0];
+        float* partial = &partials[(size_t)3*outWidth*task];
+        for (int i=0;  i<outWidth;  i++)
+            IrradianceAt(lv, a, i, j, outWidth, outHeight, l0, l1, &partial[3*i]); }
+
+    out.resize(3*outWidth*outHeight);
+#pragma omp parallel for
+    for (int j=0;  j<outHeight;  j++)
+        for (int i=0;  i<3*outWidth;  i++) {
+            float sum = 0.0f;
+            for (int tile=0;  tile<tiles;  tile++)
+                sum += partials[(size_t)3*outWidth*(j*tiles+tile) + i];
+            out[3*j*outWidth + i] = sum; }
+}
+
+// The original exact convolution: for every output pixel, loop over
+// every input pixel.  Kept as the reference the faster paths are
+// measured against.
+void IrradianceFilter::ConvolveBruteForce(const std::vector<float>& inImage, const int inWidth, const int inHeight,
+                                          std::vector<float>& outImage, const int outWidth, const int outHeight)
+{
+    outImage.assign(3*outWidth*outHeight, 0.0f);
+
+    // Irradiance calculation algorithm:
+    //  Loop through all output pixels (The #pragma parallelizes this loop)
+#pragma omp parallel for schedule(dynamic, 1) // Magic: Multi-thread y loop
+    for (int j=0;  j<outHeight;  j++) {
+        for (int i=0;  i<outWidth;  i++) {
+            // Calculate N from the indices  i and j
+            float angTheta = (pi * (j + (1.0f / 2.0f))) / outHeight;
+            float angPhi = (2 * pi * (i + (1.0f / 2.0f))) / outWidth;
+            float xOut = sin(angTheta) * cos(angPhi);
+            float yOut = sin(angTheta) * sin(angPhi);
+            float zOut = cos(angTheta);
+
+            // For each output pixel, accumulate across *all* input pixels
+            for (int l=0;  l<inHeight;  l++) {
+                for (int k=0;  k<inWidth;  k++) {
+                    // Calculate W from indices k and l
+                    angTheta = (pi * (l + (1.0f / 2.0f))) / inHeight;
+                    angPhi = (2 * pi * (k + (1.0f / 2.0f))) / inWidth;
+                    float xIn = sin(angTheta) * cos(angPhi);
+                    float yIn = sin(angTheta) * sin(angPhi);
+                    float zIn = cos(angTheta);
+
+                    float omegaDot = xOut * xIn + yOut * yIn + zOut * zIn;
+                    if (omegaDot < 0.0f) {
+                        continue;
+                    }
+
+                    // Accumulate input pixel (l,k)'s contribution to the output pixel (i,j)
+                    float w = omegaDot * sin(angTheta) * pi / inHeight * 2 * pi / inWidth;
+                    for (int c=0;  c<3;  c++)
+                        outImage[(3 * j * outWidth) + (3 * i) + c] += inImage[(3 * l * inWidth) + (3 * k) + c] * w;
+                }
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Spherical harmonics irradiance.  The input map is projected onto
+// the real SH basis up to some order (order 2 gives the usual 9
+// coefficients) in a single pass over its pixels.  Irradiance is then
+// evaluated per output pixel by scaling each band by the SH
+// coefficient of the clamped cosine lobe (Ramamoorthi & Hanrahan).
+//
+// Basis functions are indexed as l*(l+1)+m for -l <= m <= l.
+
+// Associated Legendre polynomials P_l^m(x), for 0 <= m <= l <= order,
+// stored at P[l*(l+1)+m].  (Standard recurrences, without the
+// Condon-Shortley phase.)
+static void SHLegendre(const int order, const double x, double* P)
+{
+    double s = sqrt(std::max(0.0, 1.0 - x*x));
+    double pmm = 1.0;
+    for (int m=0;  m<=order;  m++) {
+        P[m*(m+1)+m] = pmm;
+        if (m < order) {
+            double pm1 = x*(2*m+1)*pmm;
+            P[(m+1)*(m+2)+m] = pm1;
+            double pll2 = pmm, pll1 = pm1;
+            for (int l=m+2;  l<=order;  l++) {
+                double pll = ((2*l-1)*x*pll1 - (l+m-1)*pll2) / (l-m);
+                P[l*(l+1)+m] = pll;
+                pll2 = pll1;
+                pll1 = pll; } }
+        pmm *= (2*m+1)*s; }
+}
+
+// Normalization constant K_l^m (times sqrt(2) for m != 0) of the real SH basis.
+static double SHNormalization(const int l, const int m)
+{
+    double r = 1.0;             // (l-m)!/(l+m)!
+    for (int i=l-m+1;  i<=l+m;  i++)
+        r /= i;
+    double K = sqrt((2*l+1)/(4.0*M_PI)*r);
+    return m==0 ? K : sqrt(2.0)*K;
+}
+
+// Fills Y[(order+1)^2] with the real SH basis evaluated at direction
+// (theta, phi).
+static void SHBasis(const int order, const double theta, const double phi, double* Y)
+{
+    std::vector<double> P((order+1)*(order+1));
+    SHLegendre(order, cos(theta), &P[0]);
+    for (int l=0;  l<=order;  l++) {
+        Y[l*(l+1)] = SHNormalization(l, 0)*P[l*(l+1)];
+        for (int m=1;  m<=l;  m++) {
+            double K = SHNormalization(l, m)*P[l*(l+1)+m];
+            Y[l*(l+1)+m] = K*cos(m*phi);
+            Y[l*(l+1)-m] = K*sin(m*phi); } }
+}
+
+// SH coefficient of the clamped cosine lobe max(cos(theta),0) for band l.
+static double SHCosineLobe(const int l)
+{
+    if (l == 0) return M_PI;
+    if (l == 1) return 2.0*M_PI/3.0;
+    if (l%2 == 1) return 0.0;
+
+    // l!/(2^l ((l/2)!)^2)
+    double c = 1.0;
+    for (int i=1;  i<=l/2;  i++)
+        c *= double(l/2+i)/(4.0*i);
+    double sign = (l/2)%2 == 1 ? 1.0 : -1.0;
+    return 2.0*M_PI*sign/((l+2)*(l-1))*c;
+}
+
+// The Legendre terms depend only on the row and the trig terms only
+// on the column, so both are tabulated once.  (The solid angle is
+// already folded into the planar radiance.)  Rows are summed in
+// parallel into separate partial sums, then added in row order.
+std::vector<double> IrradianceFilter::ProjectSH(const int order, const int level) const
+{
+    const Level& lv = levels[level];
+    const int width = lv.width, height = lv.height;
+    const int n = (order+1)*(order+1);
+
+    // Column table: cos(m*phi) at [k*(order+1)+m], sin(m*phi) likewise.
+    std::vector<double> colCosM(width*(order+1)), colSinM(width*(order+1));
+    for (int k=0;  k<width;  k++) {
+        double phi = 2.0*M_PI*(k+0.5)/width;
+        for (int m=0;  m<=order;  m++) {
+            colCosM[k*(order+1)+m] = cos(m*phi);
+            colSinM[k*(order+1)+m] = sin(m*phi); } }
+
+    std::vector<double> rowSums(3*n*height, 0.0);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int l=0;  l<height;  l++) {
+        // Row table: normalized Legendre terms
+        std::vector<double> P(n), rowK(n);
+        SHLegendre(order, lv.rowCos[l], &P[0]);
+        for (int ll=0;  ll<=order;  ll++)
+            for (int m=0;  m<=ll;  m++)
+                rowK[ll*(ll+1)+m] = SHNormalization(ll, m)*P[ll*(ll+1)+m];
+
+        double* sum = &rowSums[3*n*l];
+        for (int k=0;  k<width;  k++) {
+            const float rgb[3] = {lv.R[l*width+k], lv.G[l*width+k], lv.B[l*width+k]};
+            const double* cs = &colCosM[k*(order+1)];
+            const double* sn = &colSinM[k*(order+1)];
+            for (int ll=0;  ll<=order;  ll++) {
+                double y = rowK[ll*(ll+1)];
+                for (int c=0;  c<3;  c++)
+                    sum[3*(ll*(ll+1))+c] += rgb[c]*y;
+                for (int m=1;  m<=ll;  m++) {
+                    double yc = rowK[ll*(ll+1)+m]*cs[m];
+                    double ys = rowK[ll*(ll+1)+m]*sn[m];
+                    for (int c=0;  c<3;  c++) {
+                        sum[3*(ll*(ll+1)+m)+c] += rgb[c]*yc;
+                        sum[3*(ll*(ll+1)-m)+c] += rgb[c]*ys; } } } } }
+
+    std::vector<double> coeffs(3*n, 0.0);
+    for (int l=0;  l<height;  l++)
+        for (int i=0;  i<3*n;  i++)
+            coeffs[i] += rowSums[3*n*l+i];
+    return coeffs;
+}
+
+// Evaluate the cosine-convolved SH expansion (i.e. irradiance) at
+// the center of each pixel of an equirectangular output image.
+void IrradianceFilter::EvaluateSH(const std::vector<double>& coeffs, const int order,
+                                  std::vector<float>& image, const int outWidth, const int outHeight)
+{
+    const int n = (order+1)*(order+1);
+
+    // Fold the cosine lobe into the coefficients once.
+    std::vector<double> E(3*n);
+    for (int l=0;  l<=order;  l++) {
+        double A = SHCosineLobe(l);
+        for (int m=-l;  m<=l;  m++)
+            for (int c=0;  c<3;  c++)
+                E[3*(l*(l+1)+m)+c] = A*coeffs[3*(l*(l+1)+m)+c]; }
+
+    image.resize(3*outWidth*outHeight);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int j=0;  j<outHeight;  j++) {
+        std::vector<double> Y(n);
+        for (int i=0;  i<outWidth;  i++) {
+            SHBasis(order, M_PI*(j+0.5)/outHeight, 2.0*M_PI*(i+0.5)/outWidth, &Y[0]);
+            double rgb[3] = {0.0, 0.0, 0.0};
+            for (int b=0;  b<n;  b++)
+                for (int c=0;  c<3;  c++)
+                    rgb[c] += E[3*b+c]*Y[b];
+            for (int c=0;  c<3;  c++)
+                image[3*(j*outWidth+i)+c] = (float)std::max(0.0, rgb[c]); } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Prefiltered specular environment maps (Karis, "Real Shading in
+// Unreal Engine 4", with the filtered importance sampling of Colbert
+// and Krivanek to avoid aliasing at low sample counts).
+
+// Hammersley point i of n, in [0,1)^2
+static void Hammersley(const unsigned int i, const unsigned int n, float* xi)
+{
+    unsigned int bits = i;
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    xi[0] = float(i)/float(n);
+    xi[1] = float(bits) * 2.3283064365386963e-10f;
+}
+
+void IrradianceFilter::PrefilterSpecular(const float alpha, const int samples,
+                                         std::vector<float>& out, const int outWidth, const int outHeight) const
+{
+    out.resize(3*outWidth*outHeight);
+    float a2 = alpha*alpha;
+
+    // Average solid angle of a level 0 texel
+    float texelOmega = 4*pi / (width*height);
+
+    // Pyramid level matching the solid angle of the output texels,
+    // used for the mirror case where all samples coincide.
+    float outOmega = 4*pi / (outWidth*outHeight);
+    float mirrorLod = std::max(0.0f, 0.5f*log2(outOmega/texelOmega));
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int j=0;  j<outHeight;  j++)
+        for (int i=0;  i<outWidth;  i++) {
+            float angTheta = (pi * (j + 0.5f)) / outHeight;
+            float angPhi = (2 * pi * (i + 0.5f)) / outWidth;
+            float N[3] = {sin(angTheta)*cos(angPhi), sin(angTheta)*sin(angPhi), cos(angTheta)};
+            float* rgb = &out[3*(j*outWidth+i)];
+
+            if (alpha <= 0.0f) {
+                const Level& lv = levels[std::min(LevelCount()-1, (int)(mirrorLod+0.5f))];
+                lv.Radiance(N[0], N[1], N[2], rgb);
+                continue; }
+
+            // Tangent frame around N
+            float up[3] = {0.0f, 0.0f, 1.0f};
+            if (fabs(N[2]) > 0.999f) { up[0] = 1.0f;  up[2] = 0.0f; }
+            float T[3] = {up[1]*N[2]-up[2]*N[1], up[2]*N[0]-up[0]*N[2], up[0]*N[1]-up[1]*N[0]};
+            float t = 1.0f/sqrt(T[0]*T[0]+T[1]*T[1]+T[2]*T[2]);
+            T[0] *= t;  T[1] *= t;  T[2] *= t;
+            float Bt[3] = {N[1]*T[2]-N[2]*T[1], N[2]*T[0]-N[0]*T[2], N[0]*T[1]-N[1]*T[0]};
+
+            double sum[3] = {0.0, 0.0, 0.0};
+            double weight = 0.0;
+            for (int s=0;  s<samples;  s++) {
+                // Sample the half vector H from the GGX distribution
+                float xi[2];
+                Hammersley(s, samples, xi);
+                float phi = 2*pi*xi[0];
+                float cosH = sqrt((1.0f - xi[1]) / (1.0f + (a2 - 1.0f)*xi[1]));
+                float sinH = sqrt(1.0f - cosH*cosH);
+                float h[3];
+                for (int c=0;  c<3;  c++)
+                    h[c] = sinH*cos(phi)*T[c] + sinH*sin(phi)*Bt[c] + cosH*N[c];
+
+                // Reflect V=N about H
+                float L[3];
+                for (int c=0;  c<3;  c++)
+                    L[c] = 2*cosH*h[c] - N[c];
+                float NL = N[0]*L[0] + N[1]*L[1] + N[2]*L[2];
+                if (NL <= 0.0f) continue;
+
+                // pdf(L) = D(H)*NH/(4*VH) = D(H)/4 since N=V.  A sample
+                // covers about 1/(samples*pdf) steradians; read the
+                // pyramid level with texels of that size.
+                float d = cosH*cosH*(a2 - 1.0f) + 1.0f;
+                float D = a2 / (pi*d*d);
+                float sampleOmega = 4.0f / (samples*D);
+                float lod = std::max(0.0f, 0.5f*log2(sampleOmega/texelOmega) + 1.0f);
+                const Level& lv = levels[std::min(LevelCount()-1, (int)(lod+0.5f))];
+
+                float L_rgb[3];
+                lv.Radiance(L[0], L[1], L[2], L_rgb);
+                for (int c=0;  c<3;  c++)
+                    sum[c] += L_rgb[c]*NL;
+                weight += NL; }
+
+            for (int c=0;  c<3;  c++)
+                rgb[c] = weight > 0.0 ? (float)(sum[c]/weight) : 0.0f; }
+}
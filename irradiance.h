@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////
+// Irradiance filtering of equirectangular HDR environment maps.
+//
+// An IrradianceFilter is built once from an input image (RGB floats,
+// row major, theta down the rows and phi across the columns), and can
+// then produce irradiance maps of any size, either exactly (a full
+// cosine-weighted convolution over every input pixel) or through a
+// spherical harmonics approximation.
+//
+// All multi-threaded work is split into independent tasks which
+// write only their own partial results; partials are then summed in
+// a fixed order, so the output is identical for any thread count.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _IRRADIANCE_
+#define _IRRADIANCE_
+
+#include <vector>
+
+class HdrReader;
+
+class IrradianceFilter
+{
+public:
+    int width, height;          // Input size
+
+    // Input rows per tile of the exact convolution's work decomposition.
+    int tileRows;
+
+    IrradianceFilter(const std::vector<float>& image, const int width, const int height);
+
+    // Decode an opened .hdr file directly into the filter's tables,
+    // in parallel.
+    IrradianceFilter(const HdrReader& hdr);
+
+    // Build an area-weighted mip pyramid of the input, halving each
+    // level down to about minHeight rows.  Level 0 is the input.
+    void BuildPyramid(const int minHeight=8);
+    int LevelCount() const { return (int)levels.size(); }
+    int LevelWidth(const int level) const { return levels[level].width; }
+    int LevelHeight(const int level) const { return levels[level].height; }
+
+    // Choose the coarsest pyramid level whose irradiance differs from
+    // the full resolution result by less than tolerance (relative RMS),
+    // estimated on a sparse set of output pixels.  The estimated
+    // errors at the chosen level are returned in maxError and rmsError.
+    int ChooseLevel(const int outWidth, const int outHeight, const float tolerance,
+                    float& maxError, float& rmsError) const;
+    void EstimateError(const int level, const int outWidth, const int outHeight,
+                       float& maxError, float& rmsError) const;
+
+    // Exact convolution of one pyramid level using the precomputed
+    // tables and SIMD kernel.
+    void Convolve(std::vector<float>& out, const int outWidth, const int outHeight,
+                  const int level=0) const;
+
+    // The original per-pixel loop over an interleaved RGB image, kept as a reference.
+    static void ConvolveBruteForce(const std::vector<float>& image, const int width, const int height,
+                                   std::vector<float>& out, const int outWidth, const int outHeight);
+
+    // Project onto SH up to order (3*(order+1)^2 coefficients, RGB
+    // interleaved), and evaluate the cosine-convolved result.
+    std::vector<double> ProjectSH(const int order, const int level=0) const;
+    static void EvaluateSH(const std::vector<double>& coeffs, const int order,
+                           std::vector<float>& out, const int outWidth, const int outHeight);
+
+    // Prefilter the input with the GGX distribution of roughness
+    // alpha (alpha=0 is a mirror), assuming N=V=R as in the usual
+    // split-sum approximation.  Importance sampled with the given
+    // sample count; each sample reads the pyramid level matching its
+    // solid angle, so build the pyramid first for alias-free results.
+    void PrefilterSpecular(const float alpha, const int samples,
+                           std::vector<float>& out, const int outWidth, const int outHeight) const;
+
+private:
+    // One resolution of the input: per-row and per-column tables, and
+    // planar radiance pre-weighted by solid angle.
+    struct Level
+    {
+        int width, height;
+        std::vector<float> rowSin, rowCos;
+        std::vector<float> colCos, colSin;
+        std::vector<float> R, G, B;
+        std::vector<float> rowInvOmega;     // 1/solid angle of a texel in each row
+
+        void BuildTables();
+        void Radiance(const float x, const float y, const float z, float* rgb) const;
+    };
+    std::vector<Level> levels;
+
+    // Scratch space owned by a single thread
+    struct ThreadState
+    {
+        std::vector<float> a;   // Per-column term of N.W for the current output pixel
+    };
+
+    void AllocateInput();
+    void SetRows(const int l0, const int l1, const float* rgb);
+    void SampleLevel(const int level, const int outWidth, const int outHeight,
+                     std::vector<float>& samples) const;
+    void IrradianceAt(const Level& lv, float* a, const int i, const int j,
+                      const int outWidth, const int outHeight, const int l0, const int l1,
+                      float* rgb) const;
+};
+
+#endif
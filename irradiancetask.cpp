@@ -0,0 +1,78 @@
+////////////////////////////////////////////////////////////////////////
+// Background computation of a sky's irradiance map.  See
+// irradiancetask.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <algorithm>
+#include <thread>
+
+#include "hdr.h"
+#include "irradiance.h"
+#include "irradiancetask.h"
+#include "trace.h"
+
+#include "stb_image.h"
+
+void IrradianceTask::Start(const std::string& skyPath, const std::string& outPath)
+{
+    state = std::make_shared<State>();
+    state->status = Running;
+    std::thread worker(Run, state, skyPath, outPath, width, height);
+    worker.detach();
+}
+
+bool IrradianceTask::Ready()
+{
+    int done = Done;
+    return state && state->status.compare_exchange_strong(done, (int)Taken);
+}
+
+void IrradianceTask::Run(std::shared_ptr<State> state, const std::string skyPath,
+                         const std::string outPath, const int width, const int height)
+{
+    Trace::NameThread("irradiance");
+    TRACE_SCOPE("IrradianceTask::Run");
+    printf("Computing irradiance of %s in the background\n", skyPath.c_str());
+
+    // An .hdr sky streams straight into the filter.  Anything else
+    // goes through stb_image, which linearizes 8 bit images with gamma
+    // 2.2.  Its flip setting is global, and the textures always turn
+    // it on, so the rows are flipped back here rather than racing the
+    // main thread to turn it off.
+    IrradianceFilter* filter = NULL;
+    HdrReader hdr;
+    if (skyPath.size() > 4 && skyPath.compare(skyPath.size()-4, 4, ".hdr") == 0) {
+        if (hdr.Open(skyPath))
+            filter = new IrradianceFilter(hdr); }
+    else {
+        int w, h, d;
+        float* pixels = stbi_loadf(skyPath.c_str(), &w, &h, &d, 3);
+        if (pixels) {
+            std::vector<float> image(pixels, pixels + 3*w*h);
+            stbi_image_free(pixels);
+            for (int y=0;  y<h/2;  y++)
+                std::swap_ranges(image.begin() + 3*w*y, image.begin() + 3*w*(y+1),
+                                 image.begin() + 3*w*(h-1-y));
+            filter = new IrradianceFilter(image, w, h); } }
+    if (!filter) {
+        printf("Can't compute irradiance of %s\n", skyPath.c_str());
+        state->status = Failed;
+        return; }
+
+    std::vector<double> coeffs = filter->ProjectSH(2);
+    delete filter;
+    IrradianceFilter::EvaluateSH(coeffs, 2, state->image, width, height);
+
+    // Save it for next time, through a temporary file so an
+    // interrupted write never leaves a partial map behind.
+    if (!outPath.empty()) {
+        std::string tmpPath = outPath + ".tmp";
+        if (HdrWrite(tmpPath, &state->image[0], width, height)
+            && rename(tmpPath.c_str(), outPath.c_str()) == 0)
+            printf("Wrote %s\n", outPath.c_str());
+        else
+            remove(tmpPath.c_str()); }
+
+    state->status = Done;
+}
@@ -0,0 +1,60 @@
+////////////////////////////////////////////////////////////////////////
+// Computes a sky's irradiance map in the background, for use when the
+// offline filter's <sky>-irradiance.hdr does not exist yet.
+//
+// Start() launches a worker thread which reads the sky, projects it
+// onto order 2 spherical harmonics, evaluates the irradiance map
+// (the same as "filter-aseem -sh"), and saves it so the next run
+// loads it directly.  The render loop polls Ready() each frame and
+// swaps the result in, so startup never waits for it.
+//
+// The worker shares its state with the task through a reference
+// counted pointer, so it may safely outlive the task (e.g. when the
+// app quits before the worker is done).
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _IRRADIANCETASK_
+#define _IRRADIANCETASK_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+class IrradianceTask
+{
+public:
+    int width, height;          // Size of the computed map
+
+    IrradianceTask() : width(200), height(100) {}
+
+    // Start computing the irradiance of the sky image in skyPath
+    // (.hdr, or any format stb_image reads); the result is also
+    // written to outPath unless it is empty.
+    void Start(const std::string& skyPath, const std::string& outPath);
+
+    // True once, when the worker has finished successfully, after
+    // which Image() holds the map as RGB floats, top row first.
+    bool Ready();
+    const std::vector<float>& Image() const { return state->image; }
+
+    // True while the worker is still computing.
+    bool Pending() const { return state && state->status == Running; }
+
+    // Release the result once it has been used.
+    void Clear() { state.reset(); }
+
+private:
+    enum Status { Running, Done, Failed, Taken };
+    struct State
+    {
+        std::atomic<int> status;
+        std::vector<float> image;
+    };
+    std::shared_ptr<State> state;
+
+    static void Run(std::shared_ptr<State> state, const std::string skyPath,
+                    const std::string outPath, const int width, const int height);
+};
+
+#endif
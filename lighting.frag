@@ -23,20 +23,18 @@ in vec3 eyeVec;
 in vec3 lightVec;
 in vec2 texCoord;
 in vec4 shadowCoord;
+flat in int instanceId;
+
+// The uniform blocks of ubo.h are declared ahead of this source by
+// ShaderProgram::AddShader.
 
-uniform int objectId;
-uniform vec3 diffuse;
-uniform vec3 specular;
-uniform float shininess;
-uniform vec3 lightVal;
-uniform vec3 lightAmb;
-uniform int mode;
-uniform int shadows;
 uniform sampler2D shadowMap;
 uniform sampler2D textureMap;
 uniform sampler2D normalMap;
 uniform sampler2D irrMap;
 uniform sampler2D skyMap;
+uniform sampler2D specMap;      // GGX prefiltered sky, roughness alpha = lod/(specLevels-1);
+                                // specLevels is 0 when there is no prefiltered chain
 
 vec4 FragColor;
 
@@ -51,10 +49,11 @@ vec3 LightingPixel() {
     vec3 cG = texture(irrMap, uv).xyz;
     vec3 cL = vec3(pow(cG.x, 2.2f), pow(cG.y, 2.2f), pow(cG.z, 2.2f));
     
-    // Values describing surface
-    vec3 Kd = diffuse;
-    vec3 Ks = specular;
-    float alpha = shininess;
+    // Values describing surface, and which object this is
+    vec3 Kd = instances[instanceId].diffuse;
+    vec3 Ks = instances[instanceId].specular;
+    float alpha = instances[instanceId].shininess;
+    int objectId = instances[instanceId].objectId;
 
     // Textures
     if (objectId == roomId ||
@@ -109,7 +108,16 @@ vec3 LightingPixel() {
 
     vec3 R = -(2 * max(dot(V, N), 0.0001f) * N - V);
     uv = vec2(-atan(R.y, R.x) / (2 * 3.141592f), acos(R.z) / 3.141592f);
-    Ii = texture(skyMap, uv).xyz;
+
+    // GGX reads the prefiltered chain at the level of its roughness,
+    // alpha = sqrt(2/(shininess+2)), instead of the full sky.
+    if (mode == 1 && specLevels > 1) {
+        float alphaG = sqrt(2.0f / (alpha + 2.0f));
+        Ii = textureLod(specMap, uv, alphaG * (specLevels - 1)).xyz;
+    }
+    else {
+        Ii = texture(skyMap, uv).xyz;
+    }
 
     // diffuse color from irradiance map
     Ia = cL * (Kd / 3.141592f);
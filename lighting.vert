@@ -5,7 +5,8 @@
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
-uniform mat4 WorldView, WorldInverse, WorldProj, ModelTr, NormalTr, ShadowMatrix, TextureTr;
+// The uniform blocks of ubo.h are declared ahead of this source by
+// ShaderProgram::AddShader.
 
 in vec4 vertex;
 in vec3 vertexNormal;
@@ -18,16 +19,19 @@ out vec3 eyeVec;
 out vec3 lightVec;
 out vec2 texCoord;
 out vec4 shadowCoord;
-uniform vec3 lightPos;
-uniform vec3 lightVal;
-uniform vec3 lightAmb;
+flat out int instanceId;
 
 void LightingVertex(vec3 eyePos) {
+    // This instance's transformations, and its index for the pixel shader
+    mat4 ModelTr = INSTANCE_MODEL_TR(gl_InstanceID);
+    mat3 NormalTr = mat3(instances[gl_InstanceID].NormalTr);
+    instanceId = gl_InstanceID;
+
     // Compute the world pos at a pixel used for light and eye vector calculations
     vec3 worldPos = (ModelTr*vertex).xyz;
     
     // Compute normal vector and output to fragment shader
-    normalVec = vertexNormal*mat3(NormalTr);
+    normalVec = vertexNormal*NormalTr;
 
     // Compute tangent vector
     tanVec = mat3(ModelTr) * vertexTangent;
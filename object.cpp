@@ -6,8 +6,9 @@
 // in a hierarchical fashion under the control of parent's
 // transformations.
 //
-// Methods consist of a constructor, and a Draw procedure, and an
-// append for building hierarchies of objects.
+// Methods consist of a constructor, and an append for building
+// hierarchies of objects.  The hierarchy is drawn through the
+// RenderList of renderlist.h, which flattens it.
 
 #include "math.h"
 #include <fstream>
@@ -37,78 +38,3 @@ Object::Object(Shape* _shape, const int _objectId,
       texture(_texture), normalTex(_normalTex), textureTransform(_textureTransform), reflective(_reflective)
      
 {}
-
-
-void Object::Draw(ShaderProgram* program, glm::mat4& objectTr)
-{
-    // @@ The object specific parameters (uniform variables) used by
-    // the shader are set here.  Scene specific parameters are set in
-    // the DrawScene procedure in scene.cpp
-
-    // @@ Textures, being uniform sampler2d variables in the shader,
-    // are also set here.  Call texture->Bind in texture.cpp to do so.
-    
-    // Inform the shader of the surface values Kd, Ks, and alpha.
-    int loc = glGetUniformLocation(program->programId, "diffuse");
-    glUniform3fv(loc, 1, &diffuseColor[0]);
-
-    loc = glGetUniformLocation(program->programId, "specular");
-    glUniform3fv(loc, 1, &specularColor[0]);
-
-    loc = glGetUniformLocation(program->programId, "shininess");
-    glUniform1f(loc, shininess);
-
-    // Inform the shader of which object is being drawn so it can make
-    // object specific decisions.
-    loc = glGetUniformLocation(program->programId, "objectId");
-    glUniform1i(loc, objectId);
-
-    // Inform the shader of this object's model transformation.  The
-    // inverse of the model transformation, needed for transforming
-    // normals, is calculated and passed to the shader here.
-    loc = glGetUniformLocation(program->programId, "ModelTr");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(objectTr));
-    
-    glm::mat4 inv = glm::inverse(objectTr);
-    loc = glGetUniformLocation(program->programId, "NormalTr");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(inv));
-
-    loc = glGetUniformLocation(program->programId, "TextureTr");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(textureTransform));
-
-    loc = glGetUniformLocation(program->programId, "Reflective");
-    glUniform1i(loc, reflective);
-
-    // If this object has an associated texture, this is the place to
-    // load the texture into a texture-unit of your choice and inform
-    // the shader program of the texture-unit number.  See
-    // Texture::Bind for the 4 lines of code to do exactly that.
-    if (texture) {
-        texture->Bind(5, program->programId, "textureMap");
-    }
-    if (normalTex) {
-        normalTex->Bind(6, program->programId, "normalMap");
-    }
-
-    // Draw this object
-    CHECKERROR;
-    if (shape)
-        if (drawMe) 
-            shape->DrawVAO();
-    CHECKERROR;
-
-    if (texture) {
-        texture->Unbind();
-    }
-    if (normalTex) {
-        normalTex->Unbind();
-    }
-
-    // Recursivelyy draw each sub-objects, each with its own transformation.
-    if (drawMe)
-        for (int i=0;  i<instances.size();  i++) {
-            glm::mat4 itr = objectTr*instances[i].second*animTr;
-            instances[i].first->Draw(program, itr); }
-    
-    CHECKERROR;
-}
@@ -6,8 +6,9 @@
 // in a hierarchical fashion under the control of parent's
 // transformations.
 //
-// Methods consist of a constructor, and a Draw procedure, and an
-// append for building hierarchies of objects.
+// Methods consist of a constructor, and an append for building
+// hierarchies of objects.  The hierarchy is drawn through the
+// RenderList of renderlist.h, which flattens it.
 
 #ifndef _OBJECT
 #define _OBJECT
@@ -46,12 +47,10 @@ class Object
     // If this object is to be drawn with a texture, this is a good
     // place to store the texture id (a small positive integer).  The
     // texture id should be set in Scene::InitializeScene and used in
-    // Object::Draw.
+    // RenderList::Draw.
     Texture* texture;
     Texture* normalTex;
     
-    void Draw(ShaderProgram* program, glm::mat4& objectTr);
-
     void add(Object* m, glm::mat4 tr=glm::mat4()) { instances.push_back(std::make_pair(m,tr)); }
 };
 
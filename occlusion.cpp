@@ -0,0 +1,179 @@
+////////////////////////////////////////////////////////////////////////
+// Software occlusion culling.  See occlusion.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <vector>
+#include <algorithm>
+
+#include "framework.h"
+#include "occlusion.h"
+#include "trace.h"
+
+const int SCALE = 4;            // Window pixels per depth buffer pixel, each way
+
+OcclusionCuller::OcclusionCuller()
+    : enabled(true), tested(0), culled(0), occluderTriangles(0), rasterTime(0.0), width(0), height(0),
+      queued(false), started(false), quit(false), ready(false)
+{}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    Wait();
+    if (!worker.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void OcclusionCuller::AddOccluder(const Object* object)
+{
+    AddOccluder(object, object->shape->Pnt, object->shape->Tri);
+}
+
+void OcclusionCuller::AddOccluder(const Object* object, const std::vector<glm::vec4>& Pnt,
+                                  const std::vector<glm::ivec3>& Tri)
+{
+    Occluder o;
+    o.object = object;
+    o.Pnt = Pnt;
+    o.Tri = Tri;
+    occluders.push_back(o);
+}
+
+void OcclusionCuller::Start(const RenderList& list, const glm::mat4& _viewProj, const int width, const int height)
+{
+    Wait();
+    ready = false;
+    tested = culled = 0;
+    if (!enabled)
+        return;
+
+    // The list is read here, on the main thread, so the worker
+    // touches nothing the rest of the frame changes.
+    viewProj = _viewProj;
+    draws.clear();
+    list.Drawn(drawn);
+    for (size_t d=0;  d<drawn.size();  d++)
+        for (int o=0;  o<(int)occluders.size();  o++)
+            if (occluders[o].object == list.objects[drawn[d]])
+                draws.push_back(std::make_pair(o, list.modelTrs[drawn[d]]));
+    raster.Begin(std::max(1, width), std::max(1, height));
+
+    if (!worker.joinable())
+        worker = std::thread(&OcclusionCuller::Loop, this);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued = true;
+    }
+    started = true;
+    wake.notify_one();
+}
+
+void OcclusionCuller::Wait()
+{
+    if (!started)
+        return;
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return !queued; });
+    started = false;
+    ready = true;
+}
+
+// The worker: one frame's Run each time Start queues one.
+void OcclusionCuller::Loop()
+{
+    Trace::NameThread("occlusion");
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait(guard, [this] { return queued || quit; });
+        if (quit)
+            return;
+        guard.unlock();
+        Run();
+        guard.lock();
+        queued = false;
+        done.notify_all(); }
+}
+
+void OcclusionCuller::Run()
+{
+    TRACE_SCOPE("OcclusionCuller::Run");
+    const double start = Trace::Now();
+    clip.resize(draws.size());
+    occluderTriangles = 0;
+    for (size_t d=0;  d<draws.size();  d++) {
+        const Occluder& o = occluders[draws[d].first];
+        const glm::mat4 mvp = viewProj*draws[d].second;
+        clip[d].resize(o.Pnt.size());
+        for (size_t i=0;  i<o.Pnt.size();  i++)
+            clip[d][i] = mvp*o.Pnt[i];
+        // Both faces occlude: the room is seen from inside and out
+        raster.Draw(&clip[d][0], sizeof(glm::vec4), &o.Tri[0], (int)o.Tri.size(), Rasterizer::CULL_NONE);
+        occluderTriangles += (int)o.Tri.size(); }
+    raster.Flush();
+    Reduce();
+    rasterTime = Trace::Now() - start;
+}
+
+// Each reduced pixel takes the farthest depth over its SCALE by SCALE
+// window pixels (fewer at the right and top edges).  Uncovered window
+// pixels are still cleared to 1, so a partly covered block is too.
+void OcclusionCuller::Reduce()
+{
+    TRACE_SCOPE("OcclusionCuller::Reduce");
+    width = (raster.width + SCALE - 1)/SCALE;
+    height = (raster.height + SCALE - 1)/SCALE;
+    depth.assign(width*height, 0.0f);
+#pragma omp parallel for schedule(static)
+    for (int y=0;  y<height;  y++) {
+        float* out = &depth[y*width];
+        for (int fy=y*SCALE;  fy<std::min(raster.height, (y + 1)*SCALE);  fy++) {
+            const float* row = &raster.depth[fy*raster.width];
+            for (int fx=0;  fx<raster.width;  fx++)
+                out[fx/SCALE] = std::max(out[fx/SCALE], row[fx]); } }
+}
+
+bool OcclusionCuller::Visible(const Object* object, const glm::mat4& modelTr)
+{
+    if (!ready || !object->shape)
+        return true;
+    for (size_t o=0;  o<occluders.size();  o++)
+        if (occluders[o].object == object)
+            return true;
+    tested++;
+
+    // The box's screen rectangle, in window pixels, and its nearest depth
+    const glm::mat4 mvp = viewProj*modelTr;
+    const glm::vec3& lo = object->shape->minP;
+    const glm::vec3& hi = object->shape->maxP;
+    float x0 = 1e30f, y0 = 1e30f, x1 = -1e30f, y1 = -1e30f, zNear = 1e30f;
+    for (int c=0;  c<8;  c++) {
+        const glm::vec4 p = mvp*glm::vec4(c&1 ? hi.x : lo.x, c&2 ? hi.y : lo.y, c&4 ? hi.z : lo.z, 1.0f);
+        if (p.z < -p.w)
+            return true;        // In front of the near plane (or behind the eye)
+        const float x = (p.x/p.w*0.5f + 0.5f)*raster.width;
+        const float y = (p.y/p.w*0.5f + 0.5f)*raster.height;
+        x0 = std::min(x0, x);
+        x1 = std::max(x1, x);
+        y0 = std::min(y0, y);
+        y1 = std::max(y1, y);
+        zNear = std::min(zNear, p.z/p.w*0.5f + 0.5f); }
+    const int px0 = std::max(0, (int)floorf(x0) - 1), px1 = std::min(raster.width-1, (int)floorf(x1) + 1);
+    const int py0 = std::max(0, (int)floorf(y0) - 1), py1 = std::min(raster.height-1, (int)floorf(y1) + 1);
+    if (px0 > px1 || py0 > py1)
+        return true;            // Off screen: for the frustum, not occlusion, to decide
+
+    // The reduced pixels containing it
+    for (int y=py0/SCALE;  y<=py1/SCALE;  y++) {
+        const float* row = &depth[y*width];
+        for (int x=px0/SCALE;  x<=px1/SCALE;  x++)
+            if (row[x] >= zNear)
+                return true; }
+    culled++;
+    return false;
+}
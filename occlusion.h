@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////
+// Software occlusion culling for the lighting pass.
+//
+// A few large objects that hide much of the rest (the room, the
+// podium, the terrain) are registered as occluders, each with a mesh
+// to rasterize: its own shape, or a cheaper stand-in that lies
+// entirely behind the real surface, such as
+// ProceduralGround::OccluderMesh.
+//
+// Each frame, Start() finds the occluders' transformations among the
+// entries the RenderList draws, and a worker thread (started once, and woken each
+// frame) then transforms and
+// rasterizes them (with the Rasterizer of raster.h, at the window's
+// size) while the main thread draws the shadow and reflection
+// passes.  The depth is then reduced to a buffer a quarter of the
+// window's size each way, each pixel keeping the farthest depth of
+// the window pixels it covers (1 where any is uncovered), so it never
+// hides anything the full size buffer shows, at silhouettes or
+// elsewhere.  Wait() waits for it before the lighting pass, where
+// RenderList::Draw asks Visible() of each entry: the Shape's bounding
+// box is projected to the screen, and the instance is culled if the
+// occluders' depth is nearer than the box's nearest point everywhere
+// in its screen rectangle (grown by a window pixel, for rounding).
+// Boxes reaching the near plane are never culled.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _OCCLUSION_
+#define _OCCLUSION_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "raster.h"
+
+class Object;
+class RenderList;
+
+class OcclusionCuller
+{
+public:
+    bool enabled;
+
+    // Statistics of the last frame
+    int tested, culled;         // Instances
+    int occluderTriangles;      // Rasterized, before clipping
+    double rasterTime;          // Seconds the worker took
+
+    OcclusionCuller();
+    ~OcclusionCuller();
+
+    // Register an occluder (an object with a Shape), drawn as its
+    // shape, or as the given mesh (in the object's coordinates).
+    void AddOccluder(const Object* object);
+    void AddOccluder(const Object* object, const std::vector<glm::vec4>& Pnt, const std::vector<glm::ivec3>& Tri);
+
+    // Start rasterizing the occluders the list draws, as of its last
+    // Update, seen through viewProj, for a window of the given size.
+    // Does nothing if not enabled.
+    void Start(const RenderList& list, const glm::mat4& viewProj, const int width, const int height);
+
+    // Wait for the worker; Visible culls nothing until this is called.
+    void Wait();
+
+    // False if an instance of object, with the given transformation,
+    // is certainly hidden by the occluders.
+    bool Visible(const Object* object, const glm::mat4& modelTr);
+
+private:
+    struct Occluder
+    {
+        const Object* object;
+        std::vector<glm::vec4> Pnt;
+        std::vector<glm::ivec3> Tri;
+    };
+    std::vector<Occluder> occluders;
+
+    // This frame's instances of the occluders, and their vertices in clip space
+    std::vector<std::pair<int, glm::mat4> > draws;
+    std::vector<int> drawn;     // Start's scratch space: the list's drawn entries
+    std::vector<std::vector<glm::vec4> > clip;
+
+    Rasterizer raster;
+    int width, height;          // Of the reduced depth buffer
+    std::vector<float> depth;   // Farthest depth of each block of window pixels, bottom row first
+    glm::mat4 viewProj;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    bool queued;                // A frame is the worker's to rasterize
+    bool started;               // Since the last Wait
+    bool quit;
+    bool ready;
+
+    void Loop();
+    void Run();
+    void Reduce();
+};
+
+#endif
@@ -0,0 +1,432 @@
+////////////////////////////////////////////////////////////////////////
+// An offline path tracer for the scene.  See pathtracer.h for an
+// overview.
+//
+// Paths are traced with next event estimation: at each surface the
+// point light and one importance sampled sky direction are tested for
+// visibility, then the BRDF is sampled to continue the path.  Sky
+// samples and BRDF samples that reach the sky are combined with
+// multiple importance sampling (the power heuristic).  Russian
+// roulette ends long paths.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <vector>
+#include <algorithm>
+#include <float.h>
+#include <stdio.h>
+
+#include "framework.h"
+#include "hdr.h"
+#include "bvh.h"
+#include "pathtracer.h"
+#include "trace.h"
+
+#ifdef EM
+
+const int TILE = 16;            // Tile size in pixels, the unit of work of a thread
+const float EPSILON = 1e-3f;    // Offset of secondary rays from the surface, in meters
+const float PI = 3.14159265f;
+
+static unsigned int Hash(unsigned int x)
+{
+    x ^= x >> 16;  x *= 0x7feb352du;
+    x ^= x >> 15;  x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Uniform in [0, 1), by xorshift
+static float Random(unsigned int& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8)*(1.0f/16777216.0f);
+}
+
+static float Luminance(const glm::vec3& c)
+{
+    return 0.2126f*c.x + 0.7152f*c.y + 0.0722f*c.z;
+}
+
+// An orthonormal basis around unit n (Duff et al.)
+static void Basis(const glm::vec3& n, glm::vec3& a, glm::vec3& b)
+{
+    const float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+    const float s = -1.0f/(sign + n.z);
+    const float t = n.x*n.y*s;
+    a = glm::vec3(1.0f + sign*n.x*n.x*s, sign*t, -sign*n.x);
+    b = glm::vec3(t, sign + n.y*n.y*s, -n.y);
+}
+
+////////////////////////////////////////////////////////////////////////
+// The BRDFs of lighting.frag, and their sampling: a diffuse lobe and
+// a specular lobe, chosen with probability pSpec.
+struct Surface
+{
+    glm::vec3 N, Kd, Ks;
+    float alpha;                // Shininess
+    int mode;                   // 0: Starter Set, 1: GGX
+    float pSpec;
+};
+
+// The specular lobe's distribution of half vectors, D(H)
+static float Distribution(const Surface& s, const float NH)
+{
+    if (s.mode == 1) {
+        const float a2 = 2.0f/(s.alpha + 2.0f);
+        const float q = NH*NH*(a2 - 1.0f) + 1.0f;
+        return a2/(PI*q*q); }
+    return (s.alpha + 2.0f)/(2.0f*PI)*powf(NH, s.alpha);
+}
+
+// Smith's masking for GGX
+static float SmithG1(const Surface& s, const float NX)
+{
+    const float a2 = 2.0f/(s.alpha + 2.0f);
+    const float tan2 = (1.0f - NX*NX)/(NX*NX);
+    return 2.0f/(1.0f + sqrtf(1.0f + a2*tan2));
+}
+
+static glm::vec3 Brdf(const Surface& s, const glm::vec3& L, const glm::vec3& V)
+{
+    const float NL = glm::dot(s.N, L), NV = glm::dot(s.N, V);
+    if (NL <= 0.0f || NV <= 0.0f)
+        return glm::vec3(0.0f);
+    const glm::vec3 H = glm::normalize(L + V);
+    const float LH = std::max(glm::dot(L, H), 1e-4f);
+    const float NH = std::max(glm::dot(s.N, H), 0.0f);
+    const glm::vec3 F = s.Ks + (glm::vec3(1.0f) - s.Ks)*powf(1.0f - LH, 5.0f);
+    const float D = Distribution(s, NH);
+    if (s.mode == 1)
+        return s.Kd/PI + F*(D*SmithG1(s, NL)*SmithG1(s, NV)/(4.0f*NL*NV));
+    return s.Kd/PI + F*(D/(4.0f*LH*LH));
+}
+
+static float BrdfPdf(const Surface& s, const glm::vec3& L, const glm::vec3& V)
+{
+    const float NL = glm::dot(s.N, L);
+    if (NL <= 0.0f)
+        return 0.0f;
+    const glm::vec3 H = glm::normalize(L + V);
+    const float NH = std::max(glm::dot(s.N, H), 0.0f);
+    const float LH = std::max(glm::dot(L, H), 1e-4f);
+    const float pdfH = s.mode == 1 ? Distribution(s, NH)*NH
+        : (s.alpha + 1.0f)/(2.0f*PI)*powf(NH, s.alpha);
+    return (1.0f - s.pSpec)*NL/PI + s.pSpec*pdfH/(4.0f*LH);
+}
+
+// A direction L from the BRDF's lobes, or a zero vector if it falls below the surface.
+static glm::vec3 SampleBrdf(const Surface& s, const glm::vec3& V, unsigned int& rng)
+{
+    glm::vec3 a, b;
+    Basis(s.N, a, b);
+    const float u0 = Random(rng), u1 = Random(rng), u2 = Random(rng);
+    const float phi = 2.0f*PI*u2;
+    if (u0 >= s.pSpec) {
+        // Cosine weighted
+        const float r = sqrtf(u1);
+        return r*cosf(phi)*a + r*sinf(phi)*b + sqrtf(std::max(0.0f, 1.0f - u1))*s.N; }
+
+    float cosH;
+    if (s.mode == 1) {
+        const float a2 = 2.0f/(s.alpha + 2.0f);
+        cosH = sqrtf((1.0f - u1)/(1.0f + (a2 - 1.0f)*u1)); }
+    else
+        cosH = powf(u1, 1.0f/(s.alpha + 1.0f));
+    const float sinH = sqrtf(std::max(0.0f, 1.0f - cosH*cosH));
+    const glm::vec3 H = sinH*cosf(phi)*a + sinH*sinf(phi)*b + cosH*s.N;
+    const glm::vec3 L = 2.0f*glm::dot(V, H)*H - V;
+    return glm::dot(s.N, L) > 0.0f ? L : glm::vec3(0.0f);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Setup
+PathTracer::PathTracer()
+    : width(0), height(0), maxDepth(6), samples(0),
+      skyWidth(0), skyHeight(0), scene(NULL)
+{}
+
+bool PathTracer::Build(const Scene& _scene, const int w, const int h)
+{
+    scene = &_scene;
+    width = w;
+    height = h;
+    samples = 0;
+    sum.assign(3*width*height, 0.0f);
+    image.assign(3*width*height, 0.0f);
+
+    double start = Trace::Now();
+    bvh.Build(scene->renderList, skyId);
+    if (bvh.instances.empty()) {
+        printf("Nothing to path trace\n");
+        return false; }
+    printf("BVH of %d instances built in %.2f s\n", (int)bvh.instances.size(), Trace::Now() - start);
+
+    if (!LoadSky(scene->skyFile))
+        return false;
+
+    inverseViewProj = glm::inverse(scene->WorldProj*scene->WorldView);
+    eye = (scene->WorldInverse*glm::vec4(0, 0, 0, 1)).xyz();
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// The sky.  Directions map to it as the sky object is textured (see
+// lighting.frag): the row is the polar angle from +Z down, and the
+// column the azimuth measured clockwise from -X.
+bool PathTracer::LoadSky(const std::string& name)
+{
+    HdrReader hdr;
+    if (!hdr.Open(name) || !hdr.Read(sky))
+        return false;
+    skyWidth = hdr.width;
+    skyHeight = hdr.height;
+
+    rowCdf.assign(skyHeight + 1, 0.0f);
+    texelCdf.assign(skyHeight*(skyWidth + 1), 0.0f);
+    for (int y=0;  y<skyHeight;  y++) {
+        const float sinTheta = sinf(PI*(y + 0.5f)/skyHeight);
+        float* cdf = &texelCdf[y*(skyWidth + 1)];
+        for (int x=0;  x<skyWidth;  x++) {
+            const float* c = &sky[3*(y*skyWidth + x)];
+            cdf[x+1] = cdf[x] + Luminance(glm::vec3(c[0], c[1], c[2]))*sinTheta; }
+        rowCdf[y+1] = rowCdf[y] + cdf[skyWidth]; }
+    if (rowCdf[skyHeight] <= 0.0f) {
+        printf("Sky is black: %s\n", name.c_str());
+        return false; }
+    return true;
+}
+
+// The texel a direction falls in
+static void SkyTexel(const glm::vec3& d, const int w, const int h, int& x, int& y)
+{
+    float u = -atan2f(-d.y, -d.x)/(2*PI);
+    u -= floorf(u);
+    const float v = acosf(std::max(-1.0f, std::min(d.z, 1.0f)))/PI;
+    x = std::min(w-1, (int)(u*w));
+    y = std::min(h-1, (int)(v*h));
+}
+
+glm::vec3 PathTracer::SkyRadiance(const glm::vec3& d) const
+{
+    int x, y;
+    SkyTexel(d, skyWidth, skyHeight, x, y);
+    const float* c = &sky[3*(y*skyWidth + x)];
+    return glm::vec3(c[0], c[1], c[2]);
+}
+
+// Texels are chosen in proportion to their weight, and directions are
+// uniform in each texel's (u, v) rectangle, hence the 1/sin(theta).
+float PathTracer::SkyPdf(const glm::vec3& d) const
+{
+    int x, y;
+    SkyTexel(d, skyWidth, skyHeight, x, y);
+    const float* cdf = &texelCdf[y*(skyWidth + 1)];
+    const float sinTheta = sqrtf(std::max(0.0f, 1.0f - d.z*d.z));
+    if (sinTheta <= 0.0f)
+        return 0.0f;
+    return (cdf[x+1] - cdf[x])/rowCdf[skyHeight]*skyWidth*skyHeight/(2*PI*PI*sinTheta);
+}
+
+glm::vec3 PathTracer::SampleSky(const float u1, const float u2, glm::vec3& d, float& pdf) const
+{
+    // The row, then the texel in the row, keeping the remainders for the position within the texel.
+    const float r = u1*rowCdf[skyHeight];
+    const int y = std::min(skyHeight-1, (int)(std::upper_bound(rowCdf.begin(), rowCdf.end(), r) - rowCdf.begin()) - 1);
+    const float* cdf = &texelCdf[y*(skyWidth + 1)];
+    const float s = u2*cdf[skyWidth];
+    const int x = std::min(skyWidth-1, (int)(std::upper_bound(cdf, cdf + skyWidth + 1, s) - cdf) - 1);
+    const float fy = (r - rowCdf[y])/std::max(rowCdf[y+1] - rowCdf[y], FLT_MIN);
+    const float fx = (s - cdf[x])/std::max(cdf[x+1] - cdf[x], FLT_MIN);
+
+    const float phi = 2*PI*(x + std::min(fx, 1.0f))/skyWidth;
+    const float theta = PI*(y + std::min(fy, 1.0f))/skyHeight;
+    d = glm::vec3(-cosf(phi)*sinf(theta), sinf(phi)*sinf(theta), cosf(theta));
+    pdf = SkyPdf(d);
+    return SkyRadiance(d);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Rendering
+glm::vec3 PathTracer::Trace(glm::vec3 o, glm::vec3 d, unsigned int& rng) const
+{
+    glm::vec3 radiance(0.0f), throughput(1.0f);
+    float lastPdf = 0.0f;       // Of the BRDF sample that chose d; 0 from the camera or a mirror
+    for (int depth=0;  ;  depth++) {
+        RayHit hit;
+        if (!bvh.Intersect(o, d, FLT_MAX, hit)) {
+            float weight = 1.0f;
+            if (lastPdf > 0.0f) {
+                const float pdf = SkyPdf(d);
+                weight = lastPdf*lastPdf/(lastPdf*lastPdf + pdf*pdf); }
+            radiance += throughput*SkyRadiance(d)*weight;
+            break; }
+        if (depth == maxDepth)
+            break;
+
+        // The surface, facing the incoming ray
+        const SceneBvh::Instance& instance = bvh.instances[hit.instance];
+        const Object& object = *instance.object;
+        const Shape& shape = *object.shape;
+        const glm::ivec3 tri = shape.Tri[hit.tri];
+        const float b[3] = { 1.0f - hit.b1 - hit.b2, hit.b1, hit.b2 };
+        const glm::vec3 p = o + hit.t*d;
+        const glm::vec3 V = -d;
+        glm::vec3 Ng = glm::normalize(instance.normalTr*glm::cross((shape.Pnt[tri[1]] - shape.Pnt[tri[0]]).xyz(),
+                                                                   (shape.Pnt[tri[2]] - shape.Pnt[tri[0]]).xyz()));
+        if (glm::dot(Ng, V) < 0.0f)
+            Ng = -Ng;
+        glm::vec3 Ns(0.0f), tangent(0.0f);
+        glm::vec2 uv(0.0f);
+        for (int k=0;  k<3;  k++) {
+            if (tri[k] < (int)shape.Nrm.size())
+                Ns += b[k]*shape.Nrm[tri[k]];
+            if (tri[k] < (int)shape.Tan.size())
+                tangent += b[k]*shape.Tan[tri[k]];
+            if (tri[k] < (int)shape.Tex.size())
+                uv += b[k]*shape.Tex[tri[k]]; }
+        Ns = instance.normalTr*Ns;
+        Ns = glm::dot(Ns, Ns) > 0.0f ? glm::normalize(Ns) : Ng;
+        if (glm::dot(Ns, Ng) < 0.0f)
+            Ns = -Ns;
+        tangent = glm::mat3(instance.modelTr)*tangent;
+        uv = (object.textureTransform*glm::vec4(uv, 0.0f, 0.0f)).xy();
+        const glm::vec3 po = p + EPSILON*Ng;
+
+        // Material values as lighting.frag chooses them
+        Surface s;
+        s.Kd = object.diffuseColor;
+        s.Ks = object.specularColor;
+        s.alpha = object.shininess;
+        s.mode = scene->mode == 1 ? 1 : 0;
+        const int objectId = object.objectId;
+        const Texture* textureMap = object.texture;
+        if ((objectId == roomId || objectId == boxId || objectId == floorId
+             || objectId == seaId || objectId == groundId) && object.normalTex) {
+            if (glm::dot(tangent, tangent) > 0.0f) {
+                const glm::vec3 Tn = glm::normalize(tangent);
+                const glm::vec3 B = glm::normalize(glm::cross(Tn, Ns));
+                const glm::vec3 delta = object.normalTex->Sample(uv, 0.0f).xyz()*2.0f - glm::vec3(1.0f);
+                const glm::vec3 mapped = delta.x*Tn + delta.y*B + delta.z*Ns;
+                if (glm::dot(mapped, mapped) > 0.0f)
+                    Ns = glm::normalize(mapped); } }
+        if (textureMap && (objectId == roomId || objectId == boxId || objectId == floorId
+                           || objectId == groundId || objectId == teapotId))
+            s.Kd = textureMap->Sample(uv, 0.0f).xyz();
+        if (objectId == lPicId) {
+            const bool white = ((int)(uv.x/0.9f*7))%2 == ((int)(uv.y/0.9f*7))%2;
+            s.Kd = glm::vec3(white ? 1.0f : 0.0f); }
+        else if (objectId == rPicId) {
+            if (uv.x < 0.05f || uv.x > 0.95f || uv.y < 0.05f || uv.y > 0.95f)
+                s.Kd = glm::vec3(0.5f);
+            else if (textureMap)
+                s.Kd = textureMap->Sample((uv - 0.05f)/0.9f, 0.0f).xyz(); }
+
+        // A shading normal facing away from the viewer is unusable
+        if (glm::dot(Ns, V) <= 0.0f)
+            Ns = Ng;
+        s.N = Ns;
+
+        // The sea is a mirror
+        if (objectId == seaId) {
+            o = po;
+            d = 2.0f*glm::dot(V, Ns)*Ns - V;
+            if (glm::dot(d, Ng) <= 0.0f)
+                break;
+            lastPdf = 0.0f;
+            continue; }
+
+        const glm::vec3 F0 = s.Ks + (glm::vec3(1.0f) - s.Ks)*powf(1.0f - glm::dot(Ns, V), 5.0f);
+        const float kd = Luminance(s.Kd), ks = Luminance(F0);
+        s.pSpec = std::max(0.1f, std::min(0.9f, ks/std::max(kd + ks, 1e-6f)));
+
+        // The point light
+        glm::vec3 L = scene->lightPos - p;
+        const float dist = glm::length(L);
+        L /= dist;
+        if (glm::dot(Ns, L) > 0.0f && glm::dot(Ng, L) > 0.0f && !bvh.Occluded(po, L, dist))
+            radiance += throughput*Brdf(s, L, V)*glm::dot(Ns, L)*scene->lightVal;
+
+        // The sky
+        float skyPdf;
+        const glm::vec3 Le = SampleSky(Random(rng), Random(rng), L, skyPdf);
+        if (skyPdf > 0.0f && glm::dot(Ns, L) > 0.0f && glm::dot(Ng, L) > 0.0f && !bvh.Occluded(po, L, FLT_MAX)) {
+            const float brdfPdf = BrdfPdf(s, L, V);
+            const float weight = skyPdf*skyPdf/(skyPdf*skyPdf + brdfPdf*brdfPdf);
+            radiance += throughput*Brdf(s, L, V)*glm::dot(Ns, L)*Le*(weight/skyPdf); }
+
+        // Continue the path
+        L = SampleBrdf(s, V, rng);
+        const float pdf = BrdfPdf(s, L, V);
+        if (pdf <= 0.0f || glm::dot(Ng, L) <= 0.0f)
+            break;
+        throughput *= Brdf(s, L, V)*(glm::dot(Ns, L)/pdf);
+        lastPdf = pdf;
+        o = po;
+        d = L;
+
+        if (depth >= 2) {
+            const float q = std::min(0.95f, std::max(throughput.x, std::max(throughput.y, throughput.z)));
+            if (Random(rng) >= q)
+                break;
+            throughput /= q; } }
+    return radiance;
+}
+
+void PathTracer::RenderTile(const int tile, const int tilesX)
+{
+    const int x0 = (tile % tilesX)*TILE, y0 = (tile / tilesX)*TILE;
+    const unsigned int passSeed = Hash(samples + 1);
+    for (int y=y0;  y<std::min(y0 + TILE, height);  y++)
+        for (int x=x0;  x<std::min(x0 + TILE, width);  x++) {
+            unsigned int rng = Hash((y*width + x) ^ passSeed) | 1;
+
+            // A jittered point in the pixel, from the near plane toward the far
+            const float nx = 2.0f*(x + Random(rng))/width - 1.0f;
+            const float ny = 1.0f - 2.0f*(y + Random(rng))/height;
+            glm::vec4 a = inverseViewProj*glm::vec4(nx, ny, -1.0f, 1.0f);
+            glm::vec4 b = inverseViewProj*glm::vec4(nx, ny, 1.0f, 1.0f);
+            const glm::vec3 o = a.xyz()/a.w;
+            const glm::vec3 d = glm::normalize(b.xyz()/b.w - o);
+
+            const glm::vec3 c = Trace(o, d, rng);
+            if (!(c.x == c.x && c.y == c.y && c.z == c.z) || c.x + c.y + c.z > FLT_MAX)
+                continue;
+            float* out = &sum[3*(y*width + x)];
+            out[0] += c.x;
+            out[1] += c.y;
+            out[2] += c.z; }
+}
+
+void PathTracer::AddPass()
+{
+    const int tilesX = (width + TILE - 1)/TILE, tilesY = (height + TILE - 1)/TILE;
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int tile=0;  tile<tilesX*tilesY;  tile++)
+        RenderTile(tile, tilesX);
+    samples++;
+
+    const float scale = 1.0f/samples;
+    for (size_t i=0;  i<sum.size();  i++)
+        image[i] = sum[i]*scale;
+}
+
+bool PathTracer::Render(const int spp, const std::string& name, const double interval)
+{
+    const double start = Trace::Now();
+    double written = start;
+    while (samples < spp) {
+        AddPass();
+        const double now = Trace::Now();
+        if (samples == spp || now - written >= interval) {
+            printf("%d of %d samples per pixel after %.1f s, writing %s\n", samples, spp, now - start, name.c_str());
+            fflush(stdout);
+            if (!HdrWrite(name, &image[0], width, height))
+                return false;
+            written = now; } }
+    return true;
+}
+
+#endif
@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////
+// An offline path tracer for the scene, for the v=em build.
+//
+// It renders a physically based reference of the same frame the
+// lighting pass draws, for judging the approximations made on the
+// GPU (the irradiance map, the mirror direction sky lookup, the
+// shadow map, ...).  Build() gathers the object hierarchy into a two
+// level bounding volume hierarchy (see bvh.h).  The surfaces
+// use the same material values as lighting.frag (diffuseColor or the
+// texture, specularColor, shininess, the normal maps) with the BRDF
+// selected by the scene's mode:
+//   mode 0: the Starter Set (a normalized Phong lobe with Schlick's Fresnel),
+//   mode 1: GGX with alpha = sqrt(2/(shininess+2)) and Smith shadowing.
+// Light comes from the full resolution HDR sky, importance sampled,
+// and from the point light.  The point light has no falloff, as in
+// lighting.frag.  The sea is a perfect mirror, as the shader draws
+// it; the sky object is left out, since the environment replaces it.
+//
+// Render() adds one sample per pixel per pass, with tiles of the
+// image spread across threads by OpenMP, and rewrites the output
+// .hdr (linear radiance, no tone mapping) as the image converges.
+// Each pixel's random numbers depend only on the pixel and pass, so
+// the result does not depend on the thread count.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _PATHTRACER_
+#define _PATHTRACER_
+
+#ifdef EM
+
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+
+class Scene;
+
+class PathTracer
+{
+public:
+    int width, height;
+    int maxDepth;               // Path vertices after the camera's
+    int samples;                // Per pixel, so far
+    std::vector<float> image;   // The mean of the samples so far: RGB, top row first
+
+    PathTracer();
+
+    // Gather the scene's geometry, materials, sky and light, as of the
+    // scene's last BuildTransforms, and build the BVH.  Prints a
+    // message and returns false on error.
+    bool Build(const Scene& scene, const int width, const int height);
+
+    // Add one sample to each pixel.
+    void AddPass();
+
+    // Render until there are spp samples per pixel, writing the image
+    // to name every interval seconds and when done.
+    bool Render(const int spp, const std::string& name, const double interval=30.0);
+
+private:
+    SceneBvh bvh;               // Of everything but the sky object
+
+    // The sky: linear radiance, top row first, and the distribution
+    // for sampling it by luminance*sin(theta) (per row marginal, and
+    // per texel conditional, cumulative).
+    int skyWidth, skyHeight;
+    std::vector<float> sky;
+    std::vector<float> rowCdf, texelCdf;
+
+    std::vector<float> sum;     // Per pixel sums of the samples
+    const Scene* scene;
+    glm::mat4 inverseViewProj;
+    glm::vec3 eye;
+
+    bool LoadSky(const std::string& name);
+    glm::vec3 SkyRadiance(const glm::vec3& d) const;
+    glm::vec3 SampleSky(const float u1, const float u2, glm::vec3& d, float& pdf) const;
+    float SkyPdf(const glm::vec3& d) const;
+
+    glm::vec3 Trace(glm::vec3 o, glm::vec3 d, unsigned int& rng) const;
+    void RenderTile(const int tile, const int tilesX);
+};
+
+#endif
+#endif
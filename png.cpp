@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////
+// Writing PNG images.  See png.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#include "png.h"
+
+// Deflate's stored blocks hold at most this many bytes each
+const int maxStored = 65535;
+
+struct CrcTable
+{
+    uint32_t crc[256];
+    CrcTable()
+    {
+        for (uint32_t n=0;  n<256;  n++) {
+            uint32_t c = n;
+            for (int k=0;  k<8;  k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            crc[n] = c; } }
+};
+static const CrcTable crcTable;
+
+static void PutBig32(std::vector<unsigned char>& out, const uint32_t v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+// Append a chunk: length, type, data, and the CRC of type and data.
+static void PutChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+{
+    PutBig32(out, (uint32_t)data.size());
+    const size_t start = out.size();
+    out.insert(out.end(), type, type+4);
+    out.insert(out.end(), data.begin(), data.end());
+    uint32_t c = 0xffffffffu;
+    for (size_t i=start;  i<out.size();  i++)
+        c = crcTable.crc[(c ^ out[i]) & 0xff] ^ (c >> 8);
+    PutBig32(out, c ^ 0xffffffffu);
+}
+
+bool PngWrite(const std::string& name, const unsigned char* rgb, const int width, const int height)
+{
+    // The raw scanlines, each with filter type 0 (none)
+    const size_t rowBytes = 3*(size_t)width;
+    std::vector<unsigned char> raw((rowBytes + 1)*height);
+    for (int y=0;  y<height;  y++) {
+        raw[y*(rowBytes+1)] = 0;
+        memcpy(&raw[y*(rowBytes+1) + 1], rgb + y*rowBytes, rowBytes); }
+
+    // A zlib stream of stored blocks, and the Adler-32 of the raw data
+    std::vector<unsigned char> idat;
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    for (size_t i=0;  i<raw.size();  i+=maxStored) {
+        const size_t n = std::min(raw.size() - i, (size_t)maxStored);
+        idat.push_back(i + n == raw.size() ? 1 : 0);
+        idat.push_back((unsigned char)n);
+        idat.push_back((unsigned char)(n >> 8));
+        idat.push_back((unsigned char)~n);
+        idat.push_back((unsigned char)(~n >> 8));
+        idat.insert(idat.end(), raw.begin() + i, raw.begin() + i + n); }
+    uint32_t a = 1, b = 0;
+    for (size_t i=0;  i<raw.size();  i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521; }
+    PutBig32(idat, (b << 16) | a);
+
+    std::vector<unsigned char> header;
+    PutBig32(header, width);
+    PutBig32(header, height);
+    header.push_back(8);        // Bits per channel
+    header.push_back(2);        // RGB
+    header.push_back(0);        // Deflate
+    header.push_back(0);        // Standard filters
+    header.push_back(0);        // Not interlaced
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<unsigned char> out(signature, signature+8);
+    PutChunk(out, "IHDR", header);
+    PutChunk(out, "IDAT", idat);
+    PutChunk(out, "IEND", std::vector<unsigned char>());
+
+    FILE* fp = fopen(name.c_str(), "wb");
+    if (!fp) {
+        printf("Can't create file: %s\n", name.c_str());
+        return false; }
+    bool ok = fwrite(&out[0], 1, out.size(), fp) == out.size();
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok)
+        printf("PNG write error in %s\n", name.c_str());
+    return ok;
+}
@@ -0,0 +1,18 @@
+////////////////////////////////////////////////////////////////////////
+// Writing PNG images, for frames dumped by the headless renderer.
+//
+// There is no zlib here, so the image data goes out in deflate's
+// stored (uncompressed) blocks, which every PNG reader accepts.  The
+// files are about the size of a PPM, but open anywhere.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _PNG_
+#define _PNG_
+
+#include <string>
+
+// Write an image of interleaved 8 bit RGB, top row first.  Prints a
+// message and returns false on error.
+bool PngWrite(const std::string& name, const unsigned char* rgb, const int width, const int height);
+
+#endif
@@ -0,0 +1,263 @@
+////////////////////////////////////////////////////////////////////////
+// Timing of the frame's passes.  See profiler.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "framework.h"
+#include "profiler.h"
+#include "trace.h"
+
+// Draw calls and triangles made so far, by every pass
+static long long drawCalls = 0, drawTriangles = 0;
+
+Profiler::Profiler()
+    : enabled(false), wait(false), history(0), frameTraced(false), frameCount(0), frameStart(0.0),
+      passStart(0.0), passDraws(0), passTriangles(0), inFrame(false), inPass(false)
+{
+    for (int s=0;  s<LATENCY;  s++) {
+        cpuBase[s] = 0.0;
+        gpuBase[s] = 0; }
+}
+
+void Profiler::CountDraw(const int triangles)
+{
+    drawCalls++;
+    drawTriangles += triangles;
+}
+
+int Profiler::Find(const char* name)
+{
+    for (int p=0;  p<(int)passes.size();  p++)
+        if (passes[p].name == name)
+            return p;
+    Pass pass;
+    pass.name = name;
+    pass.drawCalls = pass.triangles = 0;
+    passes.push_back(pass);
+    return (int)passes.size() - 1;
+}
+
+void Profiler::Add(std::vector<double>& samples, const double ms)
+{
+    samples.push_back(ms);
+    if (history > 0 && (int)samples.size() > history)
+        samples.erase(samples.begin(), samples.end() - history);
+}
+
+// The i'th query of a frame's slot, made when first needed
+unsigned int Profiler::Query(const int slot, const int i)
+{
+    while ((int)queries[slot].size() <= i) {
+        GLuint q;
+        glGenQueries(1, &q);
+        queries[slot].push_back(q); }
+    return queries[slot][i];
+}
+
+void Profiler::BeginFrame()
+{
+    if (!enabled && !Trace::Recording())
+        return;
+    const int slot = frameCount % LATENCY;
+    Find("frame");
+    frames[slot].clear();
+    inFrame = true;
+    frameTraced = Trace::Recording();
+    if (frameTraced) {
+        Trace::Begin("frame");
+        if (hasGL) {
+            GLint64 gpu;
+            glGetInteger64v(GL_TIMESTAMP, &gpu);
+            cpuBase[slot] = Trace::Now();
+            gpuBase[slot] = gpu; } }
+    frameStart = Trace::Now();
+}
+
+void Profiler::Begin(const char* name)
+{
+    if (!inFrame || inPass)
+        return;
+    const int slot = frameCount % LATENCY;
+    std::vector<Timing>& frame = frames[slot];
+    Timing t;
+    t.pass = Find(name);
+    t.name = name;
+    t.cpu = 0.0;
+    t.query = t.stamps[0] = t.stamps[1] = 0;
+    t.traced = frameTraced && Trace::Recording();
+    if (t.traced)
+        Trace::Begin(name);
+    if (hasGL) {
+        const int i = 3*(int)frame.size();
+        t.query = Query(slot, i);
+        if (t.traced) {
+            t.stamps[0] = Query(slot, i+1);
+            t.stamps[1] = Query(slot, i+2);
+            glQueryCounter(t.stamps[0], GL_TIMESTAMP); }
+        glBeginQuery(GL_TIME_ELAPSED, t.query); }
+    frame.push_back(t);
+    inPass = true;
+    passDraws = drawCalls;
+    passTriangles = drawTriangles;
+    passStart = Trace::Now();
+}
+
+void Profiler::End()
+{
+    if (!inPass)
+        return;
+    Timing& t = frames[frameCount % LATENCY].back();
+    t.cpu = 1000*(Trace::Now() - passStart);
+    if (hasGL) {
+        glEndQuery(GL_TIME_ELAPSED);
+        if (t.traced)
+            glQueryCounter(t.stamps[1], GL_TIMESTAMP); }
+    if (t.traced)
+        Trace::End();
+    passes[t.pass].drawCalls = (int)(drawCalls - passDraws);
+    passes[t.pass].triangles = (int)(drawTriangles - passTriangles);
+    inPass = false;
+}
+
+void Profiler::EndFrame()
+{
+    if (!inFrame)
+        return;
+    End();
+    const int slot = frameCount % LATENCY;
+    const int total = Find("frame");
+    Add(passes[total].cpu, 1000*(Trace::Now() - frameStart));
+    for (size_t i=0;  i<frames[slot].size();  i++)
+        Add(passes[frames[slot][i].pass].cpu, frames[slot][i].cpu);
+    inFrame = false;
+    if (frameTraced)
+        Trace::End();
+
+    // The frame before this one, whose queries have most likely finished
+    frameCount++;
+    Collect(frameCount % LATENCY, wait);
+}
+
+void Profiler::Collect(const int slot, const bool wait)
+{
+    std::vector<Timing>& frame = frames[slot];
+    if (frame.empty() || !hasGL) {
+        frame.clear();
+        return; }
+
+    // Queries finish in order, so when the last is done, all are.
+    if (!wait) {
+        const Timing& last = frame.back();
+        GLint available = 0;
+        glGetQueryObjectiv(last.traced ? last.stamps[1] : last.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            frame.clear();
+            return; } }
+
+    double gpu = 0.0;
+    for (size_t i=0;  i<frame.size();  i++) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(frame[i].query, GL_QUERY_RESULT, &ns);
+        Add(passes[frame[i].pass].gpu, ns/1e6);
+        gpu += ns/1e6;
+        if (frame[i].traced) {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(frame[i].stamps[0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(frame[i].stamps[1], GL_QUERY_RESULT, &end);
+            Trace::Gpu(frame[i].name, cpuBase[slot] + ((long long)start - gpuBase[slot])/1e9,
+                       cpuBase[slot] + ((long long)end - gpuBase[slot])/1e9); } }
+    Add(passes[Find("frame")].gpu, gpu);
+    frame.clear();
+}
+
+void Profiler::Flush()
+{
+    if (!inFrame)
+        Collect((frameCount + LATENCY - 1) % LATENCY, true);
+}
+
+void Profiler::Clear()
+{
+    for (int s=0;  s<LATENCY;  s++)
+        if (!inFrame || s != frameCount % LATENCY)
+            frames[s].clear();      // Not the frame being timed
+    for (size_t p=0;  p<passes.size();  p++) {
+        passes[p].cpu.clear();
+        passes[p].gpu.clear(); }
+}
+
+Profiler::Stats Profiler::Summarize(const std::vector<double>& samples)
+{
+    Stats s = { 0.0, 0.0, 0.0, 0.0 };
+    if (samples.empty())
+        return s;
+    std::vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    const int n = (int)sorted.size();
+    for (int i=0;  i<n;  i++)
+        s.mean += sorted[i];
+    s.mean /= n;
+    s.p50 = sorted[std::max(0, (int)ceil(0.50*n) - 1)];
+    s.p95 = sorted[std::max(0, (int)ceil(0.95*n) - 1)];
+    s.p99 = sorted[std::max(0, (int)ceil(0.99*n) - 1)];
+    return s;
+}
+
+////////////////////////////////////////////////////////////////////////
+// The ImGui window: a row per pass of its latest times and counts,
+// then a graph per pass of its recent CPU and GPU times.
+void Profiler::DrawWindow()
+{
+    if (!enabled)
+        return;
+    ImGui::SetNextWindowSize(ImVec2(460, 420), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Profiler", &enabled)) {
+        ImGui::End();
+        return; }
+
+    ImGui::Columns(5, "passes");
+    ImGui::Text("Pass");       ImGui::NextColumn();
+    ImGui::Text("CPU ms");     ImGui::NextColumn();
+    ImGui::Text("GPU ms");     ImGui::NextColumn();
+    ImGui::Text("Draws");      ImGui::NextColumn();
+    ImGui::Text("Triangles");  ImGui::NextColumn();
+    ImGui::Separator();
+    for (size_t p=0;  p<passes.size();  p++) {
+        const Pass& pass = passes[p];
+        ImGui::Text("%s", pass.name.c_str());  ImGui::NextColumn();
+        ImGui::Text("%.3f", pass.cpu.empty() ? 0.0 : pass.cpu.back());  ImGui::NextColumn();
+        ImGui::Text("%.3f", pass.gpu.empty() ? 0.0 : pass.gpu.back());  ImGui::NextColumn();
+        if (p == 0) {
+            // The frame's own counts are the sums of its passes'.
+            int calls = 0, triangles = 0;
+            for (size_t q=1;  q<passes.size();  q++) {
+                calls += passes[q].drawCalls;
+                triangles += passes[q].triangles; }
+            ImGui::Text("%d", calls);      ImGui::NextColumn();
+            ImGui::Text("%d", triangles);  ImGui::NextColumn(); }
+        else {
+            ImGui::Text("%d", pass.drawCalls);  ImGui::NextColumn();
+            ImGui::Text("%d", pass.triangles);  ImGui::NextColumn(); } }
+    ImGui::Columns(1);
+    ImGui::Separator();
+
+    std::vector<float> values;
+    for (size_t p=0;  p<passes.size();  p++) {
+        const Pass& pass = passes[p];
+        for (int g=0;  g<2;  g++) {
+            const std::vector<double>& samples = g ? pass.gpu : pass.cpu;
+            values.assign(samples.begin(), samples.end());
+            if (values.empty())
+                values.push_back(0.0f);
+            char label[64], overlay[64];
+            sprintf(label, "%s %s", pass.name.c_str(), g ? "GPU" : "CPU");
+            sprintf(overlay, "%s %.3f ms", label, samples.empty() ? 0.0 : samples.back());
+            ImGui::PlotLines(("##" + std::string(label)).c_str(), &values[0],
+                             (int)values.size(), 0, overlay, 0.0f, FLT_MAX, ImVec2(0, 40)); } }
+    ImGui::End();
+}
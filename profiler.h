@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////////////////
+// Timing of the frame's passes, on the CPU and on the GPU.
+//
+// Each pass is bracketed with Begin(name) and End(), or with a
+// ProfileScope for a pass that is a whole block.  When the profiler
+// is enabled, these read a steady clock for the CPU time spent
+// issuing the pass, count the draw calls and triangles it issues
+// (Shape::DrawVAO reports them to CountDraw), and wrap it in a
+// GL_TIME_ELAPSED query for the GPU time spent executing it.  (Such
+// queries cannot nest, so neither can passes.)
+//
+// The caller brackets whole frames with BeginFrame() and EndFrame(),
+// which appends each pass's CPU time to its samples, along with a
+// "frame" entry: the CPU time of the whole frame, and the sum of the
+// passes' GPU times.  The queries are double buffered: EndFrame
+// collects the previous frame's results, which the GPU has almost
+// always finished by then, so the CPU never waits.  (If it has not,
+// that frame's GPU times are dropped, unless wait is set.)  Flush()
+// waits for the last frame's results.
+//
+// While a Trace is recording, the frame and its passes are also
+// traced, and timestamp queries at each pass's start and end place
+// its GPU execution on the trace's timeline too.
+//
+// When neither enabled nor tracing, all of this costs nothing.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _PROFILER_
+#define _PROFILER_
+
+#include <string>
+#include <vector>
+
+class Profiler
+{
+public:
+    struct Pass
+    {
+        std::string name;
+        std::vector<double> cpu, gpu;   // Milliseconds per frame, oldest first
+        int drawCalls, triangles;       // In the last frame
+    };
+
+    // A summary of samples, in the same units
+    struct Stats
+    {
+        double mean, p50, p95, p99;
+    };
+
+    bool enabled;
+    bool wait;                  // Wait for late GPU times rather than drop them
+    int history;                // Samples kept per pass, or 0 for all
+    std::vector<Pass> passes;   // In order of first use; "frame" is first
+
+    Profiler();
+
+    // Pass names must be string literals, as traces keep only pointers.
+    void BeginFrame();
+    void EndFrame();
+    void Begin(const char* name);
+    void End();
+
+    // Wait for the GPU times of frames still in flight.
+    void Flush();
+
+    // Forget the samples (e.g. of warm-up frames), and the frame in flight.
+    void Clear();
+
+    // Show the passes' latest times and counts, with graphs of their
+    // history, in an ImGui window (between ImGui's NewFrame and
+    // Render).  Closing the window disables the profiler.
+    void DrawWindow();
+
+    // Called for each draw call made.
+    static void CountDraw(const int triangles);
+
+    // Mean and percentiles (nearest rank) of samples.
+    static Stats Summarize(const std::vector<double>& samples);
+
+private:
+    enum { LATENCY = 2 };       // Frames whose queries may be in flight
+
+    // A pass timed in a frame
+    struct Timing
+    {
+        int pass;
+        const char* name;
+        double cpu;
+        unsigned int query;
+        bool traced;
+        unsigned int stamps[2];         // GL_TIMESTAMP queries at the start and end, if traced
+    };
+    std::vector<Timing> frames[LATENCY];
+    std::vector<unsigned int> queries[LATENCY];     // Three per pass timed in a frame, reused
+
+    // When tracing, the trace's time and the GPU's timestamp at the
+    // start of each frame in flight
+    double cpuBase[LATENCY];
+    long long gpuBase[LATENCY];
+    bool frameTraced;
+    int frameCount;
+    double frameStart, passStart;
+    long long passDraws, passTriangles;
+    bool inFrame, inPass;
+
+    int Find(const char* name);
+    unsigned int Query(const int slot, const int i);
+    void Add(std::vector<double>& samples, const double ms);
+    void Collect(const int slot, const bool wait);
+};
+
+// Times the enclosing block as a pass.
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler& _profiler, const char* name) : profiler(_profiler) { profiler.Begin(name); }
+    ~ProfileScope() { profiler.End(); }
+private:
+    Profiler& profiler;
+};
+
+#endif
@@ -0,0 +1,501 @@
+////////////////////////////////////////////////////////////////////////
+// A tiled, multithreaded triangle rasterizer.  See raster.h for the
+// overall structure.
+//
+// Conventions follow OpenGL's: window coordinates have y up and row 0
+// at the bottom, pixel centers are at half integers, counterclockwise
+// triangles face front, coverage follows the top-left rule, and the
+// depth test is GL_LESS.  Vertices are snapped to 1/256 of a pixel,
+// and edge functions are exact: tile and bin tests use 64 bit
+// integers, and within a tile that an edge crosses its values are
+// small enough for 32 bit lanes.  Only edges over about 2000 pixels
+// long fall back to 64 bit arithmetic per pixel.  Triangles sharing
+// an edge never overlap or leave cracks.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <vector>
+#include <algorithm>
+
+#include "framework.h"
+#include "raster.h"
+
+// AVX2 is compiled into its own functions and chosen at run time, so
+// the build needs no special flags and runs on any x86 CPU.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RASTER_AVX2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+static bool HasAvx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#define RASTER_AVX2
+#define TARGET_AVX2
+static bool HasAvx2()
+{
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    if (!(info[2] & (1<<27)) || !(info[2] & (1<<28)) || (_xgetbv(0) & 6) != 6)
+        return false;           // No AVX, or the OS doesn't save the registers
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1<<5)) != 0;
+}
+#else
+static bool HasAvx2() { return false; }
+#endif
+
+const int TILE = 8;             // Tile size in pixels, the unit of coverage tests
+const int BIN = 8*TILE;         // Bin size in pixels, the unit of work of a thread
+const int SUBPIXEL = 256;       // Fixed point vertex precision
+const float GUARD = 16.0f;      // Guard band in viewport widths; beyond it triangles are clipped in x and y
+const int TRIANGLE_BATCH = 2048;    // Triangles per task of the setup stage
+const long long LANE_LIMIT = 1LL<<30;   // Bound on edge values within a tile for 32 bit lanes
+
+// floor(a/b) for b > 0
+static long long FloorDiv(const long long a, const long long b)
+{
+    return a >= 0 ? a/b : -((-a + b - 1)/b);
+}
+
+static int BitCount(unsigned int m)
+{
+    int n = 0;
+    for (;  m;  m &= m-1)
+        n++;
+    return n;
+}
+
+// Signed distance-like measure of a clip space point from each
+// clipping plane (inside when >= 0): near, far, and the guard band.
+static float PlaneDistance(const glm::vec4& c, const int plane)
+{
+    switch (plane) {
+    case 0: return c.w + c.z;
+    case 1: return c.w - c.z;
+    case 2: return GUARD*c.w + c.x;
+    case 3: return GUARD*c.w - c.x;
+    case 4: return GUARD*c.w + c.y;
+    default: return GUARD*c.w - c.y; }
+}
+
+// Edge k of a triangle is opposite vertex k, positive inside:
+// E(x, y) = dx*(y - y[a]) - dy*(x - x[a]), in square subpixels.  Edges
+// that are neither top nor left need strictly positive values, so
+// coverage is E + bias >= 0.
+static void EdgeSetup(const Rasterizer::Triangle& t, const int k, long long& dx, long long& dy, int& bias)
+{
+    const int a = (k+1)%3, b = (k+2)%3;
+    dx = t.x[b] - t.x[a];
+    dy = t.y[b] - t.y[a];
+    bias = (dy < 0 || (dy == 0 && dx < 0)) ? 0 : -1;
+}
+
+// The edge's value at the center of pixel (x, y)
+static long long EdgeAt(const Rasterizer::Triangle& t, const int k, const long long dx, const long long dy,
+                        const int x, const int y)
+{
+    const int a = (k+1)%3;
+    return dx*((long long)y*SUBPIXEL + SUBPIXEL/2 - t.y[a]) - dy*((long long)x*SUBPIXEL + SUBPIXEL/2 - t.x[a]);
+}
+
+// True if no pixel center of the rectangle is covered by the triangle
+static bool Outside(const Rasterizer::Triangle& t, const int x0, const int y0, const int x1, const int y1)
+{
+    for (int k=0;  k<3;  k++) {
+        long long dx, dy;
+        int bias;
+        EdgeSetup(t, k, dx, dy, bias);
+        // The corner where the edge function is largest
+        if (EdgeAt(t, k, dx, dy, dy < 0 ? x1 : x0, dx > 0 ? y1 : y0) + bias < 0)
+            return true; }
+    return false;
+}
+
+void Rasterizer::Triangle::Interpolants(const int x, const int y, glm::vec3& b, glm::vec3& dbdx, glm::vec3& dbdy) const
+{
+    const glm::vec4 q = p + (float)(x - x0)*px + (float)(y - y0)*py;
+    const float w = 1.0f/q.w;
+    b = q.xyz()*w;
+    dbdx = (px.xyz() - b*px.w)*w;
+    dbdy = (py.xyz() - b*py.w)*w;
+}
+
+Rasterizer::Rasterizer()
+    : width(0), height(0), simd(HasAvx2()), trianglesIn(0), trianglesDrawn(0), fragments(0),
+      binsX(0), binsY(0)
+{}
+
+void Rasterizer::Begin(const int _width, const int _height)
+{
+    width = _width;
+    height = _height;
+    depth.resize(width*height);
+    visible.resize(width*height);
+    draws.clear();
+    trianglesIn = 0;
+}
+
+int Rasterizer::Draw(const glm::vec4* clip, const int stride, const glm::ivec3* tris, const int count,
+                     const Cull cull)
+{
+    DrawCall d;
+    d.clip = clip;
+    d.stride = stride;
+    d.tris = tris;
+    d.count = count;
+    d.cull = cull;
+    draws.push_back(d);
+    trianglesIn += count;
+    return (int)draws.size() - 1;
+}
+
+void Rasterizer::Flush()
+{
+    // Setup and binning, in batches of triangles
+    int count = 0;
+    for (size_t d=0;  d<draws.size();  d++)
+        count += (draws[d].count + TRIANGLE_BATCH-1)/TRIANGLE_BATCH;
+    batches.resize(count);
+    count = 0;
+    for (int d=0;  d<(int)draws.size();  d++)
+        for (int first=0;  first<draws[d].count;  first+=TRIANGLE_BATCH) {
+            Batch& b = batches[count++];
+            b.draw = d;
+            b.first = first;
+            b.last = std::min(first+TRIANGLE_BATCH, draws[d].count); }
+    binsX = (width + BIN-1)/BIN;
+    binsY = (height + BIN-1)/BIN;
+#pragma omp parallel for schedule(dynamic)
+    for (int b=0;  b<(int)batches.size();  b++) {
+        SetupBatch(batches[b]);
+        BinBatch(batches[b]); }
+    trianglesDrawn = 0;
+    for (size_t b=0;  b<batches.size();  b++)
+        trianglesDrawn += batches[b].triangles.size();
+
+    // Rasterization, which also clears the buffers
+    binFragments.assign(binsX*binsY, 0);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int bin=0;  bin<binsX*binsY;  bin++)
+        RasterBin(bin);
+    fragments = 0;
+    for (size_t bin=0;  bin<binFragments.size();  bin++)
+        fragments += binFragments[bin];
+}
+
+////////////////////////////////////////////////////////////////////////
+// Setup: trivially accept or reject each triangle of the batch, and
+// clip the rest (Sutherland-Hodgman, in clip space) into a fan.
+void Rasterizer::SetupBatch(Batch& batch)
+{
+    struct ClipVertex
+    {
+        glm::vec4 clip;
+        glm::vec3 bary;         // Barycentrics in the original triangle
+    };
+
+    batch.triangles.clear();
+    batch.triangles.reserve(batch.last - batch.first);
+    const DrawCall& d = draws[batch.draw];
+    const glm::vec3 corner[3] = { glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1) };
+
+    for (int t=batch.first;  t<batch.last;  t++) {
+        const glm::vec4 v[3] = { Position(d, d.tris[t][0]), Position(d, d.tris[t][1]), Position(d, d.tris[t][2]) };
+        int outAll = 0x3f, outAny = 0;
+        for (int i=0;  i<3;  i++) {
+            int out = 0;
+            for (int p=0;  p<6;  p++)
+                if (PlaneDistance(v[i], p) < 0.0f)
+                    out |= 1<<p;
+            outAll &= out;
+            outAny |= out; }
+        if (outAll)
+            continue;
+        if (!outAny) {
+            SetupTriangle(batch, t, v, corner);
+            continue; }
+
+        // Each plane adds at most one vertex
+        ClipVertex poly[9], next[9];
+        int n = 3;
+        for (int i=0;  i<3;  i++) {
+            poly[i].clip = v[i];
+            poly[i].bary = corner[i]; }
+        for (int p=0;  p<6 && n>=3;  p++) {
+            if (!(outAny & (1<<p)))
+                continue;
+            int m = 0;
+            for (int i=0;  i<n;  i++) {
+                const ClipVertex& a = poly[i];
+                const ClipVertex& b = poly[(i+1)%n];
+                const float da = PlaneDistance(a.clip, p), db = PlaneDistance(b.clip, p);
+                if (da >= 0.0f)
+                    next[m++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f)) {
+                    const float s = da/(da-db);
+                    next[m].clip = a.clip + s*(b.clip - a.clip);
+                    next[m].bary = a.bary + s*(b.bary - a.bary);
+                    m++; } }
+            n = m;
+            std::copy(next, next+n, poly); }
+        for (int i=2;  i<n;  i++) {
+            const glm::vec4 c[3] = { poly[0].clip, poly[i-1].clip, poly[i].clip };
+            const glm::vec3 b[3] = { poly[0].bary, poly[i-1].bary, poly[i].bary };
+            SetupTriangle(batch, t, c, b); } }
+}
+
+void Rasterizer::SetupTriangle(Batch& batch, const int prim, const glm::vec4* clip, const glm::vec3* bary)
+{
+    // Most small triangles are dropped here, so the Triangle is only
+    // filled in after the tests.
+    long long x[3], y[3];
+    float invW[3], z[3];
+    for (int i=0;  i<3;  i++) {
+        const glm::vec4& p = clip[i];
+        invW[i] = 1.0f/p.w;
+        x[i] = (long long)floorf((p.x*invW[i]*0.5f + 0.5f)*width*SUBPIXEL + 0.5f);
+        y[i] = (long long)floorf((p.y*invW[i]*0.5f + 0.5f)*height*SUBPIXEL + 0.5f);
+        z[i] = p.z*invW[i]*0.5f + 0.5f; }
+
+    long long area = (x[1]-x[0])*(y[2]-y[0]) - (x[2]-x[0])*(y[1]-y[0]);
+    const Cull cull = draws[batch.draw].cull;
+    if (area == 0 || (cull == CULL_FRONT && area > 0) || (cull == CULL_BACK && area < 0))
+        return;
+    int v[3] = { 0, 1, 2 };     // Which input vertex each of t's is
+    if (area < 0) {
+        std::swap(v[1], v[2]);
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        area = -area; }
+
+    // Pixels whose centers (i+1/2)*SUBPIXEL fall in the bounding box
+    const long long minX = std::min(x[0], std::min(x[1], x[2]));
+    const long long maxX = std::max(x[0], std::max(x[1], x[2]));
+    const long long minY = std::min(y[0], std::min(y[1], y[2]));
+    const long long maxY = std::max(y[0], std::max(y[1], y[2]));
+    const int x0 = (int)std::max(0LL, -FloorDiv(SUBPIXEL/2 - minX, SUBPIXEL));
+    const int y0 = (int)std::max(0LL, -FloorDiv(SUBPIXEL/2 - minY, SUBPIXEL));
+    const int x1 = (int)std::min((long long)width-1, FloorDiv(maxX - SUBPIXEL/2, SUBPIXEL));
+    const int y1 = (int)std::min((long long)height-1, FloorDiv(maxY - SUBPIXEL/2, SUBPIXEL));
+    if (x0 > x1 || y0 > y1)
+        return;
+
+    batch.triangles.push_back(Triangle());
+    Triangle& t = batch.triangles.back();
+    t.draw = batch.draw;
+    t.prim = prim;
+    std::copy(x, x+3, t.x);
+    std::copy(y, y+3, t.y);
+    t.x0 = x0;
+    t.y0 = y0;
+    t.x1 = x1;
+    t.y1 = y1;
+
+    // The planes, from the linear barycentrics E/area at the center of
+    // pixel (x0, y0) and their steps per pixel.  Window z is linear in
+    // them, and so are the attributes over w.
+    const double invArea = 1.0/area;
+    double z0 = 0.0, zx = 0.0, zy = 0.0;
+    double p0[4] = { 0, 0, 0, 0 }, px[4] = { 0, 0, 0, 0 }, py[4] = { 0, 0, 0, 0 };
+    for (int k=0;  k<3;  k++) {
+        long long dx, dy;
+        int bias;
+        EdgeSetup(t, k, dx, dy, bias);
+        const double l = EdgeAt(t, k, dx, dy, t.x0, t.y0)*invArea;
+        const double lx = -dy*SUBPIXEL*invArea, ly = dx*SUBPIXEL*invArea;
+        z0 += l*z[v[k]];
+        zx += lx*z[v[k]];
+        zy += ly*z[v[k]];
+        const double q[4] = { bary[v[k]].x*invW[v[k]], bary[v[k]].y*invW[v[k]], bary[v[k]].z*invW[v[k]], invW[v[k]] };
+        for (int c=0;  c<4;  c++) {
+            p0[c] += l*q[c];
+            px[c] += lx*q[c];
+            py[c] += ly*q[c]; } }
+    t.z = (float)z0;
+    t.zx = (float)zx;
+    t.zy = (float)zy;
+    t.p = glm::vec4((float)p0[0], (float)p0[1], (float)p0[2], (float)p0[3]);
+    t.px = glm::vec4((float)px[0], (float)px[1], (float)px[2], (float)px[3]);
+    t.py = glm::vec4((float)py[0], (float)py[1], (float)py[2], (float)py[3]);
+}
+
+// Sort the batch's triangles by bin, counting first.  A triangle goes
+// in each bin of its bounding box that its edges don't exclude.
+void Rasterizer::BinBatch(Batch& batch)
+{
+    batch.binStart.assign(binsX*binsY + 1, 0);
+    for (int pass=0;  pass<2;  pass++) {
+        for (int i=0;  i<(int)batch.triangles.size();  i++) {
+            const Triangle& t = batch.triangles[i];
+            const int bx0 = t.x0/BIN, bx1 = t.x1/BIN, by0 = t.y0/BIN, by1 = t.y1/BIN;
+            const bool single = bx0 == bx1 && by0 == by1;
+            for (int by=by0;  by<=by1;  by++)
+                for (int bx=bx0;  bx<=bx1;  bx++) {
+                    if (!single && Outside(t, std::max(bx*BIN, t.x0), std::max(by*BIN, t.y0),
+                                           std::min(bx*BIN+BIN-1, t.x1), std::min(by*BIN+BIN-1, t.y1)))
+                        continue;
+                    const int bin = by*binsX + bx;
+                    if (pass == 0)
+                        batch.binStart[bin+1]++;
+                    else
+                        batch.binned[batch.binStart[bin]++] = i; } }
+        if (pass == 0) {
+            for (int bin=0;  bin<binsX*binsY;  bin++)
+                batch.binStart[bin+1] += batch.binStart[bin];
+            batch.binned.resize(batch.binStart.back()); }
+        else {
+            // Placing advanced each start to the next bin's
+            for (int bin=binsX*binsY;  bin>0;  bin--)
+                batch.binStart[bin] = batch.binStart[bin-1];
+            batch.binStart[0] = 0; } }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Rasterization
+
+// Coverage and depth test of a tile's nx by ny pixels from (x0, y0).
+// The edge values e (with the bias added) and steps are those at the
+// first pixel; edges known to cover the whole tile have all zeros.
+// Returns the number of pixels covered.
+static int TileScalar(const Rasterizer::Triangle& t, float* depth, const Rasterizer::Triangle** visible,
+                      const int width, const int x0, const int y0, const int nx, const int ny,
+                      const long long* e, const long long* stepX, const long long* stepY)
+{
+    int count = 0;
+    for (int j=0;  j<ny;  j++) {
+        const int y = y0 + j;
+        const float zRow = t.z + t.zy*(float)(y - t.y0);
+        for (int i=0;  i<nx;  i++) {
+            if ((e[0] + i*stepX[0] + j*stepY[0]) < 0 || (e[1] + i*stepX[1] + j*stepY[1]) < 0
+                || (e[2] + i*stepX[2] + j*stepY[2]) < 0)
+                continue;
+            count++;
+            const int x = x0 + i;
+            const float z = zRow + t.zx*(float)(x - t.x0);
+            if (z < depth[y*width + x]) {
+                depth[y*width + x] = z;
+                visible[y*width + x] = &t; } } }
+    return count;
+}
+
+#ifdef RASTER_AVX2
+// The same, a row of 8 pixels at a time, with edge values that fit in 32 bits.
+TARGET_AVX2
+static int TileAvx2(const Rasterizer::Triangle& t, float* depth, const Rasterizer::Triangle** visible,
+                    const int width, const int x0, const int y0, const int nx, const int ny,
+                    const int* e, const int* stepX, const int* stepY)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(nx), lane);
+    const __m256i minusOne = _mm256_set1_epi32(-1);
+    __m256i edge[3], step[3];
+    for (int k=0;  k<3;  k++) {
+        edge[k] = _mm256_add_epi32(_mm256_set1_epi32(e[k]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(stepX[k])));
+        step[k] = _mm256_set1_epi32(stepY[k]); }
+    const __m256 zx = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(lane, _mm256_set1_epi32(x0 - t.x0))),
+                                    _mm256_set1_ps(t.zx));
+
+    int count = 0;
+    for (int j=0;  j<ny;  j++) {
+        const __m256i in = _mm256_and_si256(_mm256_and_si256(valid, _mm256_cmpgt_epi32(edge[0], minusOne)),
+                                            _mm256_and_si256(_mm256_cmpgt_epi32(edge[1], minusOne),
+                                                             _mm256_cmpgt_epi32(edge[2], minusOne)));
+        for (int k=0;  k<3;  k++)
+            edge[k] = _mm256_add_epi32(edge[k], step[k]);
+        if (_mm256_testz_si256(in, in))
+            continue;
+        const int y = y0 + j;
+        const int p = y*width + x0;
+        const __m256 z = _mm256_add_ps(_mm256_set1_ps(t.z + t.zy*(float)(y - t.y0)), zx);
+        const __m256 old = _mm256_maskload_ps(depth + p, in);
+        const __m256 nearer = _mm256_and_ps(_mm256_castsi256_ps(in), _mm256_cmp_ps(z, old, _CMP_LT_OQ));
+        count += BitCount(_mm256_movemask_ps(_mm256_castsi256_ps(in)));
+        const int bits = _mm256_movemask_ps(nearer);
+        if (!bits)
+            continue;
+        _mm256_maskstore_ps(depth + p, _mm256_castps_si256(nearer), z);
+        for (int i=0;  i<8;  i++)
+            if (bits & (1<<i))
+                visible[p + i] = &t; }
+    return count;
+}
+#endif
+
+void Rasterizer::RasterBin(const int bin)
+{
+    const int bx0 = (bin%binsX)*BIN, by0 = (bin/binsX)*BIN;
+    const int bx1 = std::min(bx0+BIN, width)-1, by1 = std::min(by0+BIN, height)-1;
+    for (int y=by0;  y<=by1;  y++) {
+        std::fill(&depth[y*width + bx0], &depth[y*width + bx1] + 1, 1.0f);
+        std::fill(&visible[y*width + bx0], &visible[y*width + bx1] + 1, (const Triangle*)NULL); }
+
+    long long count = 0;
+    for (size_t b=0;  b<batches.size();  b++) {
+        const Batch& batch = batches[b];
+        for (int i=batch.binStart[bin];  i<batch.binStart[bin+1];  i++)
+            count += RasterTriangle(batch.triangles[batch.binned[i]], bx0, by0, bx1, by1); }
+    binFragments[bin] = count;
+}
+
+int Rasterizer::RasterTriangle(const Triangle& t, const int bx0, const int by0, const int bx1, const int by1)
+{
+    const int x0 = std::max(t.x0, bx0), x1 = std::min(t.x1, bx1);
+    const int y0 = std::max(t.y0, by0), y1 = std::min(t.y1, by1);
+    if (x0 > x1 || y0 > y1)
+        return 0;
+
+    long long e[3], stepX[3], stepY[3];
+    int bias[3];
+    for (int k=0;  k<3;  k++) {
+        long long dx, dy;
+        EdgeSetup(t, k, dx, dy, bias[k]);
+        e[k] = EdgeAt(t, k, dx, dy, x0, y0) + bias[k];
+        stepX[k] = -dy*SUBPIXEL;
+        stepY[k] = dx*SUBPIXEL; }
+
+    // Tiles are aligned to multiples of TILE, clipped to the bounding box
+    int count = 0;
+    for (int ty=y0 - y0%TILE;  ty<=y1;  ty+=TILE)
+        for (int tx=x0 - x0%TILE;  tx<=x1;  tx+=TILE) {
+            const int cx = std::max(tx, x0), cy = std::max(ty, y0);
+            const int nx = std::min(tx+TILE-1, x1) - cx + 1, ny = std::min(ty+TILE-1, y1) - cy + 1;
+
+            // Each edge's extremes over the tile decide whether it
+            // rejects the tile, covers it, or must be tested per pixel.
+            long long te[3], sx[3], sy[3];
+            bool reject = false, lanes = simd;
+            for (int k=0;  k<3 && !reject;  k++) {
+                te[k] = e[k] + (cx - x0)*stepX[k] + (cy - y0)*stepY[k];
+                const long long spanX = stepX[k]*(nx-1), spanY = stepY[k]*(ny-1);
+                const long long lo = te[k] + std::min(spanX, 0LL) + std::min(spanY, 0LL);
+                const long long hi = te[k] + std::max(spanX, 0LL) + std::max(spanY, 0LL);
+                if (hi < 0)
+                    reject = true;
+                else if (lo >= 0)
+                    te[k] = sx[k] = sy[k] = 0;
+                else {
+                    sx[k] = nx > 1 ? stepX[k] : 0;
+                    sy[k] = ny > 1 ? stepY[k] : 0;
+                    if (hi >= LANE_LIMIT || -lo >= LANE_LIMIT)
+                        lanes = false; } }
+            if (reject)
+                continue;
+#ifdef RASTER_AVX2
+            if (lanes) {
+                const int e32[3] = { (int)te[0], (int)te[1], (int)te[2] };
+                const int sx32[3] = { (int)sx[0], (int)sx[1], (int)sx[2] };
+                const int sy32[3] = { (int)sy[0], (int)sy[1], (int)sy[2] };
+                count += TileAvx2(t, &depth[0], &visible[0], width, cx, cy, nx, ny, e32, sx32, sy32);
+                continue; }
+#endif
+            count += TileScalar(t, &depth[0], &visible[0], width, cx, cy, nx, ny, te, sx, sy); }
+    return count;
+}
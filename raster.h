@@ -0,0 +1,123 @@
+////////////////////////////////////////////////////////////////////////
+// A tiled, multithreaded triangle rasterizer for the CPU, used by the
+// emulator and for occlusion culling.
+//
+// The Rasterizer knows nothing of the scene or of OpenGL: it takes
+// clip space vertex positions and triangles (a Shape's Tri, with the
+// Pnt transformed by the caller), and produces a depth buffer and,
+// per pixel, the nearest triangle.  From that, Interpolants gives the
+// perspective correct barycentrics of the triangle's own three
+// vertices, and their screen space derivatives, so the caller
+// interpolates whatever attributes it likes (after the fact, for
+// visible pixels only).  Clipping is invisible to the caller: the
+// barycentrics of a clipped triangle's pieces are those of the
+// original triangle.
+//
+// A frame is drawn in two parallel phases:
+//   Setup and binning, in batches of triangles: clipping to the near
+//   and far planes (and a wide guard band), setup in 24.8 fixed point
+//   with face culling, and binning into bins of 8x8 tiles, skipping
+//   bins that the triangle's edges miss.  Each batch sorts its own
+//   triangles by bin.
+//   Rasterization, one bin per task: the triangles of each batch
+//   overlapping the bin, in submission order, are tested against
+//   each 8x8 tile of pixels in the bin: tiles outside an edge are
+//   rejected, and edges with the whole tile inside are dropped.  The
+//   rest is evaluated 8 pixels at a time with AVX2 (when the CPU has
+//   it), followed by the depth test.
+// Triangles reach each pixel in submission order, so the result does
+// not depend on the thread count, nor on whether AVX2 is used.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _RASTER_
+#define _RASTER_
+
+#include <vector>
+
+class Rasterizer
+{
+public:
+    enum Cull { CULL_NONE, CULL_BACK, CULL_FRONT };
+
+    // A triangle after clipping and setup, in 24.8 fixed point window
+    // coordinates, counterclockwise.  Its planes are functions of the
+    // pixel (x, y): value + dx*(x-x0) + dy*(y-y0).
+    struct Triangle
+    {
+        int draw, prim;         // Index of the Draw call, and into its triangles
+        long long x[3], y[3];
+        int x0, y0, x1, y1;     // Covered pixels, inclusive, within the viewport
+        float z, zx, zy;        // Window depth
+        glm::vec4 p, px, py;    // The original barycentrics over w, and 1/w
+
+        // The original triangle's perspective correct barycentrics at
+        // the center of pixel (x, y), and their derivatives in x and y.
+        void Interpolants(const int x, const int y, glm::vec3& b, glm::vec3& dbdx, glm::vec3& dbdy) const;
+
+        // Clip space w at the center of pixel (x, y)
+        float W(const int x, const int y) const { return 1.0f/(p.w + (float)(x - x0)*px.w + (float)(y - y0)*py.w); }
+    };
+
+    int width, height;
+    std::vector<float> depth;                   // Window z of the nearest triangle, bottom row first
+    std::vector<const Triangle*> visible;       // The nearest triangle (until the next Flush), or NULL
+
+    bool simd;                  // Use AVX2; initially true if the CPU has it
+
+    // Statistics of the last frame
+    long long trianglesIn, trianglesDrawn;      // Submitted, and left after clipping and culling
+    long long fragments;                        // Pixels covered, before the depth test
+
+    Rasterizer();
+
+    // Start a frame of the given size; nothing is drawn until Flush.
+    void Begin(const int width, const int height);
+
+    // Queue count triangles, each three indices into the positions at
+    // clip (stride bytes apart).  Counterclockwise triangles face
+    // front.  The arrays must stay valid until Flush.  Returns the
+    // draw's index, as it appears in Triangle::draw.
+    int Draw(const glm::vec4* clip, const int stride, const glm::ivec3* tris, const int count,
+             const Cull cull=CULL_NONE);
+
+    // Clear depth to 1 and visible to NULL, and draw everything queued.
+    void Flush();
+
+private:
+    struct DrawCall
+    {
+        const glm::vec4* clip;
+        int stride;
+        const glm::ivec3* tris;
+        int count;
+        Cull cull;
+    };
+
+    // One task of the setup stage: a range of one draw's triangles,
+    // and afterwards their indices sorted by bin.
+    struct Batch
+    {
+        int draw, first, last;
+        std::vector<Triangle> triangles;
+        std::vector<int> binStart;      // Per bin, into binned; one extra at the end
+        std::vector<int> binned;
+    };
+
+    std::vector<DrawCall> draws;
+    std::vector<Batch> batches;
+    int binsX, binsY;
+    std::vector<long long> binFragments;
+
+    const glm::vec4& Position(const DrawCall& d, const int i) const
+    {
+        return *(const glm::vec4*)((const char*)d.clip + (size_t)i*d.stride);
+    }
+
+    void SetupBatch(Batch& batch);
+    void SetupTriangle(Batch& batch, const int prim, const glm::vec4* clip, const glm::vec3* bary);
+    void BinBatch(Batch& batch);
+    void RasterBin(const int bin);
+    int RasterTriangle(const Triangle& t, const int bx0, const int by0, const int bx1, const int by1);
+};
+
+#endif
@@ -5,7 +5,9 @@
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
-uniform mat4 ModelTr;
+// The uniform blocks of ubo.h are declared ahead of this source by
+// ShaderProgram::AddShader.
+
 uniform vec3 eyePos;
 uniform int pass;
 
@@ -20,7 +22,7 @@ void main()
 {
     // Eye position is center of teapot
 
-    vec4 WorldPoint = ModelTr*vertex;
+    vec4 WorldPoint = INSTANCE_MODEL_TR(gl_InstanceID)*vertex;
 
     vec3 R = WorldPoint.xyz - eyePos;
     float a = R.x;
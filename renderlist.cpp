@@ -0,0 +1,268 @@
+////////////////////////////////////////////////////////////////////////
+// The Object hierarchy, flattened for drawing.  See renderlist.h for
+// an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include "math.h"
+#include <stdlib.h>
+#include <algorithm>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "framework.h"
+#include "object.h"
+#include "occlusion.h"
+#include "frustum.h"
+#include "renderlist.h"
+#include "trace.h"
+
+void RenderList::Compile(const Object* root)
+{
+    TRACE_SCOPE("RenderList::Compile");
+    batches.clear();
+    objects.clear();
+    batchOf.clear();
+    instances.clear();
+    modelTrs.clear();
+    inverseTrs.clear();
+    parents.clear();
+    slots.clear();
+    ends.clear();
+    locals.clear();
+    anims.clear();
+    dirty.clear();
+    lo.clear();
+    hi.clear();
+    Add(root, -1, -1, glm::mat4(1.0f));
+
+    boxed.clear();
+    for (size_t i=0;  i<objects.size();  i++)
+        if (objects[i]->shape)
+            boxed.push_back((int)i);
+    boxLo.resize(boxed.size());
+    boxHi.resize(boxed.size());
+    for (size_t k=0;  k<boxed.size();  k++) {
+        boxLo[k] = lo[boxed[k]];
+        boxHi[k] = hi[boxed[k]]; }
+    bvh.Build(boxLo, boxHi, 1);
+}
+
+void RenderList::Add(const Object* object, const int parent, const int slot, const glm::mat4& local)
+{
+    const int i = (int)objects.size();
+    objects.push_back(object);
+    batchOf.push_back(object->shape ? FindBatch(object) : -1);
+    parents.push_back(parent);
+    slots.push_back(slot);
+    ends.push_back(i + 1);
+    locals.push_back(local);
+    anims.push_back(object->animTr);
+    dirty.push_back(0);
+    lo.push_back(glm::vec3(0.0f));
+    hi.push_back(glm::vec3(0.0f));
+
+    // @@ The object specific parameters used by the shader are set
+    // here, in a DrawInstance uploaded in the ObjectBlock of the draw
+    // that includes it.  Scene specific parameters are set in the
+    // DrawScene procedure in scene.cpp
+
+    // The surface values Kd, Ks, and alpha, and which object is being
+    // drawn so the shader can make object specific decisions.
+    DrawInstance instance;
+    instance.diffuse = object->diffuseColor;
+    instance.specular = object->specularColor;
+    instance.shininess = object->shininess;
+    instance.objectId = object->objectId;
+    instances.push_back(instance);
+    modelTrs.push_back(glm::mat4(1.0f));
+    inverseTrs.push_back(glm::mat4(1.0f));
+    SetTransform(i);
+
+    for (size_t c=0;  c<object->instances.size();  c++)
+        Add(object->instances[c].first, i, (int)c, object->instances[c].second);
+    ends[i] = (int)objects.size();
+}
+
+// The batch for an object's shape and texture state, added if new.
+int RenderList::FindBatch(const Object* object)
+{
+    for (size_t b=0;  b<batches.size();  b++) {
+        const Batch& batch = batches[b];
+        if (batch.shape == object->shape && batch.texture == object->texture
+            && batch.normalTex == object->normalTex && batch.textureTransform == object->textureTransform
+            && batch.reflective == object->reflective)
+            return (int)b; }
+
+    Batch batch;
+    batch.shape = object->shape;
+    batch.texture = object->texture;
+    batch.normalTex = object->normalTex;
+    batch.textureTransform = object->textureTransform;
+    batch.reflective = object->reflective;
+    batches.push_back(batch);
+    return (int)batches.size() - 1;
+}
+
+// The model transformation, from the parent's, and its inverse, needed
+// for transforming normals, and both packed for the shaders.  The world bounds are those of the Shape's
+// box transformed, from its center and the absolute values of the
+// transformation applied to its half extent.
+void RenderList::SetTransform(const int i)
+{
+    const int p = parents[i];
+    const glm::mat4& M = modelTrs[i] = p < 0 ? locals[i] : modelTrs[p]*locals[i]*anims[p];
+    inverseTrs[i] = glm::inverse(M);
+    for (int k=0;  k<3;  k++) {
+        instances[i].ModelTr[k] = glm::vec4(M[0][k], M[1][k], M[2][k], M[3][k]);
+        instances[i].NormalTr[k] = glm::vec4(glm::vec3(inverseTrs[i][k]), 0.0f); }
+
+    const Shape* shape = objects[i]->shape;
+    if (!shape)
+        return;
+    const glm::vec3 c = (M*glm::vec4(0.5f*(shape->minP + shape->maxP), 1.0f)).xyz();
+    const glm::vec3 e = 0.5f*(shape->maxP - shape->minP);
+    glm::vec3 r;
+    for (int k=0;  k<3;  k++)
+        r[k] = fabsf(M[0][k])*e.x + fabsf(M[1][k])*e.y + fabsf(M[2][k])*e.z;
+    lo[i] = c - r;
+    hi[i] = c + r;
+}
+
+void RenderList::Update()
+{
+    TRACE_SCOPE("RenderList::Update");
+    updated = 0;
+    bool refit = false;
+    for (size_t i=0;  i<objects.size();  i++) {
+        const int p = parents[i];
+        const bool moved = p >= 0 && dirty[p];
+        if (moved) {
+            SetTransform((int)i);
+            refit |= objects[i]->shape != NULL;
+            updated++; }
+        const bool animated = objects[i]->animTr != anims[i];
+        if (animated)
+            anims[i] = objects[i]->animTr;
+        dirty[i] = moved || animated; }
+
+    if (refit) {
+        for (size_t k=0;  k<boxed.size();  k++) {
+            boxLo[k] = lo[boxed[k]];
+            boxHi[k] = hi[boxed[k]]; }
+        bvh.Refit(boxLo, boxHi); }
+}
+
+// Mark the entries whose bounds may reach into the frustum.  A node
+// entirely inside accepts its subtree without further tests: its
+// primitives are contiguous in leaf order, from those of its leftmost
+// leaf to those of its rightmost.
+void RenderList::Cull(const Frustum& frustum)
+{
+    TRACE_SCOPE("RenderList::Cull");
+    inside.assign(objects.size(), 0);
+    culled = (int)boxed.size();
+    if (bvh.Empty())
+        return;
+
+    int stack[64], top = 0;
+    stack[top++] = 0;
+    while (top) {
+        const int node = stack[--top];
+        const Bvh::Node& n = bvh.nodes[node];
+        const Frustum::Side side = frustum.Test(n.lo, n.hi);
+        if (side == Frustum::OUTSIDE)
+            continue;
+        if (side == Frustum::PARTIAL && !n.count) {
+            stack[top++] = n.index;
+            stack[top++] = node + 1;
+            continue; }
+
+        int first = node, last = node;
+        while (!bvh.nodes[first].count)
+            first++;
+        while (!bvh.nodes[last].count)
+            last = bvh.nodes[last].index;
+        const int end = bvh.nodes[last].index + bvh.nodes[last].count;
+        for (int k=bvh.nodes[first].index;  k<end;  k++)
+            inside[boxed[bvh.indices[k]]] = 1;
+        culled -= end - bvh.nodes[first].index; }
+}
+
+void RenderList::Drawn(std::vector<int>& entries) const
+{
+    entries.clear();
+    int i = 0;
+    while (i < (int)objects.size()) {
+        if (!objects[i]->drawMe) {
+            i = ends[i];        // Nor its descendants
+            continue; }
+        if (batchOf[i] >= 0)
+            entries.push_back(i);
+        i++; }
+}
+
+void RenderList::Draw(ShaderProgram* program, UniformRing* objectBlocks, const Frustum* frustum,
+                      OcclusionCuller* culler)
+{
+    TRACE_SCOPE("RenderList::Draw");
+
+    culled = 0;
+    if (frustum)
+        Cull(*frustum);
+
+    // Gather the entries to draw, counting each batch's
+    Drawn(drawn);
+    batchStart.assign(batches.size() + 1, 0);
+    size_t kept = 0;
+    for (size_t d=0;  d<drawn.size();  d++) {
+        const int i = drawn[d];
+        if ((!frustum || inside[i]) && (!culler || culler->Visible(objects[i], modelTrs[i]))) {
+            drawn[kept++] = i;
+            batchStart[batchOf[i] + 1]++; } }
+    drawn.resize(kept);
+
+    // and sort them by batch, keeping their order within each.
+    for (size_t b=0;  b<batches.size();  b++)
+        batchStart[b + 1] += batchStart[b];
+    batchNext.assign(batchStart.begin(), batchStart.end() - 1);
+    sorted.resize(drawn.size());
+    for (size_t d=0;  d<drawn.size();  d++)
+        sorted[batchNext[batchOf[drawn[d]]]++] = drawn[d];
+
+    draws = 0;
+    for (size_t b=0;  b<batches.size();  b++) {
+        const Batch& batch = batches[b];
+        if (batchStart[b] == batchStart[b + 1])
+            continue;
+
+        // @@ Textures, being uniform sampler2d variables in the
+        // shader, are set here.  See Texture::Bind for the lines of
+        // code to do exactly that.
+        if (batch.texture)
+            batch.texture->Bind(5, program, ShaderProgram::textureMap);
+        if (batch.normalTex)
+            batch.normalTex->Bind(6, program, ShaderProgram::normalMap);
+
+        block.TextureTr = batch.textureTransform;
+        block.Reflective = batch.reflective;
+        // A batch larger than MAX_INSTANCES (none in this scene) takes
+        // more than one draw.
+        for (int first=batchStart[b];  first<batchStart[b + 1];  first+=MAX_INSTANCES) {
+            const int count = std::min(MAX_INSTANCES, batchStart[b + 1] - first);
+            for (int k=0;  k<count;  k++)
+                block.instances[k] = instances[sorted[first + k]];
+            objectBlocks->Push(&block, ObjectBlock::Size(count));
+            batch.shape->DrawVAO(count);
+            draws++; }
+
+        if (batch.texture)
+            batch.texture->Unbind();
+        if (batch.normalTex)
+            batch.normalTex->Unbind(); }
+}
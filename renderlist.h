@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////
+// The Object hierarchy, flattened for drawing.
+//
+// Compile walks the hierarchy once, as Object::Draw used to each pass,
+// and lists every instance (an Object reached along one path from the
+// root) depth first, in parallel arrays: parents precede their
+// descendants, and each entry records the end of its subtree.  Each
+// entry's DrawInstance (see ubo.h) holds its world and normal
+// transformations and its colors, ready to upload.
+//
+// Entries that differ in nothing else (the same Shape, textures,
+// texture transformation and reflectivity) share a batch, and are
+// drawn together with glDrawElementsInstanced, up to MAX_INSTANCES at
+// a time.  So the 120 spheres of SphereOfSpheres take one draw per
+// pass, as do the four boards of both picture frames.
+//
+// Update, once per frame, recomputes transformations only where they
+// may have changed: below an object whose animTr differs from the
+// last frame's, or whose own transformation was recomputed.  Each
+// pass then walks the list in order, skipping the subtree of any
+// object with drawMe false, gathers the entries to draw by batch,
+// and draws the batches.  Compile again after changing the
+// hierarchy, the instance transformations, or the materials.
+//
+// Each entry with a Shape also has world space bounds (the Shape's
+// minP and maxP through its ModelTr), held in a Bvh that Update
+// refits when anything moves.  Given a Frustum, Draw first walks the
+// Bvh to mark the entries that may be in it, and draws only those.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _RENDERLIST_
+#define _RENDERLIST_
+
+#include <vector>
+
+#include "ubo.h"
+#include "bvh.h"
+
+class Object;
+class Shape;
+class ShaderProgram;
+class OcclusionCuller;
+class Frustum;
+class Texture;
+
+class RenderList
+{
+public:
+    // What the entries of a batch have in common
+    struct Batch
+    {
+        Shape* shape;
+        Texture* texture;
+        Texture* normalTex;
+        glm::mat4 textureTransform;
+        bool reflective;
+    };
+    std::vector<Batch> batches;
+
+    // Per entry
+    std::vector<const Object*> objects;
+    std::vector<int> batchOf;           // Index into batches, or -1 for grouping nodes
+    std::vector<DrawInstance> instances;
+    std::vector<glm::mat4> modelTrs;    // World transformation (packed into instances)
+    std::vector<glm::mat4> inverseTrs;  // and its inverse
+    std::vector<int> parents;           // -1 for the root
+    std::vector<int> slots;             // Index into the parent's Object::instances, or -1
+    std::vector<int> ends;              // One past the last descendant
+    std::vector<glm::mat4> locals;      // The transformation in the parent's instance list
+    std::vector<glm::mat4> anims;       // The object's animTr at the last Update
+    std::vector<unsigned char> dirty;   // Whether descendants need recomputing
+    std::vector<glm::vec3> lo, hi;      // World bounds, of entries with a Shape
+
+    // The entries with a Shape, and a hierarchy of their bounds
+    std::vector<int> boxed;
+    Bvh bvh;
+
+    int updated;                        // Entries recomputed by the last Update
+    int draws;                          // Draw calls made by the last Draw
+    int culled;                         // Entries outside the last Draw's frustum
+
+    RenderList() : updated(0), draws(0), culled(0) {}
+
+    void Compile(const Object* root);
+    void Update();
+
+    // The entries with a Shape that are drawn, in list order: all but
+    // those in the subtree of an object with drawMe false.  The
+    // passes, the emulator, the occlusion culler and SceneBvh all
+    // take their instances from here.
+    void Drawn(std::vector<int>& entries) const;
+
+    // Draw the list with a program in use, pushing each draw's block
+    // into objectBlocks.  With a frustum, entries whose bounds lie
+    // outside it are not drawn, and with a culler, neither are entries
+    // it finds hidden (their descendants still may be).
+    void Draw(ShaderProgram* program, UniformRing* objectBlocks, const Frustum* frustum=NULL,
+              OcclusionCuller* culler=NULL);
+
+private:
+    // Draw's scratch space: the entries to draw, in list order and by
+    // batch, where batch b's are sorted[batchStart[b], batchStart[b+1])
+    std::vector<int> drawn, sorted, batchStart, batchNext;
+    std::vector<unsigned char> inside;  // Per entry, from Cull
+    std::vector<glm::vec3> boxLo, boxHi;    // Per boxed entry, for the Bvh
+    ObjectBlock block;
+
+    void Add(const Object* object, const int parent, const int slot, const glm::mat4& local);
+    int FindBatch(const Object* object);
+    void SetTransform(const int i);
+    void Cull(const Frustum& frustum);
+};
+
+#endif
@@ -17,6 +17,8 @@ const bool fullPolyCount = true; // Use false when emulating the graphics pipeli
 #include "math.h"
 #include <iostream>
 #include <stdlib.h>
+#include <chrono>
+#include <float.h>
 
 #include <glbinding/gl/gl.h>
 #include <glbinding/Binding.h>
@@ -34,6 +36,7 @@ using namespace gl;
 #include "object.h"
 #include "texture.h"
 #include "transform.h"
+#include "trace.h"
 
 const float PI = 3.14159f;
 const float rad = PI/180.0f;    // Convert degrees to radians
@@ -53,7 +56,15 @@ const float grndHigh = 5.0;        // Highest extent above sea level
 // careful programmer will check the error status *often*, perhaps as
 // often as after every OpenGL call.  At the very least, once per
 // refresh will tell you if something is going wrong.
-#define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line scene.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+#define CHECKERROR {GLenum err = hasGL ? glGetError() : GL_NO_ERROR; if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line scene.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
+
+// Seconds from a steady clock started at the first call.  (Not glfw's,
+// which does not run without a window.)
+static double Clock()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
 // Create an RGB color from human friendly parameters: hue, saturation, value
 glm::vec3 HSV2RGB(const float h, const float s, const float v)
@@ -125,7 +136,9 @@ Object* FramedPicture(const glm::mat4& modelTr, const int objectId,
 // number of other parameters.
 void Scene::InitializeScene()
 {
-    glEnable(GL_DEPTH_TEST);
+    TRACE_SCOPE("InitializeScene");
+    if (hasGL)
+        glEnable(GL_DEPTH_TEST);
     CHECKERROR;
 
     // @@ Initialize interactive viewing variables here. (spin, tilt, ry, front back, ...)
@@ -144,9 +157,10 @@ void Scene::InitializeScene()
     transformationMode = true;
     dir = glm::vec2(0.0f, 0.0f);
 
-    frameStartTime = glfwGetTime();
-    frameEndTime = glfwGetTime();
-    frameTime = glfwGetTime();
+    frameStartTime = Clock();
+    frameEndTime = Clock();
+    frameTime = Clock();
+    fixedTime = -1.0;
     
     // Set initial light parameters
     lightSpin = 150.0;
@@ -159,58 +173,64 @@ void Scene::InitializeScene()
     CHECKERROR;
     objectRoot = new Object(NULL, nullId);
     
-    // Enable OpenGL depth-testing
-    glEnable(GL_DEPTH_TEST);
-
-    // Create the lighting shader program from source code files.
-    // @@ Initialize additional shaders if necessary
-    lightingProgram = new ShaderProgram();
-    lightingProgram->AddShader("final.vert", GL_VERTEX_SHADER);
-    lightingProgram->AddShader("final.frag", GL_FRAGMENT_SHADER);
-    lightingProgram->AddShader("lighting.vert", GL_VERTEX_SHADER);
-    lightingProgram->AddShader("lighting.frag", GL_FRAGMENT_SHADER);
-
-    glBindAttribLocation(lightingProgram->programId, 0, "vertex");
-    glBindAttribLocation(lightingProgram->programId, 1, "vertexNormal");
-    glBindAttribLocation(lightingProgram->programId, 2, "vertexTexture");
-    glBindAttribLocation(lightingProgram->programId, 3, "vertexTangent");
-    lightingProgram->LinkProgram();
-
-    // Shadows
-    shadowProgram = new ShaderProgram();
-    shadowProgram->AddShader("shadow.vert", GL_VERTEX_SHADER);
-    shadowProgram->AddShader("shadow.frag", GL_FRAGMENT_SHADER);
-    //shadowProgram->AddShader("lighting.vert", GL_VERTEX_SHADER);
-    //shadowProgram->AddShader("lighting.frag", GL_FRAGMENT_SHADER);
-
-    glBindAttribLocation(shadowProgram->programId, 0, "vertex");
-    glBindAttribLocation(shadowProgram->programId, 1, "vertexNormal");
-    glBindAttribLocation(shadowProgram->programId, 2, "vertexTexture");
-    glBindAttribLocation(shadowProgram->programId, 3, "vertexTangent");
-    shadowProgram->LinkProgram();
-
-    fboShadows = new FBO();
-    fboShadows->CreateFBO(1024, 1024);
-
-    // Reflection (top)
-    reflectionProgram = new ShaderProgram();
-    reflectionProgram->AddShader("reflection.vert", GL_VERTEX_SHADER);
-    reflectionProgram->AddShader("reflection.frag", GL_FRAGMENT_SHADER);
-    reflectionProgram->AddShader("lighting.vert", GL_VERTEX_SHADER);
-    reflectionProgram->AddShader("lighting.frag", GL_FRAGMENT_SHADER);
-
-    glBindAttribLocation(shadowProgram->programId, 0, "vertex");
-    glBindAttribLocation(shadowProgram->programId, 1, "vertexNormal");
-    glBindAttribLocation(shadowProgram->programId, 2, "vertexTexture");
-    glBindAttribLocation(shadowProgram->programId, 3, "vertexTangent");
-    reflectionProgram->LinkProgram();
-
-    fboReflectionTop = new FBO();
-    fboReflectionTop->CreateFBO(1024, 1024);
-
-    fboReflectionBottom = new FBO();
-    fboReflectionBottom->CreateFBO(1024, 1024);
-    
+    // With no OpenGL (software only), the emulator needs none of the
+    // shader programs or FBOs.
+    if (hasGL) {
+        // Enable OpenGL depth-testing
+        glEnable(GL_DEPTH_TEST);
+
+        // Create the lighting shader program from source code files.
+        // @@ Initialize additional shaders if necessary
+        lightingProgram = new ShaderProgram();
+        lightingProgram->AddShader("final.vert", GL_VERTEX_SHADER);
+        lightingProgram->AddShader("final.frag", GL_FRAGMENT_SHADER);
+        lightingProgram->AddShader("lighting.vert", GL_VERTEX_SHADER);
+        lightingProgram->AddShader("lighting.frag", GL_FRAGMENT_SHADER);
+
+        glBindAttribLocation(lightingProgram->programId, 0, "vertex");
+        glBindAttribLocation(lightingProgram->programId, 1, "vertexNormal");
+        glBindAttribLocation(lightingProgram->programId, 2, "vertexTexture");
+        glBindAttribLocation(lightingProgram->programId, 3, "vertexTangent");
+        lightingProgram->LinkProgram();
+
+        // Shadows
+        shadowProgram = new ShaderProgram();
+        shadowProgram->AddShader("shadow.vert", GL_VERTEX_SHADER);
+        shadowProgram->AddShader("shadow.frag", GL_FRAGMENT_SHADER);
+        //shadowProgram->AddShader("lighting.vert", GL_VERTEX_SHADER);
+        //shadowProgram->AddShader("lighting.frag", GL_FRAGMENT_SHADER);
+
+        glBindAttribLocation(shadowProgram->programId, 0, "vertex");
+        glBindAttribLocation(shadowProgram->programId, 1, "vertexNormal");
+        glBindAttribLocation(shadowProgram->programId, 2, "vertexTexture");
+        glBindAttribLocation(shadowProgram->programId, 3, "vertexTangent");
+        shadowProgram->LinkProgram();
+
+        fboShadows = new FBO();
+        fboShadows->CreateFBO(1024, 1024);
+
+        // Reflection (top)
+        reflectionProgram = new ShaderProgram();
+        reflectionProgram->AddShader("reflection.vert", GL_VERTEX_SHADER);
+        reflectionProgram->AddShader("reflection.frag", GL_FRAGMENT_SHADER);
+        reflectionProgram->AddShader("lighting.vert", GL_VERTEX_SHADER);
+        reflectionProgram->AddShader("lighting.frag", GL_FRAGMENT_SHADER);
+
+        glBindAttribLocation(shadowProgram->programId, 0, "vertex");
+        glBindAttribLocation(shadowProgram->programId, 1, "vertexNormal");
+        glBindAttribLocation(shadowProgram->programId, 2, "vertexTexture");
+        glBindAttribLocation(shadowProgram->programId, 3, "vertexTangent");
+        reflectionProgram->LinkProgram();
+
+        fboReflectionTop = new FBO();
+        fboReflectionTop->CreateFBO(1024, 1024);
+
+        fboReflectionBottom = new FBO();
+        fboReflectionBottom->CreateFBO(1024, 1024);
+
+        frameBlock.Create(sizeof(FrameBlock), FRAME_BINDING);
+        objectBlocks.Create(sizeof(ObjectBlock), 4 << 20, OBJECT_BINDING); }
+
     // Create all the Polygon shapes
     proceduralground = new ProceduralGround(grndSize, 400,
                                      grndOctaves, grndFreq, grndPersistence,
@@ -259,8 +279,32 @@ void Scene::InitializeScene()
     texTeapotNormal = new Texture(".\\textures\\162_norm.jpg");
     texWaterNormal = new Texture(".\\textures\\ripple2.jpg");
     texFrame2 = new Texture(".\\textures\\my-house-01.png");
-    texSky = new Texture(".\\textures\\14-Hamarikyu_Bridge_B_3k.hdr");
-    texSkyIrr = new Texture(".\\textures\\14-Hamarikyu_Bridge_B_3k-irradiance.hdr");
+    const std::string skyName = ".\\textures\\14-Hamarikyu_Bridge_B_3k";
+    skyFile = skyName + ".hdr";
+    texSky = new Texture(skyFile);
+
+    // The irradiance map written by filter-aseem.  If there is none
+    // yet, it is computed in the background (and saved), and a flat
+    // grey stands in until DrawScene swaps it in.
+    const std::string irrName = skyName + "-irradiance.hdr";
+    if (FILE* fp = fopen(irrName.c_str(), "rb")) {
+        fclose(fp);
+        texSkyIrr = new Texture(irrName); }
+    else {
+        texSkyIrr = new Texture(std::vector<float>(3, 0.5f), 1, 1);
+        irrTask.Start(skyName + ".hdr", irrName); }
+
+    // The GGX prefiltered specular chain written by "filter-aseem -specular", if present.
+    std::vector<std::string> specFiles;
+    for (int i=0;  ;  i++) {
+        char name[256];
+        sprintf(name, "%s-specular%d.hdr", skyName.c_str(), i);
+        FILE* fp = fopen(name, "rb");
+        if (!fp) break;
+        fclose(fp);
+        specFiles.push_back(name); }
+    texSkySpec = specFiles.size() > 1 ? new Texture(specFiles) : NULL;
+    skySpecLevels = texSkySpec ? (int)specFiles.size() : 0;
 
     // @@ To change an object's surface parameters (Kd, Ks, or alpha),
     // modify the following lines.
@@ -316,14 +360,59 @@ void Scene::InitializeScene()
         room->add(leftFrame, Translate(-1.5, 9.85, 1.)*Scale(0.8, 0.8, 0.8));
         room->add(rightFrame, Translate( 1.5, 9.85, 1.)*Scale(0.8, 0.8, 0.8)); }
 
+    // Occluders for the lighting pass.  The terrain, with far too many
+    // triangles to rasterize every frame, stands in as a coarse mesh
+    // lying below it.
+    occlusion.AddOccluder(room);
+    occlusion.AddOccluder(podium);
+    std::vector<glm::vec4> occluderPnt;
+    std::vector<glm::ivec3> occluderTri;
+    proceduralground->OccluderMesh(50, occluderPnt, occluderTri);
+    occlusion.AddOccluder(ground, occluderPnt, occluderTri);
+
     CHECKERROR;
 
     // Options menu stuff
     show_demo_window = false;
+    frustumCulling = true;
+    for (int p=0;  p<4;  p++)
+        frustumCulled[p] = 0;
+
+    // Flatten the hierarchy for drawing.
+    renderList.Compile(objectRoot);
+
+    // The per-Shape half of the picking hierarchy, built once up
+    // front so that picking itself stays fast.
+    double start = Clock();
+    bvh.Build(renderList);
+    printf("BVH of %d instances built in %.2f s\n", (int)bvh.instances.size(), Clock() - start);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Cast a ray from the eye through a window position (in GLFW's screen
+// coordinates, origin at the top left) and find the nearest object it
+// hits.  The instance level of the BVH is rebuilt first, from the
+// render list as the last frame drew it.  Returns NULL if nothing is hit.
+const SceneBvh::Instance* Scene::Pick(const double x, const double y, RayHit& hit)
+{
+    int w = width, h = height;
+    if (hasGL && window)
+        glfwGetWindowSize(window, &w, &h);
+    const float nx = 2.0f*(float)x/w - 1.0f;
+    const float ny = 1.0f - 2.0f*(float)y/h;
+    const glm::mat4 inverseViewProj = glm::inverse(WorldProj*WorldView);
+    const glm::vec4 a = inverseViewProj*glm::vec4(nx, ny, -1.0f, 1.0f);
+    const glm::vec4 b = inverseViewProj*glm::vec4(nx, ny, 1.0f, 1.0f);
+    const glm::vec3 o = a.xyz()/a.w;
+    const glm::vec3 d = glm::normalize(b.xyz()/b.w - o);
+
+    bvh.Build(renderList);
+    return bvh.Intersect(o, d, FLT_MAX, hit) ? &bvh.instances[hit.instance] : NULL;
 }
 
 void Scene::DrawMenu()
 {
+    ProfileScope scope(profiler, "menu");
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -351,8 +440,48 @@ void Scene::DrawMenu()
             if (ImGui::MenuItem("Enable", "", shadows == 0)) { shadows = 0; }
             if (ImGui::MenuItem("Disable", "", shadows == 1)) { shadows = 1; }
             ImGui::EndMenu(); }
+
+        if (ImGui::BeginMenu("Culling")) {
+            if (ImGui::MenuItem("Occlusion culling", "", occlusion.enabled)) { occlusion.enabled ^= true; }
+            if (occlusion.enabled) {
+                char stats[128];
+                sprintf(stats, "%d of %d objects culled", occlusion.culled, occlusion.tested);
+                ImGui::MenuItem(stats, "", false, false);
+                sprintf(stats, "%d occluder triangles in %.2f ms", occlusion.occluderTriangles,
+                        1000*occlusion.rasterTime);
+                ImGui::MenuItem(stats, "", false, false); }
+            if (ImGui::MenuItem("Frustum culling", "", frustumCulling)) { frustumCulling ^= true; }
+            if (frustumCulling) {
+                char stats[128];
+                sprintf(stats, "Shadow %d, reflections %d/%d, lighting %d of %d culled", frustumCulled[0],
+                        frustumCulled[1], frustumCulled[2], frustumCulled[3], (int)renderList.boxed.size());
+                ImGui::MenuItem(stats, "", false, false); }
+            ImGui::EndMenu(); }
+
+#ifdef EM
+        if (ImGui::BeginMenu("Emulator")) {
+            if (ImGui::MenuItem("Render in software", "", emulate)) { emulate ^= true; }
+            if (emulate) {
+                char stats[128];
+                sprintf(stats, "%d of %d triangles drawn", emulator.trianglesDrawn, emulator.trianglesIn);
+                ImGui::MenuItem(stats, "", false, false);
+                sprintf(stats, "Shadow %.1f ms, lighting %.1f ms", 1000*emulator.shadowTime, 1000*emulator.lightingTime);
+                ImGui::MenuItem(stats, "", false, false); }
+            ImGui::EndMenu(); }
+#endif
+        
+        if (ImGui::BeginMenu("Profiler")) {
+            if (ImGui::MenuItem("Show pass timings", "", profiler.enabled)) { profiler.enabled ^= true; }
+            if (ImGui::MenuItem("Record trace", "", Trace::Recording())) {
+                if (Trace::Recording())
+                    Trace::Stop();
+                else
+                    Trace::Start(); }
+            if (ImGui::MenuItem("Save trace to trace.json")) { Trace::Write("trace.json"); }
+            ImGui::EndMenu(); }
         
         ImGui::EndMainMenuBar(); }
+    profiler.DrawWindow();
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
@@ -384,27 +513,22 @@ void Scene::BuildTransforms()
 }
 
 ////////////////////////////////////////////////////////////////////////
-// Procedure DrawScene is called whenever the scene needs to be
-// drawn. (Which is often: 30 to 60 times per second are the common
-// goals.)
-void Scene::DrawScene()
+// Advance everything that changes from frame to frame (the light,
+// animations, eye motion) and build the frame's transformations.
+void Scene::UpdateFrame()
 {
-    // Set the viewport
-    glfwGetFramebufferSize(window, &width, &height);
-    glViewport(0, 0, width, height);
-
-    CHECKERROR;
+    ProfileScope scope(profiler, "update");
     // Calculate the light's position from lightSpin, lightTilt, lightDist
     lightPos = glm::vec3(lightDist*cos(lightSpin*rad)*sin(lightTilt*rad),
                          lightDist*sin(lightSpin*rad)*sin(lightTilt*rad), 
                          lightDist*cos(lightTilt*rad));
 
     // Update position of any continuously animating objects
-    double atime = 360.0*glfwGetTime()/36;
+    double atime = 360.0*(fixedTime >= 0.0 ? fixedTime : Clock())/36;
     for (std::vector<Object*>::iterator m=animated.begin();  m<animated.end();  m++)
         (*m)->animTr = Rotate(2, atime);
 
-    frameEndTime = glfwGetTime();
+    frameEndTime = Clock();
     frameTime = frameEndTime - frameStartTime;
     frameStartTime = frameEndTime;
 
@@ -420,7 +544,79 @@ void Scene::DrawScene()
 
     // The lighting algorithm needs the inverse of the WorldView matrix
     WorldInverse = glm::inverse(WorldView);
-    
+}
+
+////////////////////////////////////////////////////////////////////////
+// Procedure DrawScene is called whenever the scene needs to be
+// drawn. (Which is often: 30 to 60 times per second are the common
+// goals.)
+void Scene::DrawScene()
+{
+    TRACE_SCOPE("DrawScene");
+    // Set the viewport (with no window, to the size set by the caller)
+    if (hasGL) {
+        if (window)
+            glfwGetFramebufferSize(window, &width, &height);
+        glViewport(0, 0, width, height); }
+
+    // Swap in the irradiance map computed in the background, once ready
+    if (irrTask.Ready()) {
+        delete texSkyIrr;
+        texSkyIrr = new Texture(irrTask.Image(), irrTask.width, irrTask.height);
+        irrTask.Clear(); }
+
+    CHECKERROR;
+    UpdateFrame();
+
+    // Bring the flattened hierarchy's transformations up to date with
+    // this frame's animations, for the emulator as for the passes below.
+    renderList.Update();
+
+#ifdef EM
+    // In software, the emulator does all the passes, and with a window, shows the result.
+    if (emulate) {
+        emulator.DrawScene(*this);
+        if (hasGL)
+            emulator.Blit();
+        return; }
+#endif
+
+    // The occluders are rasterized on another thread during the
+    // shadow and reflection passes.
+    occlusion.Start(renderList, WorldProj*WorldView, width, height);
+
+    // @@ The scene specific parameters shared by all the passes are
+    // written once, into the FrameBlock (see ubo.h and the shaders).
+    FrameBlock frame;
+    frame.WorldProj = WorldProj;
+    frame.WorldView = WorldView;
+    frame.WorldInverse = WorldInverse;
+    frame.LightView = LightView;
+    frame.ShadowMatrix = ShadowMatrix;
+    frame.lightPos = lightPos;
+    frame.lightVal = lightVal;
+    frame.lightAmb = lightAmb;
+    frame.mode = mode;
+    frame.shadows = shadows;
+    frame.specLevels = skySpecLevels;
+    frameBlock.Write(&frame);
+
+    // The volume each pass sees: the light's frustum for shadows, the
+    // eye's for lighting, and for each paraboloid reflection, the
+    // hemisphere above or below the teapot's center, out to the
+    // distance (2000) where the shader's depth reaches 1.
+    const glm::vec3 center = teapot->shape->center;
+    Frustum shadowFrustum = Frustum::FromMatrix(WorldProj*LightView);
+    Frustum lightingFrustum = Frustum::FromMatrix(WorldProj*WorldView);
+    Frustum topFrustum, bottomFrustum;
+    topFrustum.AddPlane(glm::vec3(0, 0, 1), -center.z);
+    topFrustum.AddPlane(glm::vec3(0, 0, -1), center.z + 2000.0f);
+    bottomFrustum.AddPlane(glm::vec3(0, 0, -1), center.z);
+    bottomFrustum.AddPlane(glm::vec3(0, 0, 1), 2000.0f - center.z);
+    const Frustum* frustums[4] = { &shadowFrustum, &topFrustum, &bottomFrustum, &lightingFrustum };
+    if (!frustumCulling)
+        for (int p=0;  p<4;  p++)
+            frustums[p] = NULL;
 
     ////////////////////////////////////////////////////////////////////////////////
     // Anatomy of a pass:
@@ -428,18 +624,19 @@ void Scene::DrawScene()
     //   Choose and FBO/Render-Target (if needed; create the FBO in InitializeScene above)
     //   Set the viewport (to the pixel size of the screen or FBO)
     //   Clear the screen.
-    //   Set the uniform variables required by the shader
+    //   Set the uniform variables required by the shader (beyond the FrameBlock)
     //   Draw the geometry
     //   Unset the FBO (if one was used)
     //   Unset the shader
     ////////////////////////////////////////////////////////////////////////////////
 
     CHECKERROR;
-    int loc, programId;
+    ShaderProgram* program;
 
     ////////////////////////////////////////////////////////////////////////////////
     // Shadow pass
     ////////////////////////////////////////////////////////////////////////////////
+    profiler.Begin("shadow");
     
     // Enable front face culling
     glEnable(GL_CULL_FACE);
@@ -447,7 +644,7 @@ void Scene::DrawScene()
 
     // Choose the lighting shader
     shadowProgram->Use();
-    programId = shadowProgram->programId;
+    program = shadowProgram;
 
     // Choose FBO
     fboShadows->Bind();
@@ -457,19 +654,14 @@ void Scene::DrawScene()
     glClearColor(0.5, 0.5, 0.5, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // @@ The scene specific parameters (uniform variables) used by
-    // the shader are set here.  Object specific parameters are set in
-    // the Draw procedure in object.cpp
-    
-    loc = glGetUniformLocation(programId, "WorldProj");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldProj));
-    loc = glGetUniformLocation(programId, "WorldView");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(LightView));
+    // The scene specific parameters are all in the frame's
+    // FrameBlock; the shadow shader uses its LightView for WorldView.
 
     CHECKERROR;
 
-    // Draw all objects (This recursively traverses the object hierarchy.)
-    objectRoot->Draw(shadowProgram, Identity);
+    // Draw all objects (in the order of the flattened hierarchy)
+    renderList.Draw(shadowProgram, &objectBlocks, frustums[0]);
+    frustumCulled[0] = renderList.culled;
     CHECKERROR;
 
     // Turn off the FBO
@@ -480,6 +672,7 @@ void Scene::DrawScene()
 
     // Disable front face culling
     glDisable(GL_CULL_FACE);
+    profiler.End();
 
     ////////////////////////////////////////////////////////////////////////////////
     // End of shadow pass
@@ -489,10 +682,11 @@ void Scene::DrawScene()
     ////////////////////////////////////////////////////////////////////////////////
     // Reflection pass 1
     ////////////////////////////////////////////////////////////////////////////////
+    profiler.Begin("reflection top");
 
     // Reflection shader
     reflectionProgram->Use();
-    programId = reflectionProgram->programId;
+    program = reflectionProgram;
 
     // Choose FBO
     fboReflectionTop->Bind();
@@ -504,53 +698,38 @@ void Scene::DrawScene()
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // scene specific parameters (uniform variables) used by the shader
-    loc = glGetUniformLocation(programId, "WorldProj");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldProj));
-    loc = glGetUniformLocation(programId, "WorldInverse");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldInverse));
-    loc = glGetUniformLocation(programId, "lightPos");
-    glUniform3fv(loc, 1, &(lightPos[0]));
-    loc = glGetUniformLocation(programId, "eyePos");
-    glUniform3fv(loc, 1, &teapot->shape->center[0]);
-    loc = glGetUniformLocation(programId, "mode");
-    glUniform1i(loc, mode);
-    loc = glGetUniformLocation(programId, "shadows");
-    glUniform1i(loc, shadows);
-    loc = glGetUniformLocation(programId, "pass");
-    glUniform1i(loc, 1);
+    program->Set(ShaderProgram::eyePos, teapot->shape->center);
+    program->Set(ShaderProgram::pass, 1);
 
     // bind the irradiance map texture
-    texSkyIrr->Bind(7, programId, "irrMap");
-    texSky->Bind(8, programId, "skyMap");
-
-    loc = glGetUniformLocation(programId, "lightVal");
-    glUniform3fv(loc, 1, &(lightVal[0]));
-    loc = glGetUniformLocation(programId, "lightAmb");
-    glUniform3fv(loc, 1, &(lightAmb[0]));
-
-    loc = glGetUniformLocation(programId, "ShadowMatrix");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(ShadowMatrix));
+    texSkyIrr->Bind(7, program, ShaderProgram::irrMap);
+    texSky->Bind(8, program, ShaderProgram::skyMap);
+    if (texSkySpec)
+        texSkySpec->Bind(9, program, ShaderProgram::specMap);
 
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, fboShadows->textureID);
-    loc = glGetUniformLocation(programId, "shadowMap");
-    glUniform1i(loc, 2);
+    program->Set(ShaderProgram::shadowMap, 2);
 
     CHECKERROR;
 
-    // Draw all objects (This recursively traverses the object hierarchy.)
-    objectRoot->Draw(reflectionProgram, Identity);
+    // Draw all objects (in the order of the flattened hierarchy)
+    renderList.Draw(reflectionProgram, &objectBlocks, frustums[1]);
+    frustumCulled[1] = renderList.culled;
     CHECKERROR;
 
     // Unbind the irradiance map texture
     texSkyIrr->Unbind();
     texSky->Unbind();
+    if (texSkySpec)
+        texSkySpec->Unbind();
 
     // Turn off the FBO
     fboReflectionTop->Unbind();
 
     // Turn off the shader
     reflectionProgram->Unuse();
+    profiler.End();
 
     ////////////////////////////////////////////////////////////////////////////////
     // End of reflection pass 1
@@ -559,10 +738,11 @@ void Scene::DrawScene()
     ////////////////////////////////////////////////////////////////////////////////
     // Reflection pass 2
     ////////////////////////////////////////////////////////////////////////////////
+    profiler.Begin("reflection bottom");
 
     // Reflection shader
     reflectionProgram->Use();
-    programId = reflectionProgram->programId;
+    program = reflectionProgram;
 
     // Choose FBO
     fboReflectionBottom->Bind();
@@ -574,51 +754,37 @@ void Scene::DrawScene()
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // scene specific parameters (uniform variables) used by the shader
-    loc = glGetUniformLocation(programId, "WorldProj");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldProj));
-    loc = glGetUniformLocation(programId, "WorldInverse");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldInverse));
-    loc = glGetUniformLocation(programId, "lightPos");
-    glUniform3fv(loc, 1, &(lightPos[0]));
-    loc = glGetUniformLocation(programId, "mode");
-    glUniform1i(loc, mode);
-    loc = glGetUniformLocation(programId, "shadows");
-    glUniform1i(loc, shadows);
-    loc = glGetUniformLocation(programId, "pass");
-    glUniform1i(loc, 0);
+    program->Set(ShaderProgram::pass, 0);
 
     // bind the irradiance map texture
-    texSkyIrr->Bind(7, programId, "irrMap");
-    texSky->Bind(8, programId, "skyMap");
-
-    loc = glGetUniformLocation(programId, "lightVal");
-    glUniform3fv(loc, 1, &(lightVal[0]));
-    loc = glGetUniformLocation(programId, "lightAmb");
-    glUniform3fv(loc, 1, &(lightAmb[0]));
-
-    loc = glGetUniformLocation(programId, "ShadowMatrix");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(ShadowMatrix));
+    texSkyIrr->Bind(7, program, ShaderProgram::irrMap);
+    texSky->Bind(8, program, ShaderProgram::skyMap);
+    if (texSkySpec)
+        texSkySpec->Bind(9, program, ShaderProgram::specMap);
 
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, fboShadows->textureID);
-    loc = glGetUniformLocation(programId, "shadowMap");
-    glUniform1i(loc, 2);
+    program->Set(ShaderProgram::shadowMap, 2);
 
     CHECKERROR;
 
-    // Draw all objects (This recursively traverses the object hierarchy.)
-    objectRoot->Draw(reflectionProgram, Identity);
+    // Draw all objects (in the order of the flattened hierarchy)
+    renderList.Draw(reflectionProgram, &objectBlocks, frustums[2]);
+    frustumCulled[2] = renderList.culled;
     CHECKERROR;
 
     // Unbind the irradiance map texture
     texSkyIrr->Unbind();
     texSky->Unbind();
+    if (texSkySpec)
+        texSkySpec->Unbind();
 
     // Turn off the FBO
     fboReflectionBottom->Unbind();
 
     // Turn off the shader
     reflectionProgram->Unuse();
+    profiler.End();
 
     ////////////////////////////////////////////////////////////////////////////////
     // End of reflection pass 2
@@ -628,72 +794,58 @@ void Scene::DrawScene()
     ////////////////////////////////////////////////////////////////////////////////
     // Lighting pass
     ////////////////////////////////////////////////////////////////////////////////
+    profiler.Begin("lighting");
     
     // Choose the lighting shader
     lightingProgram->Use();
-    programId = lightingProgram->programId;
+    program = lightingProgram;
 
     // Set the viewport, and clear the screen
     glViewport(0, 0, width, height);
     glClearColor(0.5, 0.5, 0.5, 1.0);
     glClear(GL_COLOR_BUFFER_BIT| GL_DEPTH_BUFFER_BIT);
 
-    // @@ The scene specific parameters (uniform variables) used by
-    // the shader are set here.  Object specific parameters are set in
-    // the Draw procedure in object.cpp
-    
-    loc = glGetUniformLocation(programId, "WorldProj");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldProj));
-    loc = glGetUniformLocation(programId, "WorldView");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldView));
-    loc = glGetUniformLocation(programId, "WorldInverse");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(WorldInverse));
-    loc = glGetUniformLocation(programId, "lightPos");
-    glUniform3fv(loc, 1, &(lightPos[0]));
-    loc = glGetUniformLocation(programId, "mode");
-    glUniform1i(loc, mode);
-    loc = glGetUniformLocation(programId, "shadows");
-    glUniform1i(loc, shadows);
-
-    loc = glGetUniformLocation(programId, "lightVal");
-    glUniform3fv(loc, 1, &(lightVal[0]));
-    loc = glGetUniformLocation(programId, "lightAmb");
-    glUniform3fv(loc, 1, &(lightAmb[0]));
-
-    loc = glGetUniformLocation(programId, "ShadowMatrix");
-    glUniformMatrix4fv(loc, 1, GL_FALSE, Pntr(ShadowMatrix));
+    // @@ The scene specific parameters used by the shader are in the
+    // frame's FrameBlock, written above; the samplers are set here.
+    // Object specific parameters are set in the Draw procedure in
+    // object.cpp
 
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, fboShadows->textureID);
-    loc = glGetUniformLocation(programId, "shadowMap");
-    glUniform1i(loc, 2);
+    program->Set(ShaderProgram::shadowMap, 2);
 
     glActiveTexture(GL_TEXTURE3);
     glBindTexture(GL_TEXTURE_2D, fboReflectionTop->textureID);
-    loc = glGetUniformLocation(programId, "reflectionMapTop");
-    glUniform1i(loc, 3);
+    program->Set(ShaderProgram::reflectionMapTop, 3);
 
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D, fboReflectionBottom->textureID);
-    loc = glGetUniformLocation(programId, "reflectionMapBottom");
-    glUniform1i(loc, 4);
+    program->Set(ShaderProgram::reflectionMapBottom, 4);
 
     CHECKERROR;
 
     // bind the irradiance map texture
-    texSkyIrr->Bind(7, programId, "irrMap");
-    texSky->Bind(8, programId, "skyMap");
-
-    // Draw all objects (This recursively traverses the object hierarchy.)
-    objectRoot->Draw(lightingProgram, Identity);
+    texSkyIrr->Bind(7, program, ShaderProgram::irrMap);
+    texSky->Bind(8, program, ShaderProgram::skyMap);
+    if (texSkySpec)
+        texSkySpec->Bind(9, program, ShaderProgram::specMap);
+
+    // Draw all objects (in the order of the flattened hierarchy,
+    // skipping the objects the occluders hide.)
+    occlusion.Wait();
+    renderList.Draw(lightingProgram, &objectBlocks, frustums[3], &occlusion);
+    frustumCulled[3] = renderList.culled;
     CHECKERROR;
 
     // Unbind the irradiance map texture
     texSkyIrr->Unbind();
     texSky->Unbind();
+    if (texSkySpec)
+        texSkySpec->Unbind();
     
     // Turn off the shader
     lightingProgram->Unuse();
+    profiler.End();
 
     ////////////////////////////////////////////////////////////////////////////////
     // End of Lighting pass
@@ -16,6 +16,14 @@
 #include "object.h"
 #include "texture.h"
 #include "fbo.h"
+#include "irradiancetask.h"
+#include "emulator.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "profiler.h"
+#include "ubo.h"
+#include "renderlist.h"
+#include "frustum.h"
 
 enum ObjectIds {
     nullId	= 0,
@@ -49,6 +57,7 @@ public:
     glm::vec2 dir;
 
     float frameStartTime, frameEndTime, frameTime;
+    double fixedTime;           // When >= 0, animations are frozen at this time (for reproducible offline renders)
 
     // Light parameters
     float lightSpin, lightTilt, lightDist;
@@ -74,6 +83,10 @@ public:
     std::vector<Object*> animated;
     ProceduralGround* proceduralground;
 
+    SceneBvh bvh;               // Of the drawn objects, for picking
+    OcclusionCuller occlusion;  // Of the lighting pass
+    Profiler profiler;          // Of DrawScene's passes
+
     // Shader programs
     ShaderProgram* lightingProgram;
     // @@ Declare additional shaders if necessary
@@ -85,6 +98,13 @@ public:
     FBO* fboReflectionTop;
     FBO* fboReflectionBottom;
 
+    // Uniform buffers shared by the shader programs
+    UniformBuffer frameBlock;   // One FrameBlock, written per frame
+    UniformRing objectBlocks;   // An ObjectBlock per draw, in 4MB
+    RenderList renderList;      // The hierarchy under objectRoot, as the passes draw it
+    bool frustumCulling;        // Draw each pass only what its view may see
+    int frustumCulled[4];       // By the shadow, top, bottom and lighting passes
+
     // Textures
     Texture* texGrass;
     Texture* texGrassNormal;
@@ -99,13 +119,25 @@ public:
     Texture* texWaterNormal;
     Texture* texFrame2;
     Texture* texSky;
+    std::string skyFile;        // The sky's .hdr, for the path tracer
     Texture* texSkyIrr;
+    IrradianceTask irrTask;     // Computes texSkyIrr if it wasn't made offline
+    Texture* texSkySpec;    // GGX prefiltered chain (NULL if not generated)
+    int skySpecLevels;
+
+#ifdef EM
+    // Software rendering
+    Emulator emulator;
+    bool emulate;               // Draw with the emulator instead of OpenGL
+#endif
 
     // Options menu stuff
     bool show_demo_window;
 
     void InitializeScene();
     void BuildTransforms();
+    void UpdateFrame();
+    const SceneBvh::Instance* Pick(const double x, const double y, RayHit& hit);
     void DrawMenu();
     void DrawScene();
 
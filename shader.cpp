@@ -8,12 +8,29 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include <fstream>
+#include <string>
+#include <algorithm>
+#include <string.h>
 
 #include <glbinding/gl/gl.h>
 #include <glbinding/Binding.h>
 using namespace gl;
 
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
 #include "shader.h"
+#include "ubo.h"
+
+// The names of ShaderProgram::Name, in order
+static const char* names[ShaderProgram::NAMES] = {
+    "eyePos", "pass",
+    "shadowMap", "reflectionMapTop", "reflectionMapBottom", "irrMap", "skyMap", "specMap",
+    "textureMap", "normalMap", "image" };
+
+// The uniform blocks' names, by binding point
+static const char* blocks[BLOCK_BINDINGS] = { "FrameBlock", "ObjectBlock" };
 
 // Reads a specified file into a string and returns the string.  The
 // file is examined first to determine the needed string size.
@@ -56,9 +73,18 @@ void ShaderProgram::Unuse()
 // string.
 void ShaderProgram::AddShader(const char* fileName, GLenum type)
 {
-    // Read the source from the named file
+    // Read the source from the named file, and put the uniform
+    // blocks of ubo.h after its #version line.  The #line directive
+    // keeps the compiler's line numbers those of the file.
     char* src = ReadFile(fileName);
-    const char* psrc[1] = {src};
+    std::string source = src;
+    const size_t version = source.find("#version");
+    if (version != std::string::npos) {
+        const size_t eol = source.find('\n', version);
+        const size_t at = eol == std::string::npos ? source.size() : eol + 1;
+        const int line = (int)std::count(source.begin(), source.begin() + at, '\n') + 1;
+        source.insert(at, UniformBlockSource() + "#line " + std::to_string(line) + "\n"); }
+    const char* psrc[1] = {source.c_str()};
 
     // Create a shader and attach, hand it the source, and compile it.
     int shader = glCreateShader(type);
@@ -101,4 +127,91 @@ void ShaderProgram::LinkProgram()
         printf("Link log:\n%s\n", buffer);
         delete buffer;
     }
+
+    for (int b=0;  b<BLOCK_BINDINGS;  b++) {
+        const GLuint index = glGetUniformBlockIndex(programId, blocks[b]);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(programId, index, b); }
+
+    // Build the table of uniforms: the NAMES first, present or not,
+    // then whatever else is active.  Members of uniform blocks have
+    // no location, and are left out.
+    uniforms.clear();
+    uniforms.resize(NAMES);
+    for (int n=0;  n<NAMES;  n++) {
+        uniforms[n].name = names[n];
+        uniforms[n].location = -1;
+        uniforms[n].size = 0;
+        uniforms[n].set = false; }
+
+    int count = 0;
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &count);
+    for (int i=0;  i<count;  i++) {
+        char name[256];
+        int size;
+        GLenum type;
+        glGetActiveUniform(programId, i, sizeof(name), NULL, &size, &type, name);
+        const int location = glGetUniformLocation(programId, name);
+        if (location < 0)
+            continue;
+        char* bracket = strchr(name, '[');      // Arrays are listed as name[0]
+        if (bracket)
+            *bracket = 0;
+
+        int handle = Find(name);
+        if (handle < 0) {
+            handle = (int)uniforms.size();
+            uniforms.push_back(Uniform());
+            uniforms[handle].name = name; }
+        Uniform& u = uniforms[handle];
+        u.location = location;
+        u.type = type;
+        u.size = size;
+        u.set = false; }
+}
+
+int ShaderProgram::Find(const char* name) const
+{
+    for (size_t h=0;  h<uniforms.size();  h++)
+        if (uniforms[h].name == name)
+            return (int)h;
+    return -1;
+}
+
+bool ShaderProgram::Changed(const int handle, const void* v, const int n)
+{
+    if (handle < 0 || handle >= (int)uniforms.size())
+        return false;
+    Uniform& u = uniforms[handle];
+    if (u.location < 0)
+        return false;
+    if (u.set && memcmp(u.value, v, n*sizeof(float)) == 0)
+        return false;
+    memcpy(u.value, v, n*sizeof(float));
+    u.set = true;
+    return true;
+}
+
+void ShaderProgram::Set(const int handle, const int v)
+{
+    if (Changed(handle, &v, 1))
+        glUniform1i(uniforms[handle].location, v);
+}
+
+void ShaderProgram::Set(const int handle, const float v)
+{
+    if (Changed(handle, &v, 1))
+        glUniform1f(uniforms[handle].location, v);
+}
+
+void ShaderProgram::Set(const int handle, const glm::vec3& v)
+{
+    if (Changed(handle, &v[0], 3))
+        glUniform3fv(uniforms[handle].location, 1, &v[0]);
+}
+
+void ShaderProgram::Set(const int handle, const glm::mat4& m)
+{
+    if (Changed(handle, &m[0][0], 16))
+        glUniformMatrix4fv(uniforms[handle].location, 1, GL_FALSE, &m[0][0]);
 }
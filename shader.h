@@ -5,16 +5,70 @@
 // loaded (method "Use"), its vertex shader and pixel shader will be
 // invoked for all geometry passing through the graphics pipeline.
 // When done, unload it with method "Unuse".
+//
+// Uniform variables are set through handles rather than by name.
+// LinkProgram lists the program's active uniforms once, and a handle
+// is an index into that table: for the uniforms the framework sets,
+// the handle is the enum value of the same name (so no lookup is ever
+// needed), and Find returns the handle of any other.  Each entry
+// remembers the value last uploaded, and the Set methods skip values
+// that have not changed.  Handles of uniforms the program lacks (or
+// the compiler removed) are accepted and ignored, as OpenGL ignores
+// location -1.
+//
+// LinkProgram also attaches the program's uniform blocks to the
+// binding points of ubo.h.
 ////////////////////////////////////////////////////////////////////////
 
+#ifndef _SHADER_
+#define _SHADER_
+
+#include <string>
+#include <vector>
+
 class ShaderProgram
 {
 public:
+    // The uniforms (outside the blocks of ubo.h) set by
+    // Scene::DrawScene, RenderList::Draw and the emulator, in the order
+    // of the names in shader.cpp.
+    enum Name { eyePos, pass,
+                shadowMap, reflectionMapTop, reflectionMapBottom, irrMap, skyMap, specMap,
+                textureMap, normalMap, image, NAMES };
+
+    struct Uniform
+    {
+        std::string name;
+        int location;           // -1 if not active in this program
+        GLenum type;
+        int size;               // Array length
+        bool set;               // Whether value holds the last upload
+        float value[16];        // As floats, or as ints for int, bool and sampler types
+    };
+
     int programId;
-    
+    std::vector<Uniform> uniforms;      // The NAMES, then the other active uniforms
+
     ShaderProgram();
     void AddShader(const char* fileName, const GLenum type);
     void LinkProgram();
     void Use();
     void Unuse();
+
+    // The handle of a uniform, or -1 if the program has none so named.
+    int Find(const char* name) const;
+
+    // Typed setters for single (not array) uniforms.  The program
+    // must be in use.
+    void Set(const int handle, const int v);
+    void Set(const int handle, const float v);
+    void Set(const int handle, const glm::vec3& v);
+    void Set(const int handle, const glm::mat4& m);
+
+private:
+    // Record a value of n words, returning false (and changing
+    // nothing) if it needs no upload.
+    bool Changed(const int handle, const void* v, const int n);
 };
+
+#endif
@@ -5,7 +5,8 @@
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
-uniform mat4 WorldView, WorldProj, ModelTr;
+// The uniform blocks of ubo.h are declared ahead of this source by
+// ShaderProgram::AddShader.
 
 in vec4 vertex;
 
@@ -14,7 +15,8 @@ out vec4 position;
 void main()
 {
     // Compute the point's projection on the screen
-    gl_Position = WorldProj*WorldView*ModelTr*vertex;
+    mat4 ModelTr = INSTANCE_MODEL_TR(gl_InstanceID);
+    gl_Position = WorldProj*LightView*ModelTr*vertex;
 
     // Vertex depth from light's POV
     position = gl_Position;
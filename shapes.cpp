@@ -38,8 +38,11 @@ using namespace gl;
 
 #include "math.h"
 #include "shapes.h"
+#include "profiler.h"
+#include "trace.h"
 #include "rply.h"
 #include "simplexnoise.h"
+#include "emulator.h"
 
 const float PI = 3.14159f;
 const float rad = PI/180.0f;
@@ -59,7 +62,10 @@ unsigned int VaoFromTris(std::vector<glm::vec4> Pnt,
                          std::vector<glm::vec3> Tan,
                          std::vector<glm::ivec3> Tri)
 {
+    TRACE_SCOPE("VaoFromTris");
     printf("VaoFromTris %ld %ld\n", Pnt.size(), Tri.size());
+    if (!hasGL)                 // Software only: the emulator reads the arrays directly
+        return 0;
     unsigned int vaoID;
     glGenVertexArrays(1, &vaoID);
     glBindVertexArray(vaoID);
@@ -139,12 +145,13 @@ void Shape::MakeVAO()
     count = Tri.size();
 }
 
-void Shape::DrawVAO()
+void Shape::DrawVAO(const int instances)
 {
     CHECKERROR;
     glBindVertexArray(vaoID);
     CHECKERROR;
-    glDrawElements(GL_TRIANGLES, 3*count, GL_UNSIGNED_INT, 0);
+    glDrawElementsInstanced(GL_TRIANGLES, 3*count, GL_UNSIGNED_INT, 0, instances);
+    Profiler::CountDraw(count*instances);
     CHECKERROR;
     glBindVertexArray(0);
 }
@@ -542,6 +549,7 @@ Cylinder::Cylinder(const int n)
 // sufficient, but that works poorly with the reflection map.
 Ply::Ply(const char* name, const bool reverse)
 {
+    TRACE_SCOPE("Ply");
     diffuseColor = glm::vec3(0.8, 0.8, 0.5);
     specularColor = glm::vec3(1.0, 1.0, 1.0);
     shininess = 120.0;
@@ -681,6 +689,7 @@ Plane::Plane(const float r, const int n)
                                       (i  )*(n+1) + (j),
                                       (i  )*(n+1) + (j-1)); } } }
 
+    ComputeSize();
     vaoID = VaoFromTris(Pnt, Nrm, Tex, Tan, Tri);
     count = Tri.size();
 }
@@ -724,10 +733,38 @@ ProceduralGround::ProceduralGround(const float _range, const int n,
                          (i  )*(n+1) + (j),
                          (i  )*(n+1) + (j-1)); } } }
 
+    ComputeSize();
     vaoID = VaoFromTris(Pnt, Nrm, Tex, Tan, Tri);
     count = Tri.size();
 }
 
+void ProceduralGround::OccluderMesh(const int n, std::vector<glm::vec4>& pnt, std::vector<glm::ivec3>& tri) const
+{
+    // Pnt is a grid of (fine+1) by (fine+1) vertices
+    const int fine = (int)floorf(sqrtf((float)Pnt.size()) + 0.5f) - 1;
+    const int step = (fine + n - 1)/n;
+    const int coarse = (fine + step - 1)/step;
+    pnt.clear();
+    tri.clear();
+    for (int i=0;  i<=coarse;  i++) {
+        const int fi = std::min(i*step, fine);
+        for (int j=0;  j<=coarse;  j++) {
+            const int fj = std::min(j*step, fine);
+            // The lowest vertex of the coarse squares around this one,
+            // so each coarse square is below the fine ones it covers.
+            float z = Pnt[fi*(fine+1) + fj].z;
+            for (int a=std::max(fi-step, 0);  a<=std::min(fi+step, fine);  a++)
+                for (int b=std::max(fj-step, 0);  b<=std::min(fj+step, fine);  b++)
+                    z = std::min(z, Pnt[a*(fine+1) + b].z);
+            pnt.push_back(glm::vec4(Pnt[fi*(fine+1) + fj].x, Pnt[fi*(fine+1) + fj].y, z, 1.0f));
+            if (i>0 && j>0) {
+                pushquad(tri,
+                         (i-1)*(coarse+1) + (j-1),
+                         (i-1)*(coarse+1) + (j),
+                         (i  )*(coarse+1) + (j),
+                         (i  )*(coarse+1) + (j-1)); } } }
+}
+
 float ProceduralGround::HeightAt(const float x, const float y)
 {
     glm::vec3 highPoint = glm::vec3(0.0, 0.0, 0.01);
@@ -765,6 +802,7 @@ Quad::Quad(const int n)
                          (i  )*(n+1) + (j),
                          (i  )*(n+1) + (j-1)); } } }
 
+    ComputeSize();
     vaoID = VaoFromTris(Pnt, Nrm, Tex, Tan, Tri);
     count = Tri.size();
 }
@@ -62,7 +62,7 @@ public:
 
     virtual void ComputeSize();
     virtual void MakeVAO();
-    virtual void DrawVAO();
+    virtual void DrawVAO(const int instances=1);   // Numbered by gl_InstanceID
 };
 
 class Box: public Shape
@@ -117,6 +117,10 @@ public:
                      const float _octaves, const float _persistence, const float _scale,
                      const float _low, const float _high);
     float HeightAt(const float x, const float y);
+
+    // A coarser grid of about n by n squares lying nowhere above this
+    // one, as a cheap occluder for occlusion culling.
+    void OccluderMesh(const int n, std::vector<glm::vec4>& pnt, std::vector<glm::ivec3>& tri) const;
 };
 
 class Quad: public Shape
@@ -7,6 +7,7 @@
 #include "math.h"
 #include <fstream>
 #include <stdlib.h>
+#include <algorithm>
 
 #include <glbinding/gl/gl.h>
 #include <glbinding/Binding.h>
@@ -16,7 +17,11 @@ using namespace gl;
 #define GLM_SWIZZLE
 #include <glm/glm.hpp>
 
+#include "shader.h"
 #include "texture.h"
+#include "hdr.h"
+#include "emulator.h"
+#include "trace.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
@@ -25,40 +30,172 @@ using namespace gl;
 #include <glu.h>                // For gluErrorString
 #define CHECKERROR {GLenum err = glGetError(); if (err != GL_NO_ERROR) { fprintf(stderr, "OpenGL error (at line texture.cpp:%d): %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
 
+static bool IsHdr(const std::string &path)
+{
+    return path.size() > 4 && path.compare(path.size()-4, 4, ".hdr") == 0;
+}
+
+// Upload RGB half floats to the bound texture's given level.
+static void UploadHalf(const int level, const int w, const int h, const std::vector<unsigned short>& pixels)
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, level, (GLint)GL_RGB16F, w, h, 0, GL_RGB, GL_HALF_FLOAT, &pixels[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Read an .hdr file with our own decoder, as RGB half floats bottom
+// row first.  The values are gamma encoded and clamped exactly as
+// stb_image's 8 bit conversion did, so the shaders see the same
+// colors, without the 12 byte per pixel float copy stb_image makes on
+// the way.
+static void ReadHdr(const std::string &path, int& w, int& h, std::vector<unsigned short>& pixels)
+{
+    HdrReader hdr;
+    if (!hdr.Open(path) || !hdr.ReadHalf(pixels, true, 2.2f)) {
+        printf("\nRead error on file %s\n\n", path.c_str());
+        exit(-1); }
+    w = hdr.width;
+    h = hdr.height;
+}
+
 Texture::Texture(const std::string &path) : textureId(0)
 {
+    TRACE_SCOPE("Texture");
+    std::vector<unsigned short> pixels;
+    if (IsHdr(path)) {
+        image = NULL;
+        ReadHdr(path, width, height, pixels);
+        depth = 4;
+        printf("%d %d %d %s\n", depth, width, height, path.c_str()); }
+    else {
+        stbi_set_flip_vertically_on_load(true);
+        image = stbi_load(path.c_str(), &width, &height, &depth, 4);
+        depth = 4;
+        printf("%d %d %d %s\n", depth, width, height, path.c_str());
+        if (!image) {
+            printf("\nRead error on file %s:\n  %s\n\n", path.c_str(), stbi_failure_reason());
+            exit(-1); } }
+
+#ifdef EM
+    if (image)
+        AddLevel(width, height, image);
+    else
+        AddLevel(width, height, pixels);
+    BuildMipmaps(10);
+#endif
+
+    if (hasGL) {
+        // Here we create MIPMAP and set some useful modes for the texture
+        glGenTextures(1, &textureId);   // Get an integer id for this texture from OpenGL
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        if (image)
+            glTexImage2D(GL_TEXTURE_2D, 0, (GLint)GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+        else
+            UploadHalf(0, width, height, pixels);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 10);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR_MIPMAP_LINEAR);  
+        glBindTexture(GL_TEXTURE_2D, 0); }
+    if (image)
+        stbi_image_free(image);
+
+}
+
+Texture::Texture(const std::vector<std::string> &levelFiles) : textureId(0), image(NULL)
+{
+    TRACE_SCOPE("Texture");
     stbi_set_flip_vertically_on_load(true);
-    image = stbi_load(path.c_str(), &width, &height, &depth, 4);
-    depth = 4;
-    printf("%d %d %d %s\n", depth, width, height, path.c_str());
-    if (!image) {
-        printf("\nRead error on file %s:\n  %s\n\n", path.c_str(), stbi_failure_reason());
-        exit(-1); }
+    if (hasGL) {
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_2D, textureId); }
+
+    for (int level=0;  level<(int)levelFiles.size();  level++) {
+        int w, h, d;
+        unsigned char* levelImage = NULL;
+        std::vector<unsigned short> pixels;
+        if (IsHdr(levelFiles[level]))
+            ReadHdr(levelFiles[level], w, h, pixels);
+        else {
+            levelImage = stbi_load(levelFiles[level].c_str(), &w, &h, &d, 4);
+            if (!levelImage) {
+                printf("\nRead error on file %s:\n  %s\n\n", levelFiles[level].c_str(), stbi_failure_reason());
+                exit(-1); } }
+        if (level == 0) {
+            width = w;
+            height = h;
+            depth = 4; }
+        else if (w != std::max(1, width>>level) || h != std::max(1, height>>level)) {
+            printf("\nMip level %d (%s) is %dx%d, expected %dx%d\n\n", level, levelFiles[level].c_str(),
+                   w, h, std::max(1, width>>level), std::max(1, height>>level));
+            exit(-1); }
+        printf("%d %d %d %s\n", 4, w, h, levelFiles[level].c_str());
+
+#ifdef EM
+        if (levelImage)
+            AddLevel(w, h, levelImage);
+        else
+            AddLevel(w, h, pixels);
+#endif
+        if (hasGL) {
+            if (levelImage)
+                glTexImage2D(GL_TEXTURE_2D, level, (GLint)GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, levelImage);
+            else
+                UploadHalf(level, w, h, pixels); }
+        if (levelImage)
+            stbi_image_free(levelImage); }
+
+    if (hasGL) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (int)levelFiles.size()-1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR_MIPMAP_LINEAR);  
+        glBindTexture(GL_TEXTURE_2D, 0); }
+}
+
+Texture::Texture(const std::vector<float> &rgb, const int w, const int h)
+    : textureId(0), width(w), height(h), depth(4), image(NULL)
+{
+    TRACE_SCOPE("Texture");
+    // Encoded and flipped just as an .hdr file's pixels would be
+    std::vector<unsigned short> pixels(3*w*h);
+    for (int y=0;  y<h;  y++)
+        for (int i=0;  i<3*w;  i++)
+            pixels[3*w*(h-1-y) + i] = FloatToHalf(std::min(1.0f, powf(rgb[3*w*y + i], 1.0f/2.2f)));
 
-    // Here we create MIPMAP and set some useful modes for the texture
-    glGenTextures(1, &textureId);   // Get an integer id for this texture from OpenGL
+#ifdef EM
+    AddLevel(w, h, pixels);
+    BuildMipmaps(10);
+#endif
+    if (!hasGL)
+        return;
+
+    glGenTextures(1, &textureId);
     glBindTexture(GL_TEXTURE_2D, textureId);
-    glTexImage2D(GL_TEXTURE_2D, 0, (GLint)GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+    UploadHalf(0, w, h, pixels);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 10);
     glGenerateMipmap(GL_TEXTURE_2D);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (int)GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (int)GL_LINEAR_MIPMAP_LINEAR);  
     glBindTexture(GL_TEXTURE_2D, 0);
-    stbi_image_free(image);
+}
 
+Texture::~Texture()
+{
+    if (hasGL)
+        glDeleteTextures(1, &textureId);
 }
 
 // Make a texture availabe to a shader program.  The unit parameter is
 // a small integer specifying which texture unit should load the
-// texture.  The name parameter is the sampler2d in the shader program
-// which will provide access to the texture.
-void Texture::Bind(const int unit, const int programId, const std::string& name)
+// texture.  The sampler parameter is the handle of the sampler2d in
+// the shader program which will provide access to the texture.
+void Texture::Bind(const int unit, ShaderProgram* program, const int sampler)
 {
     glActiveTexture((gl::GLenum)((int)GL_TEXTURE0 + unit));
     glBindTexture(GL_TEXTURE_2D, textureId);
-    int loc = glGetUniformLocation(programId, name.c_str());
-    glUniform1i(loc, unit);
+    program->Set(sampler, unit);
 }
 
 // Unbind a texture from a texture unit whne no longer needed.
@@ -72,3 +209,97 @@ glm::vec3 Texture::GetTexel(float u, float v)
     int i = int(v*height)*width*depth + int(u*width)*depth;
     return glm::vec3(image[i]/127.0, image[i+1]/127.0, image[i+2]/127.0);
 }
+
+
+#ifdef EM
+void Texture::AddLevel(const int w, const int h, const unsigned char* rgba)
+{
+    Level level;
+    level.width = w;
+    level.height = h;
+    level.rgba.assign(rgba, rgba + 4*w*h);
+    levels.push_back(level);
+}
+
+// From the gamma encoded half floats of an .hdr texture, all within [0,1]
+void Texture::AddLevel(const int w, const int h, const std::vector<unsigned short>& rgb)
+{
+    Level level;
+    level.width = w;
+    level.height = h;
+    level.rgba.resize(4*w*h);
+    for (int p=0;  p<w*h;  p++) {
+        for (int c=0;  c<3;  c++)
+            level.rgba[4*p+c] = (unsigned char)(255.0f*HalfToFloat(rgb[3*p+c]) + 0.5f);
+        level.rgba[4*p+3] = 255; }
+    levels.push_back(level);
+}
+
+// Box filter each level from the one before, like glGenerateMipmap,
+// up to GL_TEXTURE_MAX_LEVEL.
+void Texture::BuildMipmaps(const int maxLevel)
+{
+    while ((int)levels.size() <= maxLevel) {
+        const Level& src = levels.back();
+        if (src.width == 1 && src.height == 1)
+            break;
+        Level dst;
+        dst.width = std::max(1, src.width/2);
+        dst.height = std::max(1, src.height/2);
+        dst.rgba.resize(4*dst.width*dst.height);
+        for (int y=0;  y<dst.height;  y++) {
+            const int y0 = std::min(2*y, src.height-1), y1 = std::min(2*y+1, src.height-1);
+            for (int x=0;  x<dst.width;  x++) {
+                const int x0 = std::min(2*x, src.width-1), x1 = std::min(2*x+1, src.width-1);
+                for (int c=0;  c<4;  c++)
+                    dst.rgba[4*(y*dst.width+x)+c] = (unsigned char)
+                        ((src.rgba[4*(y0*src.width+x0)+c] + src.rgba[4*(y0*src.width+x1)+c]
+                          + src.rgba[4*(y1*src.width+x0)+c] + src.rgba[4*(y1*src.width+x1)+c] + 2) / 4); } }
+        levels.push_back(dst); }
+}
+
+glm::vec4 Texture::SampleLevel(const int level, const glm::vec2& uv) const
+{
+    const Level& lv = levels[level];
+    float x = uv.x*lv.width - 0.5f;
+    float y = uv.y*lv.height - 0.5f;
+    if (!(fabs(x) < 1e8f && fabs(y) < 1e8f))    // Also catches NaNs
+        return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    const float fx = floorf(x), fy = floorf(y);
+    const float ax = x-fx, ay = y-fy;
+    int x0 = (int)fx % lv.width, y0 = (int)fy % lv.height;
+    if (x0 < 0) x0 += lv.width;
+    if (y0 < 0) y0 += lv.height;
+    const int x1 = x0+1 < lv.width ? x0+1 : 0;
+    const int y1 = y0+1 < lv.height ? y0+1 : 0;
+
+    const unsigned char* p00 = &lv.rgba[4*(y0*lv.width+x0)];
+    const unsigned char* p01 = &lv.rgba[4*(y0*lv.width+x1)];
+    const unsigned char* p10 = &lv.rgba[4*(y1*lv.width+x0)];
+    const unsigned char* p11 = &lv.rgba[4*(y1*lv.width+x1)];
+    glm::vec4 c;
+    for (int i=0;  i<4;  i++)
+        c[i] = ((1-ay)*((1-ax)*p00[i] + ax*p01[i]) + ay*((1-ax)*p10[i] + ax*p11[i])) / 255.0f;
+    return c;
+}
+
+glm::vec4 Texture::Sample(const glm::vec2& uv, const float lod) const
+{
+    if (levels.empty())
+        return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    const float l = std::max(0.0f, std::min(lod, (float)levels.size()-1));
+    const int l0 = (int)l;
+    const float f = l - l0;
+    glm::vec4 c = SampleLevel(l0, uv);
+    if (f > 0.0f)
+        c += f*(SampleLevel(l0+1, uv) - c);
+    return c;
+}
+
+float Texture::Lod(const glm::vec2& dx, const glm::vec2& dy) const
+{
+    const float w = (float)width, h = (float)height;
+    const float rho2 = std::max(dx.x*dx.x*w*w + dx.y*dx.y*h*h, dy.x*dy.x*w*w + dy.y*dy.y*h*h);
+    return rho2 > 0.0f ? 0.5f*log2f(rho2) : 0.0f;
+}
+#endif
@@ -7,6 +7,10 @@
 #ifndef _TEXTURE_
 #define _TEXTURE_
 
+#include <string>
+#include <vector>
+
+class ShaderProgram;
 
 // This class reads an image from a file, stores it on the graphics
 // card as a texture, and stores the (small integer) texture id which
@@ -21,9 +25,46 @@ class Texture
     unsigned char* image;
     Texture(const std::string &filename);
 
-    void Bind(const int unit, const int programId, const std::string& name);
+    // Builds a texture from a prefiltered mip chain, one file per
+    // level, instead of generating the mipmaps.  Level i must be
+    // max(1, size>>i) of level 0.
+    Texture(const std::vector<std::string> &levelFiles);
+
+    // Builds a texture from linear RGB floats, top row first, stored
+    // like an .hdr file's pixels (gamma encoded, as half floats).
+    Texture(const std::vector<float> &rgb, const int width, const int height);
+    ~Texture();
+
+    // Bind to a texture unit, and set the given sampler uniform (a
+    // ShaderProgram handle) to that unit.
+    void Bind(const int unit, ShaderProgram* program, const int sampler);
     void Unbind();
     glm::vec3 GetTexel(float u, float v);
+
+#ifdef EM
+    // A CPU copy of the mip chain for the software emulator: RGBA8,
+    // bottom row first, just as OpenGL holds it.
+    struct Level
+    {
+        int width, height;
+        std::vector<unsigned char> rgba;
+    };
+    std::vector<Level> levels;
+
+    // Trilinear filtered lookup with repeat wrapping, as
+    // GL_LINEAR_MIPMAP_LINEAR does.  Returns opaque black with no levels.
+    glm::vec4 Sample(const glm::vec2& uv, const float lod) const;
+
+    // The mip level OpenGL would choose for these screen space
+    // derivatives of the texture coordinates.
+    float Lod(const glm::vec2& dx, const glm::vec2& dy) const;
+
+ private:
+    void AddLevel(const int w, const int h, const unsigned char* rgba);
+    void AddLevel(const int w, const int h, const std::vector<unsigned short>& rgb);
+    void BuildMipmaps(const int maxLevel);
+    glm::vec4 SampleLevel(const int level, const glm::vec2& uv) const;
+#endif
 };
 
 #endif
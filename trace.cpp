@@ -0,0 +1,205 @@
+////////////////////////////////////////////////////////////////////////
+// Recording and writing traces.  See trace.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+#include "trace.h"
+
+const int RING_SIZE = 1 << 16;  // Events kept per thread; a power of 2
+const int GPU_TID = 0;          // The GPU's pseudo thread
+
+std::atomic<bool> Trace::recording(false);
+
+struct TraceEvent
+{
+    const char* name;
+    const char* argName;
+    long long arg;
+    long long time;             // Nanoseconds on the trace's clock
+    long long duration;         // For GPU spans
+    char phase;                 // 'B'egin, 'E'nd, or 'X' for a GPU span
+    int depth;                  // Of scopes open on the thread, this one included
+};
+
+// Each thread's events.  Only the owning thread writes, publishing
+// each event by advancing head; rings are linked into a list (by
+// compare and swap, so also without a lock) and never freed, so
+// events from threads that have exited still get written.  A thread
+// gets its ring when it first records, and gives it back when it
+// exits, for a later thread to continue (under the same tid) rather
+// than allocate another.
+struct TraceRing
+{
+    std::vector<TraceEvent> events;
+    std::atomic<long long> head;    // Events ever written
+    std::atomic<long long> start;   // Written before the last Start
+    int tid, depth;
+    const char* name;
+    TraceRing* next;
+
+    TraceRing() : events(RING_SIZE), head(0), start(0), tid(0), depth(0), name(NULL), next(NULL) {}
+};
+
+static std::atomic<TraceRing*> rings(NULL);
+static std::atomic<int> threadCount(0);
+static thread_local TraceRing* ring = NULL;
+static thread_local const char* threadName = NULL;
+
+// Rings of exited threads.  The lock is taken only as threads start
+// recording and exit, never per event.
+static std::mutex freeLock;
+static std::vector<TraceRing*> freeRings;
+
+struct RingRelease
+{
+    bool armed;
+    ~RingRelease()
+    {
+        if (!armed || !ring)
+            return;
+        std::lock_guard<std::mutex> lock(freeLock);
+        freeRings.push_back(ring);
+        ring = NULL;
+    }
+};
+static thread_local RingRelease ringRelease;
+
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+static long long Nanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+double Trace::Now()
+{
+    return Nanoseconds()/1e9;
+}
+
+static TraceRing* ThisRing()
+{
+    if (ring)
+        return ring;
+    {
+        std::lock_guard<std::mutex> lock(freeLock);
+        if (!freeRings.empty()) {
+            ring = freeRings.back();
+            freeRings.pop_back(); }
+    }
+    if (ring)
+        ring->depth = 0;
+    else {
+        ring = new TraceRing();
+        ring->tid = ++threadCount;
+        ring->next = rings.load();
+        while (!rings.compare_exchange_weak(ring->next, ring))
+            ; }
+    ring->name = threadName;
+    ringRelease.armed = true;   // Constructed on first use, so destroyed at exit
+    return ring;
+}
+
+static void Append(TraceRing* r, const TraceEvent& e)
+{
+    const long long h = r->head.load(std::memory_order_relaxed);
+    r->events[h & (RING_SIZE-1)] = e;
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+void Trace::Start()
+{
+    for (TraceRing* r=rings.load();  r;  r=r->next)
+        r->start.store(r->head.load());
+    recording = true;
+}
+
+void Trace::Stop()
+{
+    recording = false;
+}
+
+// Kept until the thread first records, so naming allocates nothing.
+void Trace::NameThread(const char* name)
+{
+    threadName = name;
+    if (ring)
+        ring->name = name;
+}
+
+void Trace::Begin(const char* name, const char* argName, const long long arg)
+{
+    TraceRing* r = ThisRing();
+    const TraceEvent e = { name, argName, arg, Nanoseconds(), 0, 'B', ++r->depth };
+    Append(r, e);
+}
+
+void Trace::End()
+{
+    TraceRing* r = ThisRing();
+    const TraceEvent e = { NULL, NULL, 0, Nanoseconds(), 0, 'E', r->depth-- };
+    Append(r, e);
+}
+
+void Trace::Gpu(const char* name, const double start, const double end)
+{
+    const TraceEvent e = { name, NULL, 0, (long long)(start*1e9), (long long)((end - start)*1e9), 'X', 0 };
+    Append(ThisRing(), e);
+}
+
+bool Trace::Write(const std::string& name)
+{
+    FILE* fp = fopen(name.c_str(), "w");
+    if (!fp) {
+        printf("Can't create file: %s\n", name.c_str());
+        return false; }
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"GPU\"}}",
+            GPU_TID);
+    int count = 0;
+    std::vector<TraceEvent> copy;
+    for (TraceRing* r=rings.load();  r;  r=r->next) {
+        if (r->name)
+            fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                    r->tid, r->name);
+
+        // Copy the ring, then drop what the thread may have
+        // overwritten meanwhile, including the slot of the event it
+        // may be writing now (event head, not yet published).
+        const long long head = r->head.load(std::memory_order_acquire);
+        long long first = std::max(r->start.load(), head - RING_SIZE);
+        copy.resize((size_t)(head - first));
+        for (long long i=first;  i<head;  i++)
+            copy[(size_t)(i - first)] = r->events[i & (RING_SIZE-1)];
+        const long long oldest = r->head.load(std::memory_order_acquire) - RING_SIZE + 1;
+        const size_t skip = (size_t)std::max(0LL, oldest - first);
+
+        for (size_t i=skip;  i<copy.size();  i++) {
+            const TraceEvent& e = copy[i];
+            const double us = e.time/1e3;
+            if (e.phase == 'X')
+                fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        e.name, GPU_TID, us, e.duration/1e3);
+            else if (e.phase == 'E')
+                fprintf(fp, ",\n{\"ph\": \"E\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f}", r->tid, us);
+            else if (e.argName)
+                fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"B\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"args\": {\"depth\": %d, \"%s\": %lld}}",
+                        e.name, r->tid, us, e.depth, e.argName, e.arg);
+            else
+                fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"B\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"args\": {\"depth\": %d}}",
+                        e.name, r->tid, us, e.depth);
+            count++; } }
+    fprintf(fp, "\n]}\n");
+    const bool ok = fclose(fp) == 0;
+    if (ok)
+        printf("Wrote %d trace events to %s\n", count, name.c_str());
+    else
+        printf("Trace write error in %s\n", name.c_str());
+    return ok;
+}
@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////
+// A timeline of what every thread was doing, for finding hitches
+// after the fact, written in the Chrome trace_event JSON format (open
+// it at chrome://tracing or ui.perfetto.dev).
+//
+// Code marks a scope with TRACE_SCOPE("name"), or TRACE_SCOPE_ARG to
+// attach a number (e.g. an object's id).  While recording, entering
+// and leaving the scope append begin and end events, stamped with a
+// steady clock and the scope's nesting depth, to a ring buffer owned
+// by the thread, so recording takes no lock and the rings' oldest
+// events are simply overwritten.  When not recording, a scope costs
+// one relaxed atomic load.  Names must be string literals (or
+// otherwise outlive the trace), since only their pointers are kept.
+//
+// The Profiler adds its passes, and when recording, also places the
+// passes' GPU execution on the timeline, as a separate "GPU" thread.
+//
+// Write() may be called at any time: events a thread overwrites while
+// they are being copied are left out.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _TRACE_
+#define _TRACE_
+
+#include <string>
+#include <atomic>
+
+class Trace
+{
+public:
+    // Start (discarding any earlier events) and stop recording.
+    static void Start();
+    static void Stop();
+    static bool Recording() { return recording.load(std::memory_order_relaxed); }
+
+    // Name the calling thread in the trace.
+    static void NameThread(const char* name);
+
+    static void Begin(const char* name, const char* argName=NULL, const long long arg=0);
+    static void End();
+
+    // A span of GPU execution, in Now()'s seconds.
+    static void Gpu(const char* name, const double start, const double end);
+
+    // Seconds on the trace's clock, a steady clock; also what the
+    // rest of the program times things with.
+    static double Now();
+
+    // Write the events recorded so far.  Prints a message and returns
+    // false on error.
+    static bool Write(const std::string& name);
+
+private:
+    static std::atomic<bool> recording;
+};
+
+class TraceScope
+{
+public:
+    TraceScope(const char* name, const char* argName=NULL, const long long arg=0)
+        : active(Trace::Recording())
+    {
+        if (active)
+            Trace::Begin(name, argName, arg);
+    }
+    ~TraceScope()
+    {
+        if (active)
+            Trace::End();
+    }
+private:
+    bool active;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, argName, arg) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, argName, arg)
+
+#endif
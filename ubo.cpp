@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////
+// Uniform buffer objects.  See ubo.h for an overview.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glbinding/gl/gl.h>
+#include <glbinding/Binding.h>
+using namespace gl;
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "ubo.h"
+
+#define UBO_GLSL_MEMBER(type, name) "    " #type " " #name ";\n"
+
+std::string UniformBlockSource()
+{
+    char define[64];
+    sprintf(define, "#define MAX_INSTANCES %d\n", MAX_INSTANCES);
+    return std::string(
+        "// Generated from ubo.h by UniformBlockSource\n"
+        "layout(std140) uniform FrameBlock\n{\n")
+        + FRAME_BLOCK_MEMBERS(UBO_GLSL_MEMBER)
+        "};\n"
+        + define +
+        "struct DrawInstance\n{\n"
+        DRAW_INSTANCE_MEMBERS(UBO_GLSL_MEMBER)
+        "};\n"
+        "#define INSTANCE_MODEL_TR(i) transpose(mat4(instances[i].ModelTr[0], instances[i].ModelTr[1], "
+        "instances[i].ModelTr[2], vec4(0, 0, 0, 1)))\n"
+        "layout(std140) uniform ObjectBlock\n{\n"
+        OBJECT_BLOCK_MEMBERS(UBO_GLSL_MEMBER)
+        "    DrawInstance instances[MAX_INSTANCES];\n"
+        "};\n";
+}
+
+static void CheckBlockSize(const int size)
+{
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxSize);
+    if (size > maxSize) {
+        fprintf(stderr, "Uniform block of %d bytes exceeds GL_MAX_UNIFORM_BLOCK_SIZE (%d)\n", size, maxSize);
+        exit(-1); }
+}
+
+void UniformBuffer::Create(const int _size, const BlockBinding binding)
+{
+    size = _size;
+    CheckBlockSize(size);
+    glGenBuffers(1, &bufferId);
+    glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, bufferId);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformBuffer::Write(const void* data)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+    glBufferData(GL_UNIFORM_BUFFER, size, data, GL_STREAM_DRAW);
+}
+
+void UniformRing::Create(const int _size, const int _capacity, const BlockBinding _binding)
+{
+    size = _size;
+    capacity = _capacity;
+    binding = _binding;
+    next = 0;
+    CheckBlockSize(size);
+
+    // Blocks must start at multiples of the implementation's alignment.
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+
+    glGenBuffers(1, &bufferId);
+    glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+    glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformRing::Push(const void* data, const int bytes)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+    if (next + size > capacity) {
+        glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+        next = 0; }
+
+    void* block = glMapBufferRange(GL_UNIFORM_BUFFER, next, bytes,
+                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    memcpy(block, data, bytes);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, bufferId, next, size);
+    next += (bytes + align - 1)/align*align;
+}
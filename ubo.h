@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////
+// Uniform buffer objects holding the shaders' constants, in place of
+// separate glUniform calls.
+//
+// FrameBlock and ObjectBlock are the std140 uniform blocks of the same
+// names in the shaders.  Both sides are generated from the member
+// lists below: the C++ structs here, and the GLSL declarations by
+// UniformBlockSource, which ShaderProgram::AddShader puts after the
+// #version line of every shader, so the two cannot disagree.  Each
+// shader program's blocks are attached to the binding points below
+// when it is linked.  Under std140 a vec3 takes 16 bytes unless a
+// scalar follows it, and a block's size is a multiple of 16, hence
+// the pads.
+//
+// A UniformBuffer holds one block, rewritten whole: the FrameBlock is
+// written once per frame, and shared by every pass.  A UniformRing
+// holds a block per draw: an ObjectBlock, with one DrawInstance for
+// each instance the draw makes.  Only the part of the block in use is
+// written, through an unsynchronized mapping, at the ring's next free
+// offset; the whole block is bound there, as OpenGL requires, but the
+// draw reads nothing past the part written, so later blocks may
+// overlap its unused tail.  Nothing is written twice between
+// orphanings of the buffer (which happen when the ring wraps), so the
+// GPU never sees a block change under a draw already queued.
+//
+// Create exits if a block exceeds GL_MAX_UNIFORM_BLOCK_SIZE, since no
+// program using it could link.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _UBO_
+#define _UBO_
+
+#include <string>
+
+// Binding points of the uniform blocks, named in shader.cpp
+enum BlockBinding { FRAME_BINDING, OBJECT_BINDING, BLOCK_BINDINGS };
+
+// The members of each block, in order, as M(GLSL type, name).  The
+// blocks have no instance names, so their members share the shaders'
+// global names, pads included.
+#define FRAME_BLOCK_MEMBERS(M)                                          \
+    M(mat4, WorldProj) M(mat4, WorldView) M(mat4, WorldInverse)         \
+    M(mat4, LightView) M(mat4, ShadowMatrix)                            \
+    M(vec3, lightPos) M(float, framePad0)                               \
+    M(vec3, lightVal) M(float, framePad1)                               \
+    M(vec3, lightAmb) M(int, mode)                                      \
+    M(int, shadows) M(int, specLevels)                                  \
+    M(int, framePad2) M(int, framePad3)
+
+// ModelTr holds the rows of the (affine) model transformation, and
+// NormalTr the first three columns of its inverse, which the shaders
+// apply to normals as row vectors.  INSTANCE_MODEL_TR(i), in the
+// shaders, rebuilds instance i's mat4.
+#define DRAW_INSTANCE_MEMBERS(M)                                        \
+    M(mat3x4, ModelTr) M(mat3x4, NormalTr)                              \
+    M(vec3, diffuse) M(float, shininess)                                \
+    M(vec3, specular) M(int, objectId)
+
+// Followed by instances[MAX_INSTANCES]
+#define OBJECT_BLOCK_MEMBERS(M)                                         \
+    M(mat4, TextureTr)                                                  \
+    M(bool, Reflective)                                                 \
+    M(int, objectPad0) M(int, objectPad1) M(int, objectPad2)
+
+// The C++ type of each GLSL type; a std140 bool is 4 bytes
+#define UBO_TYPE_mat4 glm::mat4
+#define UBO_TYPE_mat3x4 glm::mat3x4
+#define UBO_TYPE_vec3 glm::vec3
+#define UBO_TYPE_float float
+#define UBO_TYPE_int int
+#define UBO_TYPE_bool int
+#define UBO_MEMBER(type, name) UBO_TYPE_##type name;
+
+struct FrameBlock
+{
+    FRAME_BLOCK_MEMBERS(UBO_MEMBER)
+};
+
+struct DrawInstance
+{
+    DRAW_INSTANCE_MEMBERS(UBO_MEMBER)
+};
+
+// Per draw: as many as fit (after the 80 bytes of shared members) in
+// the 16384 bytes OpenGL 3.3 guarantees for a uniform block.
+const int MAX_INSTANCES = (16384 - 80)/(int)sizeof(DrawInstance);
+
+struct ObjectBlock
+{
+    OBJECT_BLOCK_MEMBERS(UBO_MEMBER)
+    DrawInstance instances[MAX_INSTANCES];
+
+    // Bytes in use with n instances
+    static int Size(const int n) { return (int)(sizeof(ObjectBlock) - (MAX_INSTANCES - n)*sizeof(DrawInstance)); }
+};
+static_assert(sizeof(ObjectBlock) <= 16384, "ObjectBlock exceeds the guaranteed uniform block size");
+
+// The GLSL declarations of the blocks (and the DrawInstance struct and
+// MAX_INSTANCES), for ShaderProgram::AddShader.
+std::string UniformBlockSource();
+
+class UniformBuffer
+{
+public:
+    unsigned int bufferId;
+    int size;
+
+    UniformBuffer() : bufferId(0), size(0) {}
+    void Create(const int size, const BlockBinding binding);
+
+    // Replace the whole block; the old storage is orphaned, not waited for.
+    void Write(const void* data);
+};
+
+class UniformRing
+{
+public:
+    unsigned int bufferId;
+    int size;                   // Bytes in the block, as bound
+    int capacity, next;         // Bytes in the buffer, and the next free offset
+    int align;                  // Of offsets, as OpenGL requires
+    BlockBinding binding;
+
+    UniformRing() : bufferId(0), size(0), capacity(0), next(0), align(256), binding(OBJECT_BINDING) {}
+    void Create(const int size, const int capacity, const BlockBinding binding);
+
+    // Write the first bytes of a block at the next free offset, and
+    // bind the block there for the following draws.
+    void Push(const void* data, const int bytes);
+};
+
+#endif